@@ -0,0 +1,159 @@
+// BoundingBoxTreeBenchmark.cpp
+
+#include "BoundingBoxTree.h"
+#include "TriangleMesh.h"
+#include "ThreadPool.h"
+#include "LineSegment.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+
+using namespace _3DMath;
+
+static double GetSeconds( void )
+{
+	return std::chrono::duration< double >( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// This is a sphere with ripples in it, so that the triangles vary in size and the tree isn't too regular.
+static void GenerateMesh( TriangleMesh& triangleMesh, int resolution )
+{
+	for( int i = 0; i <= resolution; i++ )
+	{
+		for( int j = 0; j <= resolution; j++ )
+		{
+			double longitude = double(i) * 2.0 * M_PI / double( resolution );
+			double latitude = double(j) * M_PI / double( resolution );
+			double radius = 1.0 + 0.1 * sin( 7.0 * longitude ) * sin( 5.0 * latitude );
+
+			Vertex vertex;
+			vertex.position.Set( radius * cos( longitude ) * sin( latitude ), radius * sin( longitude ) * sin( latitude ), radius * cos( latitude ) );
+			triangleMesh.vertexArray->push_back( vertex );
+		}
+	}
+
+	for( int i = 0; i < resolution; i++ )
+	{
+		for( int j = 0; j < resolution; j++ )
+		{
+			int index = i * ( resolution + 1 ) + j;
+			triangleMesh.AddTriangle( IndexTriangle( index, index + 1, index + resolution + 2 ) );
+			triangleMesh.AddTriangle( IndexTriangle( index, index + resolution + 2, index + resolution + 1 ) );
+		}
+	}
+}
+
+// Each run is timed a few times over, and the best time taken, so that a stray hiccup doesn't count against it.
+template< typename Function >
+static double TimeBest( const Function& function, int runs = 3 )
+{
+	double bestTime = HUGE_VAL;
+	for( int i = 0; i < runs; i++ )
+	{
+		double startTime = GetSeconds();
+		function();
+		bestTime = MIN( bestTime, GetSeconds() - startTime );
+	}
+
+	return bestTime * 1000.0;
+}
+
+// This times building a tree over a generated mesh, then tracing segments one at a time and in packets of each size, and
+// then the batched queries over it, with 1, 2, 4, and so on up to the given number of threads.  The arguments are the resolution of the mesh, which has twice its square in triangles,
+// the most threads to use, which defaults to one per hardware thread, and how many queries to make of each kind.
+int main( int argc, char** argv )
+{
+	int resolution = ( argc > 1 ) ? atoi( argv[1] ) : 700;
+	int maxThreadCount = ( argc > 2 ) ? atoi( argv[2] ) : ( int )std::thread::hardware_concurrency();
+	int queryCount = ( argc > 3 ) ? atoi( argv[3] ) : 200000;
+
+	resolution = MAX( resolution, 2 );
+	maxThreadCount = MAX( maxThreadCount, 1 );
+	queryCount = MAX( queryCount, 1 );
+
+	TriangleMesh triangleMesh;
+	GenerateMesh( triangleMesh, resolution );
+	printf( "%d triangles, up to %d threads, %d queries of each kind\n\n", triangleMesh.GetTriangleCount(), maxThreadCount, queryCount );
+
+	std::vector< int > threadCountArray;
+	for( int threadCount = 1; threadCount < maxThreadCount; threadCount *= 2 )
+		threadCountArray.push_back( threadCount );
+	threadCountArray.push_back( maxThreadCount );
+
+	BoundingBoxTree boxTree;
+
+	printf( "threads      build ms   speedup\n" );
+	double serialTime = 0.0;
+	for( int i = 0; i < ( signed )threadCountArray.size(); i++ )
+	{
+		int threadCount = threadCountArray[i];
+		ThreadPool* threadPool = ( threadCount > 1 ) ? new ThreadPool( threadCount ) : nullptr;
+
+		double time = TimeBest( [ & ]() { boxTree.Build( triangleMesh, 4, threadPool ); } );
+		if( threadCount == 1 )
+			serialTime = time;
+
+		printf( "%7d %14.1f %9.2f\n", threadCount, time, serialTime / time );
+		delete threadPool;
+	}
+
+	// The segments are fanned out from a point outside the mesh, as from a camera, and the points are scattered through its box.
+	std::mt19937 generator( 1 );
+	std::uniform_real_distribution< double > distribution( -1.2, 1.2 );
+
+	std::vector< LineSegment > lineSegmentArray( queryCount );
+	std::vector< Vector > pointArray( queryCount );
+	for( int i = 0; i < queryCount; i++ )
+	{
+		lineSegmentArray[i].vertex[0].Set( 0.0, 0.0, 4.0 );
+		lineSegmentArray[i].vertex[1].Set( distribution( generator ), distribution( generator ), -4.0 );
+		pointArray[i].Set( distribution( generator ), distribution( generator ), distribution( generator ) );
+	}
+
+	std::shuffle( lineSegmentArray.begin(), lineSegmentArray.end(), generator );
+
+	std::vector< const Triangle* > triangleArray( queryCount );
+	std::vector< Vector > resultPointArray( queryCount );
+
+	// A packet size of one traces each segment by itself.  These are on one thread, so that only the packets make a difference.
+	printf( "\npacket size   Mrays/s    sorted Mrays/s\n" );
+	int packetSizeArray[] = { 1, 4, 8, 16 };
+	for( int i = 0; i < 4; i++ )
+	{
+		int packetSize = packetSizeArray[i];
+
+		double rate[2];
+		for( int j = 0; j < 2; j++ )
+		{
+			bool sortQueries = ( j == 1 ) ? true : false;
+			double time = TimeBest( [ & ]() { boxTree.FindIntersections( lineSegmentArray.data(), queryCount, triangleArray.data(), resultPointArray.data(), packetSize, nullptr, sortQueries ); } );
+			rate[j] = double( queryCount ) / ( time * 1000.0 );
+		}
+
+		printf( "%11d %9.2f %17.2f\n", packetSize, rate[0], rate[1] );
+	}
+
+	printf( "\nthreads   segments ms     sorted ms     points ms     sorted ms\n" );
+	for( int i = 0; i < ( signed )threadCountArray.size(); i++ )
+	{
+		int threadCount = threadCountArray[i];
+		ThreadPool* threadPool = ( threadCount > 1 ) ? new ThreadPool( threadCount ) : nullptr;
+
+		double time[4];
+		for( int j = 0; j < 2; j++ )
+		{
+			bool sortQueries = ( j == 1 ) ? true : false;
+			time[j] = TimeBest( [ & ]() { boxTree.FindIntersections( lineSegmentArray.data(), queryCount, triangleArray.data(), resultPointArray.data(), 16, threadPool, sortQueries ); } );
+			time[ j + 2 ] = TimeBest( [ & ]() { boxTree.FindNearestTrianglesToPoints( pointArray.data(), queryCount, triangleArray.data(), resultPointArray.data(), 0.5, threadPool, sortQueries ); } );
+		}
+
+		printf( "%7d %13.1f %13.1f %13.1f %13.1f\n", threadCount, time[0], time[1], time[2], time[3] );
+		delete threadPool;
+	}
+
+	return 0;
+}
+
+// BoundingBoxTreeBenchmark.cpp
@@ -60,7 +60,7 @@ bool AxisAlignedBox::Intersect( const AxisAlignedBox& boxA, const AxisAlignedBox
 void AxisAlignedBox::Combine( const AxisAlignedBox& boxA, const AxisAlignedBox& boxB )
 {
 	negCorner.Min( boxA.negCorner, boxB.negCorner );
-	posCorner.Max( boxA.posCorner, boxA.posCorner );
+	posCorner.Max( boxA.posCorner, boxB.posCorner );
 }
 
 void AxisAlignedBox::GetCenter( Vector& center ) const
@@ -184,6 +184,16 @@ bool AxisAlignedBox::ContainsPoint( const Vector& point, double eps /*= EPSILON*
 	return true;
 }
 
+// This is zero for a point inside the box.
+double AxisAlignedBox::DistanceToPoint( const Vector& point ) const
+{
+	Vector delta;
+	delta.x = MAX( MAX( negCorner.x - point.x, point.x - posCorner.x ), 0.0 );
+	delta.y = MAX( MAX( negCorner.y - point.y, point.y - posCorner.y ), 0.0 );
+	delta.z = MAX( MAX( negCorner.z - point.z, point.z - posCorner.z ), 0.0 );
+	return delta.Length();
+}
+
 bool AxisAlignedBox::ContainsTriangle( const Triangle& triangle, double eps /*= EPSILON*/ ) const
 {
 	for( int i = 0; i < 3; i++ )
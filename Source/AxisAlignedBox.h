@@ -36,6 +36,7 @@ public:
 	bool ContainsTriangle( const Triangle& triangle, double eps = EPSILON ) const;
 	bool ContainsLineSegment( const LineSegment& lineSegment, double eps = EPSILON ) const;
 	bool IntersectsWithLineSegment( const LineSegment& lineSegment, double eps = EPSILON ) const;
+	double DistanceToPoint( const Vector& point ) const;
 
 	static void ExpandInterval( double& min, double& max, double value );
 	static bool InInterval( double min, double max, double value, double eps = EPSILON );
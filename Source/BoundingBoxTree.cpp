@@ -2,100 +2,2943 @@
 
 #include "BoundingBoxTree.h"
 #include "LineSegment.h"
+#include "TriangleMesh.h"
+#include "ThreadPool.h"
+#include "AffineTransform.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#	define BOUNDING_BOX_TREE_SSE2
+#	include <emmintrin.h>
+#endif
 
 using namespace _3DMath;
 
-//-----------------------------------------------------------------------------------------------------------
-//                                           BoundingBoxTree
-//-----------------------------------------------------------------------------------------------------------
+//-----------------------------------------------------------------------------------------------------------
+//                                           BoundingBoxTree
+//-----------------------------------------------------------------------------------------------------------
+
+// Queries that hand back triangles may be made from several threads at once, so the first of them to need the triangles copied out of the records
+// does it while holding the lock, and the rest wait for it.
+struct BoundingBoxTree::FlatTriangleState
+{
+	std::mutex mutex;
+	std::atomic< bool > ready;
+};
+
+BoundingBoxTree::BoundingBoxTree( void )
+{
+	rootNode = nullptr;
+	flatNodeArray = new FlatNodeArray();
+	flatTriangleArray = new std::vector< Triangle >();
+	flatTriangleState = new FlatTriangleState();
+	flatTriangleState->ready = false;
+	flatTriangleSlotArray = new std::vector< int >();
+	flatTriangleMeshArray = new std::vector< int >();
+	triangleRecordArray = new std::vector< double >();
+	meshTriangleArray = new std::vector< int >();
+	builtAreaArray = new std::vector< float >();
+	flatTriangleCount = 0;
+	flatTreeDepth = 0;
+	flatMaxLeafSize = 0;
+	mappedFile = nullptr;
+	mappedNodes = nullptr;
+	mappedNodeCount = 0;
+	mappedRecords = nullptr;
+	mappedMeshTriangles = nullptr;
+	mappedBuiltAreas = nullptr;
+}
+
+/*virtual*/ BoundingBoxTree::~BoundingBoxTree( void )
+{
+	delete rootNode;
+	delete mappedFile;
+	delete flatNodeArray;
+	delete flatTriangleArray;
+	delete flatTriangleState;
+	delete flatTriangleSlotArray;
+	delete flatTriangleMeshArray;
+	delete triangleRecordArray;
+	delete meshTriangleArray;
+	delete builtAreaArray;
+}
+
+void BoundingBoxTree::GenerateNodes( const AxisAlignedBox& rootBox, int depth )
+{
+	if( rootNode )
+		delete rootNode;
+
+	ClearCompiledTree();
+
+	rootNode = CreateNode( rootBox, depth );
+}
+
+void BoundingBoxTree::ClearCompiledTree( void )
+{
+	flatNodeArray->clear();
+	flatTriangleArray->clear();
+	flatTriangleState->ready = false;
+	flatTriangleSlotArray->clear();
+	flatTriangleMeshArray->clear();
+	triangleRecordArray->clear();
+	meshTriangleArray->clear();
+	builtAreaArray->clear();
+	flatTriangleCount = 0;
+	flatTreeDepth = 0;
+	flatMaxLeafSize = 0;
+
+	delete mappedFile;
+	mappedFile = nullptr;
+	mappedNodes = nullptr;
+	mappedNodeCount = 0;
+	mappedRecords = nullptr;
+	mappedMeshTriangles = nullptr;
+	mappedBuiltAreas = nullptr;
+}
+
+bool BoundingBoxTree::IsCompiled( void ) const
+{
+	return( GetFlatNodeCount() > 0 ? true : false );
+}
+
+// Queries get at the nodes and records through these, so that they work the same on a tree loaded from a cache file.
+const BoundingBoxTree::FlatNode* BoundingBoxTree::GetFlatNodes( void ) const
+{
+	return( mappedFile ? mappedNodes : flatNodeArray->data() );
+}
+
+int BoundingBoxTree::GetFlatNodeCount( void ) const
+{
+	return( mappedFile ? mappedNodeCount : ( int )flatNodeArray->size() );
+}
+
+const double* BoundingBoxTree::GetTriangleRecords( void ) const
+{
+	return( mappedFile ? mappedRecords : triangleRecordArray->data() );
+}
+
+// This is null if the tree wasn't built from a mesh.
+const int* BoundingBoxTree::GetMeshTriangles( void ) const
+{
+	if( mappedFile )
+		return mappedMeshTriangles;
+
+	return( meshTriangleArray->size() > 0 ? meshTriangleArray->data() : nullptr );
+}
+
+const float* BoundingBoxTree::GetBuiltAreas( void ) const
+{
+	return( mappedFile ? mappedBuiltAreas : builtAreaArray->data() );
+}
+
+// A tree built from a mesh, or loaded from a cache file, has only its records until a query has to hand back triangles, and then
+// they're made from the records once and for all.  The triangles start out in the same order as the records, but never move after.
+const Triangle* BoundingBoxTree::GetFlatTriangles( void ) const
+{
+	if( !flatTriangleState->ready.load( std::memory_order_acquire ) )
+	{
+		std::lock_guard< std::mutex > lock( flatTriangleState->mutex );
+		if( !flatTriangleState->ready.load( std::memory_order_relaxed ) )
+		{
+			flatTriangleArray->resize( flatTriangleCount );
+			for( int i = 0; i < flatTriangleCount; i++ )
+				GetRecordVertices( i, ( *flatTriangleArray )[i].vertex );
+
+			flatTriangleState->ready.store( true, std::memory_order_release );
+		}
+	}
+
+	return flatTriangleArray->data();
+}
+
+// A refit that rebuilds moves the records about, but not the triangles, after which each record has to look up where its triangle is.
+int BoundingBoxTree::GetFlatTriangleSlot( int index ) const
+{
+	return( flatTriangleSlotArray->size() > 0 ? ( *flatTriangleSlotArray )[ index ] : index );
+}
+
+const Triangle* BoundingBoxTree::GetFlatTriangle( int index ) const
+{
+	const Triangle* flatTriangles = GetFlatTriangles();
+	return flatTriangles + GetFlatTriangleSlot( index );
+}
+
+// Each mesh triangle appears in the tree at most once, so it ties each record to its triangle however the records have been moved.
+void BoundingBoxTree::MatchFlatTriangles( void )
+{
+	int maxMeshTriangle = -1;
+	for( int i = 0; i < ( signed )flatTriangleMeshArray->size(); i++ )
+		maxMeshTriangle = MAX( maxMeshTriangle, ( *flatTriangleMeshArray )[i] );
+
+	std::vector< int > slotArray( maxMeshTriangle + 1 );
+	for( int i = 0; i < ( signed )flatTriangleMeshArray->size(); i++ )
+		slotArray[ ( *flatTriangleMeshArray )[i] ] = i;
+
+	flatTriangleSlotArray->resize( flatTriangleCount );
+	for( int i = 0; i < flatTriangleCount; i++ )
+		( *flatTriangleSlotArray )[i] = slotArray[ ( *meshTriangleArray )[i] ];
+}
+
+// A compiled tree is one array of nodes laid out depth-first, in which the first child of a branch immediately follows it, and one array
+// of triangle records, in which each leaf owns a contiguous range.  Queries then walk the nodes with an explicit stack and no virtual calls.
+// This fails if a leaf has more triangles than a compiled node can count.
+bool BoundingBoxTree::Compile( void )
+{
+	if( !rootNode )
+		return false;
+
+	ClearCompiledTree();
+
+	if( !CompileNode( rootNode, 1 ) )
+	{
+		ClearCompiledTree();
+		return false;
+	}
+
+	flatTriangleCount = ( int )flatTriangleArray->size();
+	flatTriangleState->ready = true;
+
+	triangleRecordArray->resize( TRIANGLE_RECORD_COMPONENTS * flatTriangleCount );
+	for( int i = 0; i < flatTriangleCount; i++ )
+		SetTriangleRecord( i, ( *flatTriangleArray )[i] );
+
+	delete rootNode;
+	rootNode = nullptr;
+	return true;
+}
+
+bool BoundingBoxTree::CompileNode( const Node* node, int depth )
+{
+	flatTreeDepth = MAX( flatTreeDepth, depth );
+
+	int index = ( int )flatNodeArray->size();
+	flatNodeArray->push_back( FlatNode() );
+
+	double min[3] = { node->boundingBox.negCorner.x, node->boundingBox.negCorner.y, node->boundingBox.negCorner.z };
+	double max[3] = { node->boundingBox.posCorner.x, node->boundingBox.posCorner.y, node->boundingBox.posCorner.z };
+	SetFlatNodeBox( ( *flatNodeArray )[ index ], min, max );
+
+	const BranchNode* branchNode = dynamic_cast< const BranchNode* >( node );
+	if( branchNode )
+	{
+		const Vector& normal = branchNode->plane.normal;
+		int axis = 0;
+		if( fabs( normal.y ) > fabs( normal.x ) )
+			axis = 1;
+		if( fabs( normal.z ) > fabs( axis == 0 ? normal.x : normal.y ) )
+			axis = 2;
+
+		if( !CompileNode( branchNode->backNode, depth + 1 ) )
+			return false;
+
+		FlatNode& flatNode = ( *flatNodeArray )[ index ];
+		flatNode.offset = ( int )flatNodeArray->size();
+		flatNode.count = 0;
+		flatNode.axis = ( unsigned short )axis;
+
+		return CompileNode( branchNode->frontNode, depth + 1 );
+	}
+
+	const LeafNode* leafNode = dynamic_cast< const LeafNode* >( node );
+	if( !leafNode || leafNode->triangleList->size() > 0xFFFF )
+		return false;
+
+	FlatNode& flatNode = ( *flatNodeArray )[ index ];
+	flatNode.offset = ( int )flatTriangleArray->size();
+	flatNode.count = ( unsigned short )leafNode->triangleList->size();
+	flatNode.axis = FlatNode::LEAF_AXIS;
+
+	flatTriangleArray->insert( flatTriangleArray->end(), leafNode->triangleList->cbegin(), leafNode->triangleList->cend() );
+	return true;
+}
+
+/*static*/ void BoundingBoxTree::SetFlatNodeBox( FlatNode& flatNode, const double* min, const double* max )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		flatNode.min[i] = float( min[i] );
+		if( double( flatNode.min[i] ) > min[i] )
+			flatNode.min[i] = nextafterf( flatNode.min[i], -HUGE_VALF );
+
+		flatNode.max[i] = float( max[i] );
+		if( double( flatNode.max[i] ) < max[i] )
+			flatNode.max[i] = nextafterf( flatNode.max[i], HUGE_VALF );
+	}
+}
+
+BoundingBoxTree::Node* BoundingBoxTree::CreateNode( const AxisAlignedBox& boundingBox, int depth )
+{
+	Node* node = nullptr;
+	
+	if( depth == 1 )
+		node = new LeafNode();
+	else
+	{
+		BranchNode* branchNode = new BranchNode();
+
+		node = branchNode;
+	
+		AxisAlignedBox boxA, boxB;
+		boundingBox.SplitInTwo( boxA, boxB, &branchNode->plane );
+
+		branchNode->backNode = CreateNode( boxA, depth - 1 );
+		branchNode->frontNode = CreateNode( boxB, depth - 1 );
+	}
+
+	node->boundingBox = boundingBox;
+
+	return node;
+}
+
+bool BoundingBoxTree::Build( const TriangleList& triangleList, int maxLeafSize /*= 4*/, ThreadPool* threadPool /*= nullptr*/ )
+{
+	std::vector< Triangle > triangleArray( triangleList.cbegin(), triangleList.cend() );
+	return Build( triangleArray, nullptr, maxLeafSize, threadPool );
+}
+
+bool BoundingBoxTree::Build( const TriangleMesh& triangleMesh, int maxLeafSize /*= 4*/, ThreadPool* threadPool /*= nullptr*/ )
+{
+	std::vector< Triangle > triangleArray;
+	triangleArray.reserve( triangleMesh.GetTriangleCount() );
+
+	std::vector< int > meshTriangleArray;
+	meshTriangleArray.reserve( triangleMesh.GetTriangleCount() );
+
+	for( int i = 0; i < ( signed )triangleMesh.triangleArray->size(); i++ )
+	{
+		Triangle triangle;
+		if( ( *triangleMesh.triangleArray )[i].GetTriangle( triangle, triangleMesh.vertexArray ) )
+		{
+			triangleArray.push_back( triangle );
+			meshTriangleArray.push_back(i);
+		}
+	}
+
+	return Build( triangleArray, &meshTriangleArray, maxLeafSize, threadPool );
+}
+
+#define BUILD_GRAIN_SIZE			16384
+#define PARALLEL_SPLIT_SIZE			65536
+#define NEAR_ROOT_FRACTION			16
+#define TASK_SPLIT_SIZE				4096
+
+// A build job is a subtree under construction.  It either holds the subtree's nodes, numbered as if the subtree were
+// the whole tree, or, if it was split to be built in parallel, the subtree's root and the jobs for its two halves.
+struct BoundingBoxTree::BuildJob
+{
+	BuildJob( int begin, int end, int depth )
+	{
+		this->begin = begin;
+		this->end = end;
+		this->depth = depth;
+		treeDepth = depth;
+		childJob[0] = nullptr;
+		childJob[1] = nullptr;
+	}
+
+	~BuildJob( void )
+	{
+		delete childJob[0];
+		delete childJob[1];
+	}
+
+	int begin, end, depth;
+	int treeDepth;
+	FlatNode node;
+	BuildJob* childJob[2];
+	FlatNodeArray nodeArray;
+};
+
+// Rather than cut space into a fixed number of levels and then cut triangles to fit, this builds the tree to fit the triangles.  Each branch
+// divides its triangles into two groups by the position of their centers, choosing the split that the surface area heuristic predicts is
+// cheapest to trace rays through, so the children's boxes may overlap, but no triangle is ever split or duplicated.  A leaf is made once
+// splitting no longer pays, or once there is no way left to split.  Given a thread pool, the result is the same, only sooner.
+bool BoundingBoxTree::Build( const std::vector< Triangle >& triangleArray, const std::vector< int >* meshTriangleArray, int maxLeafSize, ThreadPool* threadPool )
+{
+	delete rootNode;
+	rootNode = nullptr;
+
+	ClearCompiledTree();
+
+	if( triangleArray.size() == 0 )
+		return false;
+
+	int count = ( int )triangleArray.size();
+	maxLeafSize = MIN( MAX( maxLeafSize, 1 ), 0xFFFF );
+
+	BuildPrimitiveArray primitiveArray( count );
+	ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+		for( int i = begin; i < end; i++ )
+			primitiveArray[i].Set( triangleArray[i], i );
+	} );
+
+	BuildContext context;
+	context.primitiveArray = &primitiveArray;
+	context.maxLeafSize = maxLeafSize;
+	context.nearRootSize = MAX( PARALLEL_SPLIT_SIZE, count / NEAR_ROOT_FRACTION );
+	context.threadPool = threadPool;
+
+	if( !threadPool || threadPool->GetThreadCount() == 1 )
+		BuildNode( context, 0, count, 1, *flatNodeArray, flatTreeDepth );
+	else
+	{
+		// The first few splits each cover a good share of the triangles, so we make them one at a time, but with every
+		// thread helping to bin the triangles and divide them.  That leaves a set of subtrees to build as tasks.
+		std::vector< BuildJob* > pendingJobArray;
+		BuildJob rootJob( 0, count, 1 );
+		PlanBuildJob( context, &rootJob, pendingJobArray );
+
+		threadPool->RunTasks( [ & ]() {
+			for( int i = 0; i < ( signed )pendingJobArray.size(); i++ )
+			{
+				BuildJob* job = pendingJobArray[i];
+				threadPool->SpawnTask( [ this, &context, job ]() { RunBuildJob( context, job ); } );
+			}
+		} );
+
+		StitchBuildJob( &rootJob );
+	}
+
+	// The build leaves each leaf's triangles together, so the triangles are recorded in the order it left them.
+	flatTriangleCount = count;
+	triangleRecordArray->resize( TRIANGLE_RECORD_COMPONENTS * count );
+	ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+		for( int i = begin; i < end; i++ )
+			SetTriangleRecord( i, triangleArray[ primitiveArray[i].triangle ] );
+	} );
+
+	// A tree built from a list of triangles can only hand back triangles, so it keeps them, but one built from a mesh keeps just the records.
+	if( !meshTriangleArray )
+	{
+		flatTriangleArray->resize( count );
+		ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+			for( int i = begin; i < end; i++ )
+				( *flatTriangleArray )[i] = triangleArray[ primitiveArray[i].triangle ];
+		} );
+
+		flatTriangleState->ready = true;
+	}
+	else
+	{
+		this->meshTriangleArray->resize( count );
+		ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+			for( int i = begin; i < end; i++ )
+				( *this->meshTriangleArray )[i] = ( *meshTriangleArray )[ primitiveArray[i].triangle ];
+		} );
+
+		flatMaxLeafSize = maxLeafSize;
+		builtAreaArray->resize( flatNodeArray->size() );
+		RecordBuiltAreas( threadPool );
+	}
+
+	return true;
+}
+
+/*static*/ void BoundingBoxTree::ParallelFor( ThreadPool* threadPool, int count, const std::function< void( int, int ) >& rangeFunction )
+{
+	if( threadPool )
+		threadPool->ParallelFor( count, BUILD_GRAIN_SIZE, rangeFunction );
+	else
+		rangeFunction( 0, count );
+}
+
+void BoundingBoxTree::PlanBuildJob( const BuildContext& context, BuildJob* job, std::vector< BuildJob* >& pendingJobArray )
+{
+	if( job->end - job->begin < context.nearRootSize )
+	{
+		pendingJobArray.push_back( job );
+		return;
+	}
+
+	BuildSplit buildSplit;
+	SplitPrimitives( context, job->begin, job->end, buildSplit, true );
+	SetFlatNodeBox( job->node, buildSplit.box.min, buildSplit.box.max );
+
+	if( buildSplit.axis < 0 )
+	{
+		// This can only be a leaf of coincident triangles, as many as are allowed, which is no job for a thread pool.
+		pendingJobArray.push_back( job );
+		return;
+	}
+
+	job->node.count = 0;
+	job->node.axis = ( unsigned short )buildSplit.axis;
+	job->childJob[0] = new BuildJob( job->begin, buildSplit.split, job->depth + 1 );
+	job->childJob[1] = new BuildJob( buildSplit.split, job->end, job->depth + 1 );
+
+	for( int i = 0; i < 2; i++ )
+		PlanBuildJob( context, job->childJob[i], pendingJobArray );
+}
+
+// Large subtrees are split further into tasks, so that idle threads can steal part of the work.
+void BoundingBoxTree::RunBuildJob( const BuildContext& context, BuildJob* job )
+{
+	if( job->end - job->begin < TASK_SPLIT_SIZE )
+	{
+		BuildNode( context, job->begin, job->end, job->depth, job->nodeArray, job->treeDepth );
+		return;
+	}
+
+	BuildSplit buildSplit;
+	SplitPrimitives( context, job->begin, job->end, buildSplit, false );
+	SetFlatNodeBox( job->node, buildSplit.box.min, buildSplit.box.max );
+
+	if( buildSplit.axis < 0 )
+	{
+		BuildNode( context, job->begin, job->end, job->depth, job->nodeArray, job->treeDepth );
+		return;
+	}
+
+	job->node.count = 0;
+	job->node.axis = ( unsigned short )buildSplit.axis;
+	job->childJob[0] = new BuildJob( job->begin, buildSplit.split, job->depth + 1 );
+	job->childJob[1] = new BuildJob( buildSplit.split, job->end, job->depth + 1 );
+
+	BuildJob* childJob = job->childJob[1];
+	context.threadPool->SpawnTask( [ this, &context, childJob ]() { RunBuildJob( context, childJob ); } );
+
+	RunBuildJob( context, job->childJob[0] );
+}
+
+// This appends the job's subtree to the tree in depth-first order, so the result is just what a serial build makes.
+void BoundingBoxTree::StitchBuildJob( const BuildJob* job )
+{
+	flatTreeDepth = MAX( flatTreeDepth, job->treeDepth );
+
+	if( !job->childJob[0] )
+	{
+		int base = ( int )flatNodeArray->size();
+		for( int i = 0; i < ( signed )job->nodeArray.size(); i++ )
+		{
+			FlatNode flatNode = job->nodeArray[i];
+			if( !flatNode.IsLeaf() )
+				flatNode.offset += base;
+			flatNodeArray->push_back( flatNode );
+		}
+
+		return;
+	}
+
+	int index = ( int )flatNodeArray->size();
+	flatNodeArray->push_back( job->node );
+
+	StitchBuildJob( job->childJob[0] );
+	( *flatNodeArray )[ index ].offset = ( int )flatNodeArray->size();
+	StitchBuildJob( job->childJob[1] );
+}
+
+void BoundingBoxTree::BuildPrimitive::Set( const Triangle& triangle, int index )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		double point[3] = { triangle.vertex[i].x, triangle.vertex[i].y, triangle.vertex[i].z };
+		if( i == 0 )
+		{
+			for( int j = 0; j < 3; j++ )
+				box.min[j] = box.max[j] = point[j];
+		}
+		else
+			box.GrowToIncludePoint( point );
+	}
+
+	for( int i = 0; i < 3; i++ )
+		center[i] = 0.5 * ( box.min[i] + box.max[i] );
+
+	this->triangle = index;
+}
+
+void BoundingBoxTree::BuildBox::Set( const BuildBox& box )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		min[i] = box.min[i];
+		max[i] = box.max[i];
+	}
+}
+
+void BoundingBoxTree::BuildBox::Grow( const BuildBox& box )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		min[i] = MIN( min[i], box.min[i] );
+		max[i] = MAX( max[i], box.max[i] );
+	}
+}
+
+void BoundingBoxTree::BuildBox::GrowToIncludePoint( const double* point )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		min[i] = MIN( min[i], point[i] );
+		max[i] = MAX( max[i], point[i] );
+	}
+}
+
+double BoundingBoxTree::BuildBox::SurfaceArea( void ) const
+{
+	double x = max[0] - min[0];
+	double y = max[1] - min[1];
+	double z = max[2] - min[2];
+	return 2.0 * ( x * y + y * z + z * x );
+}
+
+#define SAH_BIN_COUNT		16
+
+struct BoundingBoxTree::BuildBins
+{
+	BuildBins( void )
+	{
+		for( int axis = 0; axis < 3; axis++ )
+			for( int bin = 0; bin < SAH_BIN_COUNT; bin++ )
+				count[ axis ][ bin ] = 0;
+	}
+
+	void Add( const BuildPrimitive* primitives, int begin, int end, const double* centerMin, const double* scale )
+	{
+		for( int i = begin; i < end; i++ )
+		{
+			const BuildPrimitive& primitive = primitives[i];
+			for( int axis = 0; axis < 3; axis++ )
+			{
+				int bin = MIN( int( ( primitive.center[ axis ] - centerMin[ axis ] ) * scale[ axis ] ), SAH_BIN_COUNT - 1 );
+				if( count[ axis ][ bin ]++ == 0 )
+					box[ axis ][ bin ].Set( primitive.box );
+				else
+					box[ axis ][ bin ].Grow( primitive.box );
+			}
+		}
+	}
+
+	void Merge( const BuildBins& bins )
+	{
+		for( int axis = 0; axis < 3; axis++ )
+		{
+			for( int bin = 0; bin < SAH_BIN_COUNT; bin++ )
+			{
+				if( bins.count[ axis ][ bin ] == 0 )
+					continue;
+
+				if( count[ axis ][ bin ] == 0 )
+					box[ axis ][ bin ].Set( bins.box[ axis ][ bin ] );
+				else
+					box[ axis ][ bin ].Grow( bins.box[ axis ][ bin ] );
+
+				count[ axis ][ bin ] += bins.count[ axis ][ bin ];
+			}
+		}
+	}
+
+	int count[3][ SAH_BIN_COUNT ];
+	BuildBox box[3][ SAH_BIN_COUNT ];
+};
+
+/*static*/ void BoundingBoxTree::BoundPrimitives( const BuildPrimitive* primitives, int begin, int end, BuildBox& box, BuildBox& centerBox )
+{
+	box.Set( primitives[ begin ].box );
+	for( int k = 0; k < 3; k++ )
+		centerBox.min[k] = centerBox.max[k] = primitives[ begin ].center[k];
+
+	for( int i = begin + 1; i < end; i++ )
+	{
+		box.Grow( primitives[i].box );
+		centerBox.GrowToIncludePoint( primitives[i].center );
+	}
+}
+
+// This finds the bounds of the given triangles, and, if they are to be split, how to split them, dividing them accordingly.
+// A thread pool helps with this only near the root, where there are enough triangles to go around.  There, each pass over
+// the triangles is shared out between threads.  The passes compute nothing but minima, maxima and counts, which don't depend
+// on the order in which things are combined, and the triangles are divided with a stable partition, which has only one
+// possible outcome, so the result is exactly what it would be without the thread pool.
+/*static*/ void BoundingBoxTree::SplitPrimitives( const BuildContext& context, int begin, int end, BuildSplit& buildSplit, bool useThreadPool )
+{
+	BuildPrimitiveArray& primitiveArray = *context.primitiveArray;
+	int maxLeafSize = context.maxLeafSize;
+	int count = end - begin;
+
+	bool nearRoot = ( count >= context.nearRootSize );
+	ThreadPool* threadPool = ( nearRoot && useThreadPool ) ? context.threadPool : nullptr;
+
+	int chunkCount = ( count + BUILD_GRAIN_SIZE - 1 ) / BUILD_GRAIN_SIZE;
+	const BuildPrimitive* primitives = &primitiveArray[0];
+
+	BuildBox& box = buildSplit.box;
+	BuildBox centerBox;
+
+	if( !threadPool )
+		BoundPrimitives( primitives, begin, end, box, centerBox );
+	else
+	{
+		std::vector< BuildBox > chunkBoxArray( chunkCount ), chunkCenterBoxArray( chunkCount );
+		threadPool->ParallelFor( count, BUILD_GRAIN_SIZE, [ & ]( int chunkBegin, int chunkEnd ) {
+			int chunk = chunkBegin / BUILD_GRAIN_SIZE;
+			BoundPrimitives( primitives, begin + chunkBegin, begin + chunkEnd, chunkBoxArray[ chunk ], chunkCenterBoxArray[ chunk ] );
+		} );
+
+		box.Set( chunkBoxArray[0] );
+		centerBox.Set( chunkCenterBoxArray[0] );
+		for( int i = 1; i < chunkCount; i++ )
+		{
+			box.Grow( chunkBoxArray[i] );
+			centerBox.Grow( chunkCenterBoxArray[i] );
+		}
+	}
+
+	// Bin the triangles by center along each axis, then sweep the bins to price every split between them.
+	// The costs are relative to that of intersecting one triangle, taking a traversal step as equally costly.
+	int bestAxis = -1, bestSplit = 0;
+	double bestCost = double( count );
+
+	double scale[3];
+	for( int axis = 0; axis < 3; axis++ )
+	{
+		double extent = centerBox.max[ axis ] - centerBox.min[ axis ];
+		scale[ axis ] = ( extent > 0.0 ) ? double( SAH_BIN_COUNT ) / extent : 0.0;
+	}
+
+	if( count > 1 )
+	{
+		// All three axes are binned in one pass over the triangles.
+		BuildBins bins;
+
+		if( !threadPool )
+			bins.Add( primitives, begin, end, centerBox.min, scale );
+		else
+		{
+			std::vector< BuildBins > chunkBinsArray( chunkCount );
+			threadPool->ParallelFor( count, BUILD_GRAIN_SIZE, [ & ]( int chunkBegin, int chunkEnd ) {
+				chunkBinsArray[ chunkBegin / BUILD_GRAIN_SIZE ].Add( primitives, begin + chunkBegin, begin + chunkEnd, centerBox.min, scale );
+			} );
+
+			for( int i = 0; i < chunkCount; i++ )
+				bins.Merge( chunkBinsArray[i] );
+		}
+
+		double parentArea = box.SurfaceArea();
+
+		for( int axis = 0; axis < 3; axis++ )
+		{
+			if( scale[ axis ] == 0.0 )
+				continue;
+
+			double rightArea[ SAH_BIN_COUNT ];
+			int rightCount[ SAH_BIN_COUNT ];
+			BuildBox sweepBox;
+			int sweepCount = 0;
+
+			for( int bin = SAH_BIN_COUNT - 1; bin > 0; bin-- )
+			{
+				if( bins.count[ axis ][ bin ] > 0 )
+				{
+					if( sweepCount == 0 )
+						sweepBox.Set( bins.box[ axis ][ bin ] );
+					else
+						sweepBox.Grow( bins.box[ axis ][ bin ] );
+					sweepCount += bins.count[ axis ][ bin ];
+				}
+
+				rightArea[ bin ] = ( sweepCount > 0 ) ? sweepBox.SurfaceArea() : 0.0;
+				rightCount[ bin ] = sweepCount;
+			}
+
+			sweepCount = 0;
+			for( int bin = 0; bin < SAH_BIN_COUNT - 1; bin++ )
+			{
+				if( bins.count[ axis ][ bin ] > 0 )
+				{
+					if( sweepCount == 0 )
+						sweepBox.Set( bins.box[ axis ][ bin ] );
+					else
+						sweepBox.Grow( bins.box[ axis ][ bin ] );
+					sweepCount += bins.count[ axis ][ bin ];
+				}
+
+				if( sweepCount == 0 || rightCount[ bin + 1 ] == 0 )
+					continue;
+
+				double cost = 1.0 + ( sweepBox.SurfaceArea() * double( sweepCount ) + rightArea[ bin + 1 ] * double( rightCount[ bin + 1 ] ) ) / parentArea;
+				if( bestAxis < 0 || cost < bestCost )
+				{
+					bestAxis = axis;
+					bestSplit = bin + 1;
+					bestCost = cost;
+				}
+			}
+		}
+	}
+
+	buildSplit.axis = -1;
+	buildSplit.split = end;
+
+	// Splitting, even at a loss, beats letting a leaf grow past its limit.
+	if( bestAxis >= 0 && ( count > maxLeafSize || bestCost < double( count ) ) )
+	{
+		double min = centerBox.min[ bestAxis ];
+		double axisScale = scale[ bestAxis ];
+
+		auto isOnLeft = [ & ]( const BuildPrimitive& primitive ) {
+			return MIN( int( ( primitive.center[ bestAxis ] - min ) * axisScale ), SAH_BIN_COUNT - 1 ) < bestSplit;
+		};
+
+		BuildPrimitive* first = &primitiveArray[0] + begin;
+		BuildPrimitive* last = &primitiveArray[0] + end;
+
+		buildSplit.axis = bestAxis;
+		if( !nearRoot )
+			buildSplit.split = int( std::partition( first, last, isOnLeft ) - &primitiveArray[0] );
+		else if( !threadPool )
+			buildSplit.split = int( std::stable_partition( first, last, isOnLeft ) - &primitiveArray[0] );
+		else
+			buildSplit.split = begin + StablePartition( first, count, isOnLeft, threadPool );
+	}
+	else if( count > maxLeafSize )
+	{
+		// With every center in the same place, there's nothing to go on, so we just split the list in half.
+		buildSplit.axis = 0;
+		buildSplit.split = begin + count / 2;
+	}
+}
+
+// This moves the primitives satisfying the given predicate to the front, without otherwise changing their order, and returns how many there are.
+/*static*/ int BoundingBoxTree::StablePartition( BuildPrimitive* primitives, int count, const std::function< bool( const BuildPrimitive& ) >& isOnLeft, ThreadPool* threadPool )
+{
+	int chunkCount = ( count + BUILD_GRAIN_SIZE - 1 ) / BUILD_GRAIN_SIZE;
+	std::vector< int > leftCountArray( chunkCount + 1, 0 );
+	std::vector< char > isOnLeftArray( count );
+
+	threadPool->ParallelFor( count, BUILD_GRAIN_SIZE, [ & ]( int chunkBegin, int chunkEnd ) {
+		int leftCount = 0;
+		for( int i = chunkBegin; i < chunkEnd; i++ )
+		{
+			isOnLeftArray[i] = isOnLeft( primitives[i] ) ? 1 : 0;
+			leftCount += isOnLeftArray[i];
+		}
+		leftCountArray[ chunkBegin / BUILD_GRAIN_SIZE + 1 ] = leftCount;
+	} );
+
+	for( int i = 0; i < chunkCount; i++ )
+		leftCountArray[ i + 1 ] += leftCountArray[i];
+
+	int totalLeftCount = leftCountArray[ chunkCount ];
+
+	BuildPrimitiveArray partitionArray( count );
+	threadPool->ParallelFor( count, BUILD_GRAIN_SIZE, [ & ]( int chunkBegin, int chunkEnd ) {
+		int chunk = chunkBegin / BUILD_GRAIN_SIZE;
+		int left = leftCountArray[ chunk ];
+		int right = totalLeftCount + chunkBegin - leftCountArray[ chunk ];
+		for( int i = chunkBegin; i < chunkEnd; i++ )
+		{
+			if( isOnLeftArray[i] )
+				partitionArray[ left++ ] = primitives[i];
+			else
+				partitionArray[ right++ ] = primitives[i];
+		}
+	} );
+
+	threadPool->ParallelFor( count, BUILD_GRAIN_SIZE, [ & ]( int chunkBegin, int chunkEnd ) {
+		std::copy( &partitionArray[0] + chunkBegin, &partitionArray[0] + chunkEnd, primitives + chunkBegin );
+	} );
+
+	return totalLeftCount;
+}
+
+/*static*/ void BoundingBoxTree::BuildNode( const BuildContext& context, int begin, int end, int depth, FlatNodeArray& nodeArray, int& treeDepth )
+{
+	treeDepth = MAX( treeDepth, depth );
+
+	BuildSplit buildSplit;
+	SplitPrimitives( context, begin, end, buildSplit, false );
+
+	int index = ( int )nodeArray.size();
+	nodeArray.push_back( FlatNode() );
+	SetFlatNodeBox( nodeArray[ index ], buildSplit.box.min, buildSplit.box.max );
+
+	if( buildSplit.axis >= 0 )
+	{
+		BuildNode( context, begin, buildSplit.split, depth + 1, nodeArray, treeDepth );
+
+		FlatNode& flatNode = nodeArray[ index ];
+		flatNode.offset = ( int )nodeArray.size();
+		flatNode.count = 0;
+		flatNode.axis = ( unsigned short )buildSplit.axis;
+
+		BuildNode( context, buildSplit.split, end, depth + 1, nodeArray, treeDepth );
+	}
+	else
+	{
+		FlatNode& flatNode = nodeArray[ index ];
+		flatNode.offset = begin;
+		flatNode.count = ( unsigned short )( end - begin );
+		flatNode.axis = FlatNode::LEAF_AXIS;
+	}
+}
+
+bool BoundingBoxTree::CanRefit( void ) const
+{
+	return( IsCompiled() && GetMeshTriangles() ? true : false );
+}
+
+// When a mesh deforms, as cloth does, refitting is much cheaper than rebuilding.  The triangles are read back from the mesh and the boxes
+// recomputed from the leaves up, in time linear in the size of the mesh.  The tree's shape doesn't change, so queries slow down as the triangles
+// drift away from where it was built for, which is what rebuilding the subtrees that have grown too much makes up for.
+bool BoundingBoxTree::Refit( const TriangleMesh& triangleMesh, double rebuildFactor /*= 0.0*/, ThreadPool* threadPool /*= nullptr*/ )
+{
+	if( !CanRefit() )
+		return false;
+
+	ReleaseMappedFile();
+
+	int count = flatTriangleCount;
+	int meshTriangleCount = ( int )triangleMesh.triangleArray->size();
+	std::atomic< bool > success( true );
+
+	ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+		Triangle triangle;
+		for( int i = begin; i < end; i++ )
+		{
+			int meshTriangle = ( *meshTriangleArray )[i];
+			if( meshTriangle >= meshTriangleCount || !( *triangleMesh.triangleArray )[ meshTriangle ].GetTriangle( triangle, triangleMesh.vertexArray ) )
+			{
+				success = false;
+				break;
+			}
+
+			SetTriangleRecord( i, triangle );
+		}
+	} );
+
+	if( !success )
+	{
+		ClearCompiledTree();
+		return false;
+	}
+
+	RefitNodes( threadPool );
+
+	if( rebuildFactor > 0.0 )
+	{
+		// Taking the subtrees to rebuild from the top down, we get only the largest of any nested ones.
+		std::vector< int > rootArray;
+		int index = 0;
+		while( index < ( signed )flatNodeArray->size() )
+		{
+			const FlatNode& flatNode = ( *flatNodeArray )[ index ];
+			if( !flatNode.IsLeaf() && flatNode.SurfaceArea() > rebuildFactor * double( ( *builtAreaArray )[ index ] ) )
+			{
+				rootArray.push_back( index );
+				index = GetSubtreeEnd( index );
+			}
+			else
+				index++;
+		}
+
+		if( rootArray.size() > 0 )
+		{
+			// Triangles already handed back stay where they are, standing for the same mesh triangles, so before the records
+			// are moved, we note which mesh triangle each of them is, and after, match the records back up to them.
+			bool handedBack = flatTriangleState->ready ? true : false;
+			if( handedBack && flatTriangleMeshArray->size() == 0 )
+				flatTriangleMeshArray->assign( meshTriangleArray->begin(), meshTriangleArray->end() );
+
+			if( rootArray.size() == 1 && rootArray[0] == 0 )
+			{
+				// Rebuilding the whole tree is just a build, which can make better use of a thread pool.  The build starts from
+				// nothing, so the triangles are set aside while it runs.
+				std::vector< Triangle > triangleArray( count );
+				ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+					for( int i = begin; i < end; i++ )
+						GetRecordVertices( i, triangleArray[i].vertex );
+				} );
+
+				std::vector< int > meshTriangleArray( *this->meshTriangleArray );
+				std::vector< Triangle > flatTriangleArray;
+				std::vector< int > flatTriangleMeshArray;
+				this->flatTriangleArray->swap( flatTriangleArray );
+				this->flatTriangleMeshArray->swap( flatTriangleMeshArray );
+
+				if( !Build( triangleArray, &meshTriangleArray, flatMaxLeafSize, threadPool ) )
+					return false;
+
+				this->flatTriangleArray->swap( flatTriangleArray );
+				this->flatTriangleMeshArray->swap( flatTriangleMeshArray );
+				flatTriangleState->ready = handedBack;
+			}
+			else
+				RebuildSubtrees( rootArray, threadPool );
+
+			if( handedBack )
+				MatchFlatTriangles();
+		}
+	}
+
+	// Any triangles already handed back are brought up to date where they are, so that they stay valid.
+	if( flatTriangleState->ready )
+	{
+		ParallelFor( threadPool, count, [ & ]( int begin, int end ) {
+			for( int i = begin; i < end; i++ )
+				GetRecordVertices( i, ( *flatTriangleArray )[ GetFlatTriangleSlot(i) ].vertex );
+		} );
+	}
+
+	return true;
+}
+
+void BoundingBoxTree::RefitNodes( ThreadPool* threadPool )
+{
+	FlatNode* flatNodes = flatNodeArray->data();
+	int nodeCount = ( int )flatNodeArray->size();
+
+	ParallelFor( threadPool, nodeCount, [ & ]( int begin, int end ) {
+		for( int i = begin; i < end; i++ )
+		{
+			FlatNode& flatNode = flatNodes[i];
+			if( !flatNode.IsLeaf() || flatNode.count == 0 )
+				continue;
+
+			Triangle triangle;
+			GetRecordVertices( flatNode.offset, triangle.vertex );
+
+			BuildPrimitive primitive;
+			primitive.Set( triangle, flatNode.offset );
+
+			BuildBox box;
+			box.Set( primitive.box );
+			for( int j = 1; j < flatNode.count; j++ )
+			{
+				GetRecordVertices( flatNode.offset + j, triangle.vertex );
+				primitive.Set( triangle, flatNode.offset + j );
+				box.Grow( primitive.box );
+			}
+
+			SetFlatNodeBox( flatNode, box.min, box.max );
+		}
+	} );
+
+	// Both children of a branch come after it, so going from back to front, they're always refit before it is.
+	for( int i = nodeCount - 1; i >= 0; i-- )
+	{
+		FlatNode& flatNode = flatNodes[i];
+		if( flatNode.IsLeaf() )
+			continue;
+
+		const FlatNode& firstChild = flatNodes[ i + 1 ];
+		const FlatNode& secondChild = flatNodes[ flatNode.offset ];
+		for( int j = 0; j < 3; j++ )
+		{
+			flatNode.min[j] = MIN( firstChild.min[j], secondChild.min[j] );
+			flatNode.max[j] = MAX( firstChild.max[j], secondChild.max[j] );
+		}
+	}
+}
+
+void BoundingBoxTree::RecordBuiltAreas( ThreadPool* threadPool )
+{
+	builtAreaArray->resize( flatNodeArray->size() );
+	ParallelFor( threadPool, ( int )flatNodeArray->size(), [ & ]( int begin, int end ) {
+		for( int i = begin; i < end; i++ )
+			( *builtAreaArray )[i] = float( ( *flatNodeArray )[i].SurfaceArea() );
+	} );
+}
+
+// The subtrees are rebuilt independently, and then the node array is put back together with each in place of the one
+// it replaces.  A new subtree may not have as many nodes as the old one, so nodes after it move, and links to them change.
+void BoundingBoxTree::RebuildSubtrees( const std::vector< int >& rootArray, ThreadPool* threadPool )
+{
+	int rebuildCount = ( int )rootArray.size();
+	std::vector< FlatNodeArray > subtreeArrayArray( rebuildCount );
+
+	if( threadPool )
+		threadPool->ParallelFor( rebuildCount, 1, [ & ]( int begin, int end ) {
+			for( int i = begin; i < end; i++ )
+				RebuildSubtree( rootArray[i], subtreeArrayArray[i] );
+		} );
+	else
+	{
+		for( int i = 0; i < rebuildCount; i++ )
+			RebuildSubtree( rootArray[i], subtreeArrayArray[i] );
+	}
+
+	// A node outside the rebuilt subtrees moves by however many nodes were gained or lost before it.
+	std::vector< int > endArray( rebuildCount );
+	std::vector< int > shiftArray( rebuildCount + 1 );
+	shiftArray[0] = 0;
+	for( int i = 0; i < rebuildCount; i++ )
+	{
+		endArray[i] = GetSubtreeEnd( rootArray[i] );
+		shiftArray[ i + 1 ] = shiftArray[i] + ( int )subtreeArrayArray[i].size() - ( endArray[i] - rootArray[i] );
+	}
+
+	FlatNodeArray nodeArray;
+	nodeArray.reserve( flatNodeArray->size() + shiftArray[ rebuildCount ] );
+
+	std::vector< float > areaArray;
+	areaArray.reserve( nodeArray.capacity() );
+
+	int index = 0;
+	int rebuild = 0;
+	while( index < ( signed )flatNodeArray->size() )
+	{
+		if( rebuild < rebuildCount && index == rootArray[ rebuild ] )
+		{
+			int base = ( int )nodeArray.size();
+			const FlatNodeArray& subtreeArray = subtreeArrayArray[ rebuild ];
+			for( int i = 0; i < ( signed )subtreeArray.size(); i++ )
+			{
+				FlatNode flatNode = subtreeArray[i];
+				if( !flatNode.IsLeaf() )
+					flatNode.offset += base;
+				nodeArray.push_back( flatNode );
+				areaArray.push_back( float( flatNode.SurfaceArea() ) );
+			}
+
+			index = endArray[ rebuild++ ];
+		}
+		else
+		{
+			FlatNode flatNode = ( *flatNodeArray )[ index ];
+			if( !flatNode.IsLeaf() )
+				flatNode.offset += shiftArray[ std::upper_bound( endArray.begin(), endArray.end(), flatNode.offset ) - endArray.begin() ];
+			nodeArray.push_back( flatNode );
+			areaArray.push_back( ( *builtAreaArray )[ index ] );
+
+			index++;
+		}
+	}
+
+	flatNodeArray->swap( nodeArray );
+	builtAreaArray->swap( areaArray );
+
+	UpdateTreeDepth();
+}
+
+// This builds a new subtree over the triangles of the given one, which are rearranged to suit it.  The new subtree's
+// leaves refer to the triangles where they are, but its branches refer to nodes as if it were the whole tree.
+void BoundingBoxTree::RebuildSubtree( int index, FlatNodeArray& subtreeArray )
+{
+	// Leaves are in the same order as the triangles they own, so a subtree owns a contiguous range of them.
+	int first = index;
+	while( !( *flatNodeArray )[ first ].IsLeaf() )
+		first++;
+
+	const FlatNode& lastLeaf = ( *flatNodeArray )[ GetSubtreeEnd( index ) - 1 ];
+	int firstTriangle = ( *flatNodeArray )[ first ].offset;
+	int count = lastLeaf.offset + lastLeaf.count - firstTriangle;
+
+	std::vector< Triangle > triangleArray( count );
+	BuildPrimitiveArray primitiveArray( count );
+	for( int i = 0; i < count; i++ )
+	{
+		GetRecordVertices( firstTriangle + i, triangleArray[i].vertex );
+		primitiveArray[i].Set( triangleArray[i], i );
+	}
+
+	BuildContext context;
+	context.primitiveArray = &primitiveArray;
+	context.maxLeafSize = flatMaxLeafSize;
+	context.nearRootSize = count + 1;
+	context.threadPool = nullptr;
+
+	int treeDepth = 0;
+	BuildNode( context, 0, count, 1, subtreeArray, treeDepth );
+
+	for( int i = 0; i < ( signed )subtreeArray.size(); i++ )
+		if( subtreeArray[i].IsLeaf() )
+			subtreeArray[i].offset += firstTriangle;
+
+	std::vector< int > meshTriangleArray( count );
+	for( int i = 0; i < count; i++ )
+		meshTriangleArray[i] = ( *this->meshTriangleArray )[ firstTriangle + primitiveArray[i].triangle ];
+
+	for( int i = 0; i < count; i++ )
+		SetTriangleRecord( firstTriangle + i, triangleArray[ primitiveArray[i].triangle ] );
+
+	std::copy( meshTriangleArray.begin(), meshTriangleArray.end(), this->meshTriangleArray->begin() + firstTriangle );
+}
+
+// The last node of a subtree is the leaf reached by always taking the second child.
+int BoundingBoxTree::GetSubtreeEnd( int index ) const
+{
+	while( !( *flatNodeArray )[ index ].IsLeaf() )
+		index = ( *flatNodeArray )[ index ].offset;
+
+	return index + 1;
+}
+
+void BoundingBoxTree::UpdateTreeDepth( void )
+{
+	int nodeCount = ( int )flatNodeArray->size();
+	std::vector< int > depthArray( nodeCount );
+	depthArray[0] = 1;
+	flatTreeDepth = 1;
+
+	for( int i = 0; i < nodeCount; i++ )
+	{
+		const FlatNode& flatNode = ( *flatNodeArray )[i];
+		flatTreeDepth = MAX( flatTreeDepth, depthArray[i] );
+		if( !flatNode.IsLeaf() )
+			depthArray[ i + 1 ] = depthArray[ flatNode.offset ] = depthArray[i] + 1;
+	}
+}
+
+#define CACHE_MAGIC					"BBTCACHE"
+#define CACHE_VERSION				2
+#define CACHE_ALIGNMENT				64
+
+// A cache file starts with this header, which locates each of the arrays following it.  Each array starts on a cache line,
+// and is stored just as it is kept in memory.
+struct BoundingBoxTree::CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;			// This is written as 0x01020304, so a file from a machine of the other byte order is turned away.
+	uint32_t nodeSize;
+	int32_t treeDepth;
+	int32_t maxLeafSize;
+	int32_t nodeCount;
+	int32_t triangleCount;
+	int32_t meshTriangleCount;	// This is either zero or the triangle count, and the built areas are stored only if it isn't zero.
+	uint64_t contentHash;
+	uint64_t nodeOffset;
+	uint64_t recordOffset;
+	uint64_t meshTriangleOffset;
+	uint64_t builtAreaOffset;
+	uint64_t fileSize;
+};
+
+bool BoundingBoxTree::Save( const std::string& file, uint64_t contentHash /*= 0*/ ) const
+{
+	if( !IsCompiled() )
+		return false;
+
+	int nodeCount = GetFlatNodeCount();
+	int triangleCount = flatTriangleCount;
+	int meshTriangleCount = GetMeshTriangles() ? triangleCount : 0;
+	int builtAreaCount = ( meshTriangleCount > 0 ) ? nodeCount : 0;
+
+	CacheHeader header;
+	memset( &header, 0, sizeof( CacheHeader ) );
+	memcpy( header.magic, CACHE_MAGIC, sizeof( header.magic ) );
+	header.version = CACHE_VERSION;
+	header.byteOrder = 0x01020304;
+	header.nodeSize = sizeof( FlatNode );
+	header.treeDepth = flatTreeDepth;
+	header.maxLeafSize = flatMaxLeafSize;
+	header.nodeCount = nodeCount;
+	header.triangleCount = triangleCount;
+	header.meshTriangleCount = meshTriangleCount;
+	header.contentHash = contentHash;
+
+	uint64_t offset = sizeof( CacheHeader );
+	auto placeArray = [ &offset ]( uint64_t size ) {
+		offset = ( offset + CACHE_ALIGNMENT - 1 ) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+		uint64_t arrayOffset = offset;
+		offset += size;
+		return arrayOffset;
+	};
+
+	header.nodeOffset = placeArray( uint64_t( nodeCount ) * sizeof( FlatNode ) );
+	header.recordOffset = placeArray( uint64_t( triangleCount ) * TRIANGLE_RECORD_COMPONENTS * sizeof( double ) );
+	header.meshTriangleOffset = placeArray( uint64_t( meshTriangleCount ) * sizeof( int ) );
+	header.builtAreaOffset = placeArray( uint64_t( builtAreaCount ) * sizeof( float ) );
+	header.fileSize = offset;
+
+	// Writing a new file and renaming it over the old one never disturbs a tree that has the old one mapped.
+	std::string tempFile = file + ".tmp";
+	std::ofstream stream( tempFile, std::ios::binary | std::ios::trunc );
+	if( !stream.is_open() )
+		return false;
+
+	uint64_t position = 0;
+	auto writeArray = [ &stream, &position ]( uint64_t arrayOffset, const void* data, uint64_t size ) {
+		static const char padding[ CACHE_ALIGNMENT ] = {};
+		stream.write( padding, ( std::streamsize )( arrayOffset - position ) );
+		stream.write( ( const char* )data, ( std::streamsize )size );
+		position = arrayOffset + size;
+	};
+
+	writeArray( 0, &header, sizeof( CacheHeader ) );
+	writeArray( header.nodeOffset, GetFlatNodes(), uint64_t( nodeCount ) * sizeof( FlatNode ) );
+	writeArray( header.recordOffset, GetTriangleRecords(), uint64_t( triangleCount ) * TRIANGLE_RECORD_COMPONENTS * sizeof( double ) );
+	writeArray( header.meshTriangleOffset, GetMeshTriangles(), uint64_t( meshTriangleCount ) * sizeof( int ) );
+	writeArray( header.builtAreaOffset, GetBuiltAreas(), uint64_t( builtAreaCount ) * sizeof( float ) );
+
+	stream.close();
+	if( stream.fail() )
+	{
+		std::remove( tempFile.c_str() );
+		return false;
+	}
+
+	// Some systems won't rename a file over another, so failing that, we remove the old one first.
+	if( std::rename( tempFile.c_str(), file.c_str() ) != 0 )
+	{
+		std::remove( file.c_str() );
+		if( std::rename( tempFile.c_str(), file.c_str() ) != 0 )
+		{
+			std::remove( tempFile.c_str() );
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Loading is far faster than building, since the file is mapped into memory and everything queries run on is used right where it lies,
+// without being read or copied.  The content hash is meant to be that of the mesh the tree was built from, so that a stale cache can just
+// be rebuilt and saved again.  The file must not be rewritten in place while a tree is loaded from it, which is why Save renames a new file
+// over it, and why a loaded tree copies what it needs out of the file before it is refit.
+bool BoundingBoxTree::Load( const std::string& file, uint64_t contentHash /*= 0*/ )
+{
+	delete rootNode;
+	rootNode = nullptr;
+
+	ClearCompiledTree();
+
+	MappedFile* mappedFile = new MappedFile();
+	if( !mappedFile->Open( file ) || !ValidateCache( *mappedFile, contentHash ) )
+	{
+		delete mappedFile;
+		return false;
+	}
+
+	const unsigned char* data = mappedFile->GetData();
+	const CacheHeader* header = ( const CacheHeader* )data;
+
+	this->mappedFile = mappedFile;
+	mappedNodes = ( const FlatNode* )( data + header->nodeOffset );
+	mappedNodeCount = header->nodeCount;
+	mappedRecords = ( const double* )( data + header->recordOffset );
+	flatTriangleCount = header->triangleCount;
+	flatTreeDepth = header->treeDepth;
+	flatMaxLeafSize = header->maxLeafSize;
+
+	if( header->meshTriangleCount > 0 )
+	{
+		mappedMeshTriangles = ( const int* )( data + header->meshTriangleOffset );
+		mappedBuiltAreas = ( const float* )( data + header->builtAreaOffset );
+	}
+
+	return true;
+}
+
+// Queries trust the nodes to lead only to other nodes and to triangles that exist, and the tree depth to be right, so we make sure of
+// all that before using a file, but otherwise take its contents as they are.
+/*static*/ bool BoundingBoxTree::ValidateCache( const MappedFile& mappedFile, uint64_t contentHash )
+{
+	if( mappedFile.GetSize() < sizeof( CacheHeader ) )
+		return false;
+
+	const unsigned char* data = mappedFile.GetData();
+	const CacheHeader* header = ( const CacheHeader* )data;
+
+	if( memcmp( header->magic, CACHE_MAGIC, sizeof( header->magic ) ) != 0 ||
+		header->version != CACHE_VERSION ||
+		header->byteOrder != 0x01020304 ||
+		header->nodeSize != sizeof( FlatNode ) ||
+		header->contentHash != contentHash ||
+		header->fileSize != mappedFile.GetSize() )
+	{
+		return false;
+	}
+
+	int nodeCount = header->nodeCount;
+	int triangleCount = header->triangleCount;
+	int meshTriangleCount = header->meshTriangleCount;
+	if( nodeCount <= 0 || triangleCount < 0 || ( meshTriangleCount != 0 && meshTriangleCount != triangleCount ) )
+		return false;
+
+	if( header->treeDepth < 1 || header->treeDepth > nodeCount || header->maxLeafSize < 0 )
+		return false;
+
+	auto arrayFits = [ header ]( uint64_t arrayOffset, uint64_t size ) {
+		return( arrayOffset % CACHE_ALIGNMENT == 0 && arrayOffset >= sizeof( CacheHeader ) && arrayOffset <= header->fileSize && size <= header->fileSize - arrayOffset );
+	};
+
+	if( !arrayFits( header->nodeOffset, uint64_t( nodeCount ) * sizeof( FlatNode ) ) ||
+		!arrayFits( header->recordOffset, uint64_t( triangleCount ) * TRIANGLE_RECORD_COMPONENTS * sizeof( double ) ) ||
+		!arrayFits( header->meshTriangleOffset, uint64_t( meshTriangleCount ) * sizeof( int ) ) ||
+		!arrayFits( header->builtAreaOffset, uint64_t( meshTriangleCount > 0 ? nodeCount : 0 ) * sizeof( float ) ) )
+	{
+		return false;
+	}
+
+	// Both children of a branch come after it, and no node is the child of two, so we can find every node's depth in one pass.
+	const FlatNode* nodes = ( const FlatNode* )( data + header->nodeOffset );
+	std::vector< int > depthArray( nodeCount, 0 );
+	depthArray[0] = 1;
+
+	for( int i = 0; i < nodeCount; i++ )
+	{
+		const FlatNode& node = nodes[i];
+		if( depthArray[i] == 0 || depthArray[i] > header->treeDepth )
+			return false;
+
+		if( node.IsLeaf() )
+		{
+			if( node.offset < 0 || node.offset > triangleCount - int( node.count ) )
+				return false;
+		}
+		else
+		{
+			if( node.axis > 2 || i + 1 >= nodeCount || node.offset <= i + 1 || node.offset >= nodeCount )
+				return false;
+
+			if( depthArray[ i + 1 ] != 0 || depthArray[ node.offset ] != 0 )
+				return false;
+
+			depthArray[ i + 1 ] = depthArray[ node.offset ] = depthArray[i] + 1;
+		}
+	}
+
+	const int* meshTriangle = ( const int* )( data + header->meshTriangleOffset );
+	for( int i = 0; i < meshTriangleCount; i++ )
+		if( meshTriangle[i] < 0 )
+			return false;
+
+	return true;
+}
+
+// This copies everything out of the cache file, if the tree was loaded from one, so that it can be changed.
+void BoundingBoxTree::ReleaseMappedFile( void )
+{
+	if( !mappedFile )
+		return;
+
+	flatNodeArray->assign( mappedNodes, mappedNodes + mappedNodeCount );
+	triangleRecordArray->assign( mappedRecords, mappedRecords + TRIANGLE_RECORD_COMPONENTS * flatTriangleCount );
+
+	if( mappedMeshTriangles )
+	{
+		meshTriangleArray->assign( mappedMeshTriangles, mappedMeshTriangles + flatTriangleCount );
+		builtAreaArray->assign( mappedBuiltAreas, mappedBuiltAreas + mappedNodeCount );
+	}
+
+	delete mappedFile;
+	mappedFile = nullptr;
+	mappedNodes = nullptr;
+	mappedNodeCount = 0;
+	mappedRecords = nullptr;
+	mappedMeshTriangles = nullptr;
+	mappedBuiltAreas = nullptr;
+}
+
+bool BoundingBoxTree::InsertTriangle( const Triangle& triangle )
+{
+	if( !rootNode )
+		return false;
+
+	return rootNode->InsertTriangle( triangle );
+}
+
+bool BoundingBoxTree::InsertTriangleList( const TriangleList& triangleList, const Vector* normalFilter /*= nullptr*/, double angleFilter /*= 0.0*/ )
+{
+	for( TriangleList::const_iterator iter = triangleList.begin(); iter != triangleList.cend(); iter++ )
+	{
+		const Triangle& triangle = *iter;
+
+		if( normalFilter )
+		{
+			Vector normal;
+			triangle.GetNormal( normal );
+
+			double angle = normal.AngleBetween( *normalFilter );
+			if( angle >= angleFilter )
+				continue;
+		}
+
+		if( !InsertTriangle( triangle ) )
+			return false;
+	}
+
+	return true;
+}
+
+// The compiled tree is searched nearest child first, and the segment is cut short at each hit, so that anything beyond it is skipped.
+bool BoundingBoxTree::FindIntersection( const LineSegment& lineSegment, const Triangle*& intersectedTriangle, Vector& intersectionPoint ) const
+{
+	if( IsCompiled() )
+		return FindIntersectionCompiled( lineSegment, intersectedTriangle, intersectionPoint, false );
+
+	if( !rootNode )
+		return false;
+
+	return rootNode->FindIntersection( lineSegment, intersectedTriangle, intersectionPoint );
+}
+
+bool BoundingBoxTree::IntersectsWithLineSegment( const LineSegment& lineSegment ) const
+{
+	const Triangle* intersectedTriangle = nullptr;
+	Vector intersectionPoint;
+
+	if( IsCompiled() )
+		return FindIntersectionCompiled( lineSegment, intersectedTriangle, intersectionPoint, true );
+
+	if( !rootNode )
+		return false;
+
+	return rootNode->FindIntersection( lineSegment, intersectedTriangle, intersectionPoint );
+}
+
+// Each of these decides how far from the point the search reaches, and what becomes of the triangles found within reach.
+// A collector may also give its own bound on how near a box comes, so long as nothing in the box is nearer than that.
+// A compiled tree gives each triangle found by its place in the records, and one that isn't gives it as it is in its leaf.
+struct BoundingBoxTree::NearCollector
+{
+	double SquareDistanceToBox( const FlatNode& node, const double* position ) const { return BoundingBoxTree::SquareDistanceToBox( node, position ); }
+};
+
+struct BoundingBoxTree::NearestCollector : public NearCollector
+{
+	double GetSquareRadius( void ) const { return squareDistance; }
+
+	// Of triangles equally near, the first in the records is kept, so that which is found doesn't depend on the order they're visited in.
+	void Collect( int triangle, double squareDistance, double u, double v )
+	{
+		if( this->triangle >= 0 && squareDistance == this->squareDistance && triangle > this->triangle )
+			return;
+
+		this->triangle = triangle;
+		this->leafTriangle = nullptr;
+		this->squareDistance = squareDistance;
+		this->u = u;
+		this->v = v;
+	}
+
+	void Collect( const Triangle* triangle, double squareDistance, double u, double v )
+	{
+		this->triangle = -1;
+		this->leafTriangle = triangle;
+		this->squareDistance = squareDistance;
+		this->u = u;
+		this->v = v;
+	}
+
+	bool Found( void ) const { return( triangle >= 0 || leafTriangle ? true : false ); }
+
+	void GetNearestPoint( const Vector* vertex, Vector& nearestPoint, Vector* barycentricCoords ) const
+	{
+		double w = 1.0 - u - v;
+		nearestPoint.Set(
+			w * vertex[0].x + u * vertex[1].x + v * vertex[2].x,
+			w * vertex[0].y + u * vertex[1].y + v * vertex[2].y,
+			w * vertex[0].z + u * vertex[1].z + v * vertex[2].z );
+
+		if( barycentricCoords )
+			barycentricCoords->Set( w, u, v );
+	}
+
+	int triangle;
+	const Triangle* leafTriangle;
+	double squareDistance;
+	double u, v;
+};
+
+struct BoundingBoxTree::RangeCollector : public NearCollector
+{
+	double GetSquareRadius( void ) const { return squareRadius; }
+
+	void Collect( int triangle, double squareDistance, double u, double v ) { Collect( boxTree->GetFlatTriangle( triangle ), squareDistance, u, v ); }
+
+	void Collect( const Triangle* triangle, double squareDistance, double /*u*/, double /*v*/ )
+	{
+		if( count < maxCount )
+		{
+			triangles[ count ] = triangle;
+			if( distances )
+				distances[ count ] = sqrt( squareDistance );
+		}
+
+		count++;
+	}
+
+	const BoundingBoxTree* boxTree;
+	const Triangle** triangles;
+	double* distances;
+	int maxCount;
+	int count;
+	double squareRadius;
+};
+
+// The triangles found so far are kept in a max-heap, with the farthest on top, to be replaced by anything nearer once the
+// heap is full.  Until then, the search reaches as far as it was asked to, but after that, only as far as the farthest.
+struct BoundingBoxTree::KNearestCollector : public NearCollector
+{
+	double GetSquareRadius( void ) const { return( count < maxCount ? squareRadius : squareDistances[0] ); }
+
+	void Collect( int triangle, double squareDistance, double u, double v ) { Collect( boxTree->GetFlatTriangle( triangle ), squareDistance, u, v ); }
+
+	void Collect( const Triangle* triangle, double squareDistance, double /*u*/, double /*v*/ )
+	{
+		if( count < maxCount )
+		{
+			int i = count++;
+			while( i > 0 && squareDistances[ ( i - 1 ) / 2 ] < squareDistance )
+			{
+				int parent = ( i - 1 ) / 2;
+				triangles[i] = triangles[ parent ];
+				squareDistances[i] = squareDistances[ parent ];
+				i = parent;
+			}
+
+			triangles[i] = triangle;
+			squareDistances[i] = squareDistance;
+		}
+		else if( squareDistance < squareDistances[0] )
+			SiftDown( triangle, squareDistance, count );
+	}
+
+	void SiftDown( const Triangle* triangle, double squareDistance, int size )
+	{
+		int i = 0;
+		while( true )
+		{
+			int child = 2 * i + 1;
+			if( child >= size )
+				break;
+
+			if( child + 1 < size && squareDistances[ child + 1 ] > squareDistances[ child ] )
+				child++;
+
+			if( squareDistances[ child ] <= squareDistance )
+				break;
+
+			triangles[i] = triangles[ child ];
+			squareDistances[i] = squareDistances[ child ];
+			i = child;
+		}
+
+		triangles[i] = triangle;
+		squareDistances[i] = squareDistance;
+	}
+
+	// Repeatedly moving the farthest triangle to the end of what's left of the heap sorts them nearest first.
+	void Sort( void )
+	{
+		for( int size = count - 1; size > 0; size-- )
+		{
+			const Triangle* triangle = triangles[ size ];
+			double squareDistance = squareDistances[ size ];
+			triangles[ size ] = triangles[0];
+			squareDistances[ size ] = squareDistances[0];
+			SiftDown( triangle, squareDistance, size );
+		}
+	}
+
+	const BoundingBoxTree* boxTree;
+	const Triangle** triangles;
+	double* squareDistances;
+	int maxCount;
+	int count;
+	double squareRadius;
+};
+
+// The triangles reached by this are tested after being put through the transform.  The search is made before the transform, so it must
+// reach as far as anything that ends up within the nearest distance found so far might be, which is that distance over the least scale.
+// When the transform stretches some ways much more than others, that ball reaches too far in the others, so a box is then reached only
+// if the box bounding it after the transform comes within the nearest distance as well.
+struct BoundingBoxTree::TransformedNearestCollector
+{
+	double GetSquareRadius( void ) const { return squareDistance * squareScale; }
+
+	double SquareDistanceToBox( const FlatNode& node, const double* localPosition ) const
+	{
+		if( !stretched )
+			return BoundingBoxTree::SquareDistanceToBox( node, localPosition );
+
+		double min[3], max[3];
+		TransformNodeBox( matrix, node, min, max );
+
+		double squareDistance = 0.0;
+		for( int i = 0; i < 3; i++ )
+		{
+			double delta = MAX( MAX( min[i] - position[i], position[i] - max[i] ), 0.0 );
+			squareDistance += delta * delta;
+		}
+
+		return MAX( BoundingBoxTree::SquareDistanceToBox( node, localPosition ), squareDistance * squareScale );
+	}
+
+	void Collect( int triangle, double /*localSquareDistance*/, double /*localU*/, double /*localV*/ )
+	{
+		Vector localVertex[3];
+		boxTree->GetRecordVertices( triangle, localVertex );
+		if( CollectVertices( localVertex ) )
+		{
+			this->triangle = triangle;
+			this->leafTriangle = nullptr;
+		}
+	}
+
+	void Collect( const Triangle* triangle, double /*localSquareDistance*/, double /*localU*/, double /*localV*/ )
+	{
+		if( CollectVertices( triangle->vertex ) )
+		{
+			this->triangle = -1;
+			this->leafTriangle = triangle;
+		}
+	}
+
+	bool CollectVertices( const Vector* localVertex )
+	{
+		Vector vertex[3];
+		for( int i = 0; i < 3; i++ )
+			transform->Transform( localVertex[i], vertex[i] );
+
+		double base[3] = { vertex[0].x, vertex[0].y, vertex[0].z };
+		double edgeA[3] = { vertex[1].x - vertex[0].x, vertex[1].y - vertex[0].y, vertex[1].z - vertex[0].z };
+		double edgeB[3] = { vertex[2].x - vertex[0].x, vertex[2].y - vertex[0].y, vertex[2].z - vertex[0].z };
+
+		double u, v;
+		double squareDistance = Triangle::NearestPoint( position, base, edgeA, edgeB, u, v );
+		if( squareDistance > this->squareDistance )
+			return false;
+
+		this->squareDistance = squareDistance;
+		for( int i = 0; i < 3; i++ )
+			nearestPoint[i] = base[i] + u * edgeA[i] + v * edgeB[i];
+
+		return true;
+	}
+
+	const BoundingBoxTree* boxTree;
+	const AffineTransform* transform;
+	double matrix[3][4];
+	bool stretched;
+	const double* position;
+	double squareScale;
+	int triangle;
+	const Triangle* leafTriangle;
+	double squareDistance;
+	double nearestPoint[3];
+};
+
+// This is a search like TraceSegment's, except that what shrinks as we go, if anything, is the radius of a ball about the point.
+template< typename Collector >
+void BoundingBoxTree::VisitNear( const double* position, Collector& collector ) const
+{
+	if( !IsCompiled() )
+	{
+		if( rootNode && SquareDistanceToBox( rootNode->boundingBox, position ) <= collector.GetSquareRadius() )
+			VisitNearNode( rootNode, position, collector );
+		return;
+	}
+
+	const FlatNode* nodes = GetFlatNodes();
+
+	if( collector.SquareDistanceToBox( nodes[0], position ) > collector.GetSquareRadius() )
+		return;
+
+	TraversalStack< TraversalEntry > stack( flatTreeDepth );
+	int index = 0;
+
+	while( index >= 0 )
+	{
+		const FlatNode& node = nodes[ index ];
+
+		if( node.IsLeaf() )
+			VisitNearLeaf( node, position, collector );
+		else
+		{
+			int nearChild = index + 1;
+			int farChild = node.offset;
+			double nearDistance = collector.SquareDistanceToBox( nodes[ nearChild ], position );
+			double farDistance = collector.SquareDistanceToBox( nodes[ farChild ], position );
+			if( farDistance < nearDistance )
+			{
+				std::swap( nearChild, farChild );
+				std::swap( nearDistance, farDistance );
+			}
+
+			double squareRadius = collector.GetSquareRadius();
+			if( nearDistance <= squareRadius )
+			{
+				if( farDistance <= squareRadius )
+				{
+					TraversalEntry entry;
+					entry.node = farChild;
+					entry.lambda = farDistance;
+					stack.Push( entry );
+				}
+
+				index = nearChild;
+				continue;
+			}
+		}
+
+		// Resume with the next node we put off, unless the ball has since shrunk away from it.
+		index = -1;
+		while( !stack.IsEmpty() )
+		{
+			TraversalEntry entry = stack.Pop();
+			if( entry.lambda <= collector.GetSquareRadius() )
+			{
+				index = entry.node;
+				break;
+			}
+		}
+	}
+}
+
+template< typename Collector >
+void BoundingBoxTree::VisitNearLeaf( const FlatNode& node, const double* position, Collector& collector ) const
+{
+	int count = flatTriangleCount;
+	const double* record = GetTriangleRecords();
+
+	for( int i = node.offset; i < node.offset + node.count; i++ )
+	{
+		double base[3] = { record[ RECORD_VERTEX_0_X * count + i ], record[ RECORD_VERTEX_0_Y * count + i ], record[ RECORD_VERTEX_0_Z * count + i ] };
+		double edgeA[3] = { record[ RECORD_VERTEX_1_X * count + i ] - base[0], record[ RECORD_VERTEX_1_Y * count + i ] - base[1], record[ RECORD_VERTEX_1_Z * count + i ] - base[2] };
+		double edgeB[3] = { record[ RECORD_VERTEX_2_X * count + i ] - base[0], record[ RECORD_VERTEX_2_Y * count + i ] - base[1], record[ RECORD_VERTEX_2_Z * count + i ] - base[2] };
+
+		double u, v;
+		double squareDistance = Triangle::NearestPoint( position, base, edgeA, edgeB, u, v );
+		if( squareDistance <= collector.GetSquareRadius() )
+			collector.Collect( i, squareDistance, u, v );
+	}
+}
+
+// This is the same search over a tree that hasn't been compiled.
+template< typename Collector >
+void BoundingBoxTree::VisitNearNode( const Node* node, const double* position, Collector& collector ) const
+{
+	const BranchNode* branchNode = dynamic_cast< const BranchNode* >( node );
+	if( branchNode )
+	{
+		const Node* nearNode = branchNode->backNode;
+		const Node* farNode = branchNode->frontNode;
+		double nearDistance = SquareDistanceToBox( nearNode->boundingBox, position );
+		double farDistance = SquareDistanceToBox( farNode->boundingBox, position );
+		if( farDistance < nearDistance )
+		{
+			std::swap( nearNode, farNode );
+			std::swap( nearDistance, farDistance );
+		}
+
+		if( nearDistance <= collector.GetSquareRadius() )
+			VisitNearNode( nearNode, position, collector );
+
+		if( farDistance <= collector.GetSquareRadius() )
+			VisitNearNode( farNode, position, collector );
+
+		return;
+	}
+
+	const LeafNode* leafNode = dynamic_cast< const LeafNode* >( node );
+	if( !leafNode )
+		return;
+
+	for( TriangleList::const_iterator iter = leafNode->triangleList->cbegin(); iter != leafNode->triangleList->cend(); iter++ )
+	{
+		const Vector* vertex = iter->vertex;
+		double base[3] = { vertex[0].x, vertex[0].y, vertex[0].z };
+		double edgeA[3] = { vertex[1].x - vertex[0].x, vertex[1].y - vertex[0].y, vertex[1].z - vertex[0].z };
+		double edgeB[3] = { vertex[2].x - vertex[0].x, vertex[2].y - vertex[0].y, vertex[2].z - vertex[0].z };
+
+		double u, v;
+		double squareDistance = Triangle::NearestPoint( position, base, edgeA, edgeB, u, v );
+		if( squareDistance <= collector.GetSquareRadius() )
+			collector.Collect( &( *iter ), squareDistance, u, v );
+	}
+}
+
+bool BoundingBoxTree::FindNearestTriangle( const Vector& point, const Triangle*& nearestTriangle, double maxDistance ) const
+{
+	Vector nearestPoint;
+	return FindNearestTriangle( point, nearestTriangle, nearestPoint, maxDistance );
+}
+
+// The compiled tree is searched nearest box first, and the search radius shrinks to each nearer triangle found, so that boxes beyond it are skipped.
+bool BoundingBoxTree::FindNearestTriangle( const Vector& point, const Triangle*& nearestTriangle, Vector& nearestPoint, double maxDistance, Vector* barycentricCoords /*= nullptr*/ ) const
+{
+	nearestTriangle = nullptr;
+	if( maxDistance < 0.0 )
+		return false;
+
+	double position[3] = { point.x, point.y, point.z };
+
+	NearestCollector collector;
+	collector.triangle = -1;
+	collector.leafTriangle = nullptr;
+	collector.squareDistance = maxDistance * maxDistance;
+
+	VisitNear( position, collector );
+
+	if( !collector.Found() )
+		return false;
+
+	nearestTriangle = collector.leafTriangle ? collector.leafTriangle : GetFlatTriangle( collector.triangle );
+	collector.GetNearestPoint( nearestTriangle->vertex, nearestPoint, barycentricCoords );
+	return true;
+}
+
+// These work from the records alone, so they never need the triangles copied out of them.
+bool BoundingBoxTree::FindIntersection( const LineSegment& lineSegment, int& meshTriangle, Vector& intersectionPoint, Vector* barycentricCoords /*= nullptr*/ ) const
+{
+	meshTriangle = -1;
+	if( !CanRefit() )
+		return false;
+
+	FlatSegment segment;
+	segment.Set( lineSegment );
+
+	SegmentHit hit;
+	hit.triangle = -1;
+	hit.lambda = 1.0;
+
+	TraceSegment( segment, 0, hit, false );
+
+	if( hit.triangle < 0 )
+		return false;
+
+	meshTriangle = GetMeshTriangles()[ hit.triangle ];
+	intersectionPoint = hit.point;
+
+	if( barycentricCoords )
+		barycentricCoords->Set( 1.0 - hit.u - hit.v, hit.u, hit.v );
+
+	return true;
+}
+
+bool BoundingBoxTree::FindNearestTriangle( const Vector& point, int& meshTriangle, Vector& nearestPoint, double maxDistance, Vector* barycentricCoords /*= nullptr*/ ) const
+{
+	meshTriangle = -1;
+	if( !CanRefit() || maxDistance < 0.0 )
+		return false;
+
+	double position[3] = { point.x, point.y, point.z };
+
+	NearestCollector collector;
+	collector.triangle = -1;
+	collector.leafTriangle = nullptr;
+	collector.squareDistance = maxDistance * maxDistance;
+
+	VisitNear( position, collector );
+
+	if( collector.triangle < 0 )
+		return false;
+
+	Vector vertex[3];
+	GetRecordVertices( collector.triangle, vertex );
+	collector.GetNearestPoint( vertex, nearestPoint, barycentricCoords );
+
+	meshTriangle = GetMeshTriangles()[ collector.triangle ];
+	return true;
+}
+
+// The triangles handed back are in the order the records were in when they were made, which a refit that rebuilds notes.
+int BoundingBoxTree::GetMeshTriangle( const Triangle* triangle ) const
+{
+	const int* meshTriangles = GetMeshTriangles();
+	if( !triangle || !meshTriangles || !flatTriangleState->ready )
+		return -1;
+
+	const Triangle* firstTriangle = flatTriangleArray->data();
+	if( triangle < firstTriangle || triangle >= firstTriangle + flatTriangleCount )
+		return -1;
+
+	int slot = int( triangle - firstTriangle );
+	return( flatTriangleMeshArray->size() > 0 ? ( *flatTriangleMeshArray )[ slot ] : meshTriangles[ slot ] );
+}
+
+// The transform can shrink distances by no more than the given factor.  The search is made at the given point's preimage, but the distances
+// are measured after the transform, and the nearest point is given after it.
+bool BoundingBoxTree::FindNearestTransformed( const Vector& point, const Vector& localPoint, const AffineTransform& transform, double minScale, const Triangle*& nearestTriangle, Vector& nearestPoint, double& squareDistance ) const
+{
+	double position[3] = { point.x, point.y, point.z };
+	double localPosition[3] = { localPoint.x, localPoint.y, localPoint.z };
+
+	TransformedNearestCollector collector;
+	collector.boxTree = this;
+	collector.transform = &transform;
+	collector.position = position;
+
+	GetTransformMatrix( transform, collector.matrix );
+
+	// No axis is stretched more than the greatest scale, nor less than the least, so with a rotation and a uniform scale, they're all alike.
+	const LinearTransform& linearTransform = transform.linearTransform;
+	double maxSquareLength = MAX( linearTransform.xAxis.Dot( linearTransform.xAxis ), MAX( linearTransform.yAxis.Dot( linearTransform.yAxis ), linearTransform.zAxis.Dot( linearTransform.zAxis ) ) );
+	collector.stretched = ( maxSquareLength > 2.0 * minScale * minScale ) ? true : false;
+	collector.squareScale = 1.0 / ( minScale * minScale );
+	collector.triangle = -1;
+	collector.leafTriangle = nullptr;
+	collector.squareDistance = squareDistance;
+
+	VisitNear( localPosition, collector );
+
+	if( collector.triangle < 0 && !collector.leafTriangle )
+		return false;
+
+	nearestTriangle = collector.leafTriangle ? collector.leafTriangle : GetFlatTriangle( collector.triangle );
+	nearestPoint.Set( collector.nearestPoint[0], collector.nearestPoint[1], collector.nearestPoint[2] );
+	squareDistance = collector.squareDistance;
+	return true;
+}
+
+int BoundingBoxTree::FindTrianglesWithinDistance( const Vector& point, double distance, const Triangle** triangles, double* distances, int maxCount ) const
+{
+	if( distance < 0.0 )
+		return 0;
+
+	double position[3] = { point.x, point.y, point.z };
+
+	RangeCollector collector;
+	collector.boxTree = this;
+	collector.triangles = triangles;
+	collector.distances = distances;
+	collector.maxCount = maxCount;
+	collector.count = 0;
+	collector.squareRadius = distance * distance;
+
+	VisitNear( position, collector );
+
+	return collector.count;
+}
+
+// Like the search for the nearest triangle, this searches only where the triangles it's after might be, and so takes time in proportion to how
+// many there are, rather than to the size of the tree.  The distance array is needed since the search keeps its working set in the given arrays.
+int BoundingBoxTree::FindNearestTriangles( const Vector& point, int count, const Triangle** triangles, double* distances, double maxDistance ) const
+{
+	if( count <= 0 || maxDistance < 0.0 )
+		return 0;
+
+	double position[3] = { point.x, point.y, point.z };
+
+	KNearestCollector collector;
+	collector.boxTree = this;
+	collector.triangles = triangles;
+	collector.squareDistances = distances;
+	collector.maxCount = count;
+	collector.count = 0;
+	collector.squareRadius = maxDistance * maxDistance;
+
+	VisitNear( position, collector );
+	collector.Sort();
+
+	for( int i = 0; i < collector.count; i++ )
+		distances[i] = sqrt( distances[i] );
+
+	return collector.count;
+}
+
+#define NODE_PAIRS_PER_THREAD		16
+
+// The trees are descended together, always dividing the larger of two overlapping boxes, so that only triangles in overlapping leaves are ever
+// tested against one another.  Given a thread pool, the pairs of boxes near the top of the trees are divided among the threads, with the same result.
+bool BoundingBoxTree::FindIntersectingTriangles( const BoundingBoxTree& otherTree, TrianglePairArray& trianglePairArray, const AffineTransform* transform /*= nullptr*/, ThreadPool* threadPool /*= nullptr*/ ) const
+{
+	trianglePairArray.clear();
+
+	if( !IsCompiled() || !otherTree.IsCompiled() )
+		return false;
+
+	OverlapContext context;
+	context.otherTree = &otherTree;
+	context.nodes = GetFlatNodes();
+	context.otherNodes = otherTree.GetFlatNodes();
+	context.transform = transform;
+	if( transform )
+		GetTransformMatrix( *transform, context.matrix );
+
+	double min[3], max[3];
+	GetOtherNodeBox( context, context.otherNodes[0], min, max );
+	if( !NodeOverlapsBox( context.nodes[0], min, max ) )
+		return true;
+
+	NodePair rootPair;
+	rootPair.node = 0;
+	rootPair.otherNode = 0;
+	std::vector< NodePair > pairArray( 1, rootPair );
+
+	// We divide the pairs near the top until there are enough to go around.  Each pair is replaced by its children in place, so
+	// gathering the triangles under each pair in turn gives them in the same order that a single search from the top would.
+	if( threadPool && threadPool->GetThreadCount() > 1 )
+	{
+		int targetCount = threadPool->GetThreadCount() * NODE_PAIRS_PER_THREAD;
+		while( ( signed )pairArray.size() < targetCount )
+		{
+			std::vector< NodePair > childPairArray;
+			bool split = false;
+
+			for( int i = 0; i < ( signed )pairArray.size(); i++ )
+			{
+				const NodePair& pair = pairArray[i];
+				if( context.nodes[ pair.node ].IsLeaf() && context.otherNodes[ pair.otherNode ].IsLeaf() )
+					childPairArray.push_back( pair );
+				else
+				{
+					NodePair childPairs[2];
+					int count = SplitNodePair( context, pair, childPairs );
+					childPairArray.insert( childPairArray.end(), childPairs, childPairs + count );
+					split = true;
+				}
+			}
+
+			pairArray.swap( childPairArray );
+			if( !split )
+				break;
+		}
+	}
+
+	int count = ( int )pairArray.size();
+	std::vector< TrianglePairArray > pairTriangleArray( count );
+	ThreadPool::RangeFunction rangeFunction = [ & ]( int begin, int end ) {
+		for( int i = begin; i < end; i++ )
+			IntersectNodePair( context, pairArray[i], pairTriangleArray[i] );
+	};
+
+	if( threadPool )
+		threadPool->ParallelFor( count, 1, rangeFunction );
+	else
+		rangeFunction( 0, count );
+
+	for( int i = 0; i < count; i++ )
+		trianglePairArray.insert( trianglePairArray.end(), pairTriangleArray[i].begin(), pairTriangleArray[i].end() );
+
+	return true;
+}
+
+// Each pair on the stack is one whose boxes are known to overlap.  Taking the first child pair next, and putting off the second,
+// never leaves more pairs on the stack than the two trees are deep together.
+void BoundingBoxTree::IntersectNodePair( const OverlapContext& context, const NodePair& rootPair, TrianglePairArray& trianglePairArray ) const
+{
+	TraversalStack< NodePair > stack( flatTreeDepth + context.otherTree->flatTreeDepth + 1 );
+	stack.Push( rootPair );
+
+	while( !stack.IsEmpty() )
+	{
+		NodePair pair = stack.Pop();
+
+		if( context.nodes[ pair.node ].IsLeaf() && context.otherNodes[ pair.otherNode ].IsLeaf() )
+		{
+			IntersectLeafPair( context, pair, trianglePairArray );
+			continue;
+		}
+
+		NodePair childPairs[2];
+		int count = SplitNodePair( context, pair, childPairs );
+		for( int i = count - 1; i >= 0; i-- )
+			stack.Push( childPairs[i] );
+	}
+}
+
+// This divides whichever of the two boxes is larger, unless it's a leaf, and gives the pairs of boxes that still overlap.
+int BoundingBoxTree::SplitNodePair( const OverlapContext& context, const NodePair& pair, NodePair* childPairs ) const
+{
+	const FlatNode* nodes = context.nodes;
+	const FlatNode* otherNodes = context.otherNodes;
+	const FlatNode& node = nodes[ pair.node ];
+	const FlatNode& otherNode = otherNodes[ pair.otherNode ];
+
+	double min[3], max[3];
+	GetOtherNodeBox( context, otherNode, min, max );
+
+	bool splitNode = !node.IsLeaf();
+	if( splitNode && !otherNode.IsLeaf() )
+	{
+		double size[3] = { max[0] - min[0], max[1] - min[1], max[2] - min[2] };
+		double otherArea = 2.0 * ( size[0] * size[1] + size[1] * size[2] + size[2] * size[0] );
+		splitNode = ( node.SurfaceArea() >= otherArea ) ? true : false;
+	}
+
+	int count = 0;
+
+	if( splitNode )
+	{
+		int children[2] = { pair.node + 1, node.offset };
+		for( int i = 0; i < 2; i++ )
+		{
+			if( NodeOverlapsBox( nodes[ children[i] ], min, max ) )
+			{
+				childPairs[ count ].node = children[i];
+				childPairs[ count ].otherNode = pair.otherNode;
+				count++;
+			}
+		}
+	}
+	else
+	{
+		int children[2] = { pair.otherNode + 1, otherNode.offset };
+		for( int i = 0; i < 2; i++ )
+		{
+			GetOtherNodeBox( context, otherNodes[ children[i] ], min, max );
+			if( NodeOverlapsBox( node, min, max ) )
+			{
+				childPairs[ count ].node = pair.node;
+				childPairs[ count ].otherNode = children[i];
+				count++;
+			}
+		}
+	}
+
+	return count;
+}
+
+// Each of the other leaf's triangles is put through the transform just once, and skipped if it then misses this leaf's box altogether.
+void BoundingBoxTree::IntersectLeafPair( const OverlapContext& context, const NodePair& pair, TrianglePairArray& trianglePairArray ) const
+{
+	const FlatNode& node = context.nodes[ pair.node ];
+	const FlatNode& otherNode = context.otherNodes[ pair.otherNode ];
+
+	for( int j = otherNode.offset; j < otherNode.offset + otherNode.count; j++ )
+	{
+		const Triangle* otherTriangle = context.otherTree->GetFlatTriangle(j);
+
+		Triangle triangle = *otherTriangle;
+		if( context.transform )
+			context.transform->Transform( triangle.vertex, 3 );
+
+		double min[3], max[3];
+		min[0] = MIN( triangle.vertex[0].x, MIN( triangle.vertex[1].x, triangle.vertex[2].x ) );
+		min[1] = MIN( triangle.vertex[0].y, MIN( triangle.vertex[1].y, triangle.vertex[2].y ) );
+		min[2] = MIN( triangle.vertex[0].z, MIN( triangle.vertex[1].z, triangle.vertex[2].z ) );
+		max[0] = MAX( triangle.vertex[0].x, MAX( triangle.vertex[1].x, triangle.vertex[2].x ) );
+		max[1] = MAX( triangle.vertex[0].y, MAX( triangle.vertex[1].y, triangle.vertex[2].y ) );
+		max[2] = MAX( triangle.vertex[0].z, MAX( triangle.vertex[1].z, triangle.vertex[2].z ) );
+
+		if( !NodeOverlapsBox( node, min, max ) )
+			continue;
+
+		for( int i = node.offset; i < node.offset + node.count; i++ )
+		{
+			const Triangle* nodeTriangle = GetFlatTriangle(i);
+			if( nodeTriangle->Intersect( triangle ) )
+			{
+				TrianglePair trianglePair;
+				trianglePair.triangle = nodeTriangle;
+				trianglePair.otherTriangle = otherTriangle;
+				trianglePairArray.push_back( trianglePair );
+			}
+		}
+	}
+}
+
+bool BoundingBoxTree::FindIntersectionCompiled( const LineSegment& lineSegment, const Triangle*& intersectedTriangle, Vector& intersectionPoint, bool anyIntersection ) const
+{
+	FlatSegment segment;
+	segment.Set( lineSegment );
+
+	SegmentHit hit;
+	hit.triangle = -1;
+	hit.lambda = 1.0;
+
+	TraceSegment( segment, 0, hit, anyIntersection );
+
+	if( hit.triangle < 0 )
+	{
+		intersectedTriangle = nullptr;
+		return false;
+	}
+
+	// A visibility test needs no triangle, so it doesn't make the tree copy its triangles out of the records.
+	intersectedTriangle = anyIntersection ? nullptr : GetFlatTriangle( hit.triangle );
+	intersectionPoint = hit.point;
+	return true;
+}
+
+// The given hit bounds the search; nothing beyond it is considered, and it's replaced by anything nearer that is found.
+void BoundingBoxTree::TraceSegment( const FlatSegment& segment, int rootIndex, SegmentHit& hit, bool anyIntersection ) const
+{
+	const FlatNode* nodes = GetFlatNodes();
+
+	double entryLambda;
+	if( !segment.HitsBox( nodes[ rootIndex ], hit.lambda, entryLambda ) )
+		return;
+
+	TraversalStack< TraversalEntry > stack( flatTreeDepth );
+	int index = rootIndex;
+
+	while( index >= 0 )
+	{
+		const FlatNode& node = nodes[ index ];
+
+		if( node.IsLeaf() )
+		{
+			if( IntersectLeaf( node, segment, hit, anyIntersection ) && anyIntersection )
+				return;
+		}
+		else
+		{
+			// The child on the side of the split the segment starts from is searched first,
+			// so that its hits, if any, can rule out what's behind them in the other child.
+			int nearChild = index + 1;
+			int farChild = node.offset;
+			if( segment.direction[ node.axis ] < 0.0 )
+			{
+				nearChild = node.offset;
+				farChild = index + 1;
+			}
+
+			double nearLambda, farLambda;
+			bool hitsNearChild = segment.HitsBox( nodes[ nearChild ], hit.lambda, nearLambda );
+			bool hitsFarChild = segment.HitsBox( nodes[ farChild ], hit.lambda, farLambda );
+
+			if( hitsNearChild )
+			{
+				if( hitsFarChild )
+				{
+					TraversalEntry entry;
+					entry.node = farChild;
+					entry.lambda = farLambda;
+					stack.Push( entry );
+				}
+
+				index = nearChild;
+				continue;
+			}
+
+			if( hitsFarChild )
+			{
+				index = farChild;
+				continue;
+			}
+		}
+
+		// Resume with the next node we put off, unless the segment has since been cut short of it.
+		index = -1;
+		while( !stack.IsEmpty() )
+		{
+			TraversalEntry entry = stack.Pop();
+			if( entry.lambda <= hit.lambda )
+			{
+				index = entry.node;
+				break;
+			}
+		}
+	}
+}
+
+#define QUERY_GRAIN_SIZE		256
+#define MORTON_AXIS_BITS		10
+
+// Testing each box against all of a packet's segments at once pays off when the segments are coherent, like rays fanned out from one place,
+// so a packet whose segments head in different directions is traced one segment at a time.  The threads claim chunks of segments as they come
+// free, which is safe, since queries never change the tree.  Taking the segments in the order of the Morton codes of their midpoints makes those
+// traced together, or one after another on the same thread, tend to visit the same nodes.
+void BoundingBoxTree::FindIntersections( const LineSegment* lineSegments, int count, const Triangle** intersectedTriangles, Vector* intersectionPoints, int packetSize /*= 16*/, ThreadPool* threadPool /*= nullptr*/, bool sortQueries /*= false*/ ) const
+{
+	packetSize = MIN( MAX( packetSize, 1 ), int( MAX_PACKET_SIZE ) );
+
+	if( !sortQueries )
+	{
+		ParallelQueries( threadPool, count, [ & ]( int begin, int end ) {
+			TraceSegments( &lineSegments[ begin ], end - begin, &intersectedTriangles[ begin ], &intersectionPoints[ begin ], packetSize );
+		} );
+
+		return;
+	}
+
+	std::vector< int > orderArray;
+	SortByMortonCode( count, [ lineSegments ]( int i, double* position ) {
+		const Vector* vertex = lineSegments[i].vertex;
+		position[0] = 0.5 * ( vertex[0].x + vertex[1].x );
+		position[1] = 0.5 * ( vertex[0].y + vertex[1].y );
+		position[2] = 0.5 * ( vertex[0].z + vertex[1].z );
+	}, orderArray );
+
+	// Sorted segments are no longer side by side, so each packet's worth is gathered up, traced, and its results scattered back.
+	ParallelQueries( threadPool, count, [ & ]( int begin, int end ) {
+		LineSegment packetSegments[ MAX_PACKET_SIZE ];
+		const Triangle* packetTriangles[ MAX_PACKET_SIZE ];
+		Vector packetPoints[ MAX_PACKET_SIZE ];
+
+		for( int first = begin; first < end; first += packetSize )
+		{
+			int size = MIN( packetSize, end - first );
+
+			for( int i = 0; i < size; i++ )
+				packetSegments[i] = lineSegments[ orderArray[ first + i ] ];
+
+			TraceSegments( packetSegments, size, packetTriangles, packetPoints, packetSize );
+
+			for( int i = 0; i < size; i++ )
+			{
+				int j = orderArray[ first + i ];
+				intersectedTriangles[j] = packetTriangles[i];
+				if( packetTriangles[i] )
+					intersectionPoints[j] = packetPoints[i];
+			}
+		}
+	} );
+}
+
+void BoundingBoxTree::FindNearestTrianglesToPoints( const Vector* points, int count, const Triangle** nearestTriangles, Vector* nearestPoints, double maxDistance, ThreadPool* threadPool /*= nullptr*/, bool sortQueries /*= false*/ ) const
+{
+	std::vector< int > orderArray;
+	if( sortQueries )
+	{
+		SortByMortonCode( count, [ points ]( int i, double* position ) {
+			position[0] = points[i].x;
+			position[1] = points[i].y;
+			position[2] = points[i].z;
+		}, orderArray );
+	}
 
-BoundingBoxTree::BoundingBoxTree( void )
+	ParallelQueries( threadPool, count, [ & ]( int begin, int end ) {
+		for( int i = begin; i < end; i++ )
+		{
+			int j = sortQueries ? orderArray[i] : i;
+			if( !FindNearestTriangle( points[j], nearestTriangles[j], nearestPoints[j], maxDistance ) )
+				nearestTriangles[j] = nullptr;
+		}
+	} );
+}
+
+// Queries vary a lot in cost, so they're handed out in small chunks, letting a thread that finishes early go back for more.
+/*static*/ void BoundingBoxTree::ParallelQueries( ThreadPool* threadPool, int count, const std::function< void( int, int ) >& rangeFunction )
 {
-	rootNode = nullptr;
+	if( threadPool )
+		threadPool->ParallelFor( count, QUERY_GRAIN_SIZE, rangeFunction );
+	else if( count > 0 )
+		rangeFunction( 0, count );
 }
 
-/*virtual*/ BoundingBoxTree::~BoundingBoxTree( void )
+// Each key holds a query's Morton code above its index, so sorting the keys puts the queries in Morton order, and
+// those with the same code in the order given.  The codes are taken over the box bounding the queries' positions.
+template< typename GetPosition >
+/*static*/ void BoundingBoxTree::SortByMortonCode( int count, const GetPosition& getPosition, std::vector< int >& orderArray )
 {
-	delete rootNode;
+	orderArray.resize( count );
+	if( count == 0 )
+		return;
+
+	std::vector< double > positionArray( 3 * count );
+	double min[3], max[3];
+
+	for( int i = 0; i < count; i++ )
+	{
+		double* position = &positionArray[ 3 * i ];
+		getPosition( i, position );
+
+		for( int j = 0; j < 3; j++ )
+		{
+			min[j] = ( i == 0 ) ? position[j] : MIN( min[j], position[j] );
+			max[j] = ( i == 0 ) ? position[j] : MAX( max[j], position[j] );
+		}
+	}
+
+	double scale[3];
+	for( int j = 0; j < 3; j++ )
+		scale[j] = ( max[j] > min[j] ) ? double( ( 1 << MORTON_AXIS_BITS ) - 1 ) / ( max[j] - min[j] ) : 0.0;
+
+	std::vector< uint64_t > keyArray( count );
+	for( int i = 0; i < count; i++ )
+		keyArray[i] = ( uint64_t( GetMortonCode( &positionArray[ 3 * i ], min, scale ) ) << 32 ) | uint32_t(i);
+
+	std::sort( keyArray.begin(), keyArray.end() );
+
+	for( int i = 0; i < count; i++ )
+		orderArray[i] = int( keyArray[i] & 0xFFFFFFFF );
 }
 
-void BoundingBoxTree::GenerateNodes( const AxisAlignedBox& rootBox, int depth )
+// This interleaves the bits of the position's three grid coordinates, so that positions near one another tend to have codes near one another.
+/*static*/ uint32_t BoundingBoxTree::GetMortonCode( const double* position, const double* min, const double* scale )
 {
-	if( rootNode )
-		delete rootNode;
+	uint32_t code = 0;
 
-	rootNode = CreateNode( rootBox, depth );
+	for( int j = 0; j < 3; j++ )
+	{
+		// A position that isn't a number is put at the grid's corner, since converting it to an integer would be undefined.
+		double offset = ( position[j] - min[j] ) * scale[j];
+		uint32_t coordinate = ( offset > 0.0 ) ? uint32_t( MIN( offset, double( ( 1 << MORTON_AXIS_BITS ) - 1 ) ) ) : 0;
+
+		coordinate = ( coordinate | ( coordinate << 16 ) ) & 0x030000FF;
+		coordinate = ( coordinate | ( coordinate << 8 ) ) & 0x0300F00F;
+		coordinate = ( coordinate | ( coordinate << 4 ) ) & 0x030C30C3;
+		coordinate = ( coordinate | ( coordinate << 2 ) ) & 0x09249249;
+
+		code |= coordinate << j;
+	}
+
+	return code;
 }
 
-BoundingBoxTree::Node* BoundingBoxTree::CreateNode( const AxisAlignedBox& boundingBox, int depth )
+void BoundingBoxTree::TraceSegments( const LineSegment* lineSegments, int count, const Triangle** intersectedTriangles, Vector* intersectionPoints, int packetSize ) const
 {
-	Node* node = nullptr;
-	
-	if( depth == 1 )
-		node = new LeafNode();
-	else
+	SegmentPacket packet;
+	FlatSegment segments[ MAX_PACKET_SIZE ];
+	SegmentHit hits[ MAX_PACKET_SIZE ];
+
+	for( int first = 0; first < count; first += packetSize )
 	{
-		BranchNode* branchNode = new BranchNode();
+		int size = MIN( packetSize, count - first );
 
-		node = branchNode;
-	
-		AxisAlignedBox boxA, boxB;
-		boundingBox.SplitInTwo( boxA, boxB, &branchNode->plane );
+		if( !IsCompiled() || size == 1 || !packet.Set( &lineSegments[ first ], size ) )
+		{
+			for( int i = first; i < first + size; i++ )
+				if( !FindIntersection( lineSegments[i], intersectedTriangles[i], intersectionPoints[i] ) )
+					intersectedTriangles[i] = nullptr;
 
-		branchNode->backNode = CreateNode( boxA, depth - 1 );
-		branchNode->frontNode = CreateNode( boxB, depth - 1 );
+			continue;
+		}
+
+		for( int lane = 0; lane < size; lane++ )
+		{
+			segments[ lane ].Set( lineSegments[ first + lane ] );
+			hits[ lane ].triangle = -1;
+			hits[ lane ].lambda = 1.0;
+		}
+
+		TracePacket( packet, segments, hits );
+
+		for( int lane = 0; lane < size; lane++ )
+		{
+			if( hits[ lane ].triangle < 0 )
+				intersectedTriangles[ first + lane ] = nullptr;
+			else
+			{
+				intersectedTriangles[ first + lane ] = GetFlatTriangle( hits[ lane ].triangle );
+				intersectionPoints[ first + lane ] = hits[ lane ].point;
+			}
+		}
 	}
+}
 
-	node->boundingBox = boundingBox;
+void BoundingBoxTree::TracePacket( SegmentPacket& packet, const FlatSegment* segments, SegmentHit* hits ) const
+{
+	const FlatNode* nodes = GetFlatNodes();
 
-	return node;
+	TraversalStack< PacketEntry > stack( flatTreeDepth );
+
+	PacketEntry entry;
+	entry.node = 0;
+	entry.laneMask = ( 1u << packet.count ) - 1;
+	stack.Push( entry );
+
+	while( !stack.IsEmpty() )
+	{
+		entry = stack.Pop();
+
+		unsigned int laneMask = packet.HitsBox( nodes[ entry.node ], entry.laneMask );
+		if( laneMask == 0 )
+			continue;
+
+		if( ( laneMask & ( laneMask - 1 ) ) == 0 )
+		{
+			int lane = 0;
+			while( ( laneMask & ( 1u << lane ) ) == 0 )
+				lane++;
+
+			TraceSegment( segments[ lane ], entry.node, hits[ lane ], false );
+			packet.lambda[ lane ] = hits[ lane ].lambda;
+			continue;
+		}
+
+		const FlatNode& node = nodes[ entry.node ];
+
+		if( node.IsLeaf() )
+		{
+			for( int lane = 0; lane < packet.count; lane++ )
+			{
+				if( ( laneMask & ( 1u << lane ) ) != 0 && IntersectLeaf( node, segments[ lane ], hits[ lane ], false ) )
+					packet.lambda[ lane ] = hits[ lane ].lambda;
+			}
+		}
+		else
+		{
+			// The packet's segments all head the same way, so they agree on which child is nearer.
+			PacketEntry nearEntry, farEntry;
+			nearEntry.node = entry.node + 1;
+			farEntry.node = node.offset;
+			if( packet.directionSign[ node.axis ] < 0 )
+			{
+				nearEntry.node = node.offset;
+				farEntry.node = entry.node + 1;
+			}
+
+			nearEntry.laneMask = laneMask;
+			farEntry.laneMask = laneMask;
+			stack.Push( farEntry );
+			stack.Push( nearEntry );
+		}
+	}
 }
 
-bool BoundingBoxTree::InsertTriangle( const Triangle& triangle )
+#define LEAF_BATCH_SIZE		8
+
+// This is the Moller-Trumbore test, run over a leaf's triangles a batch at a time.  The batch is tested without branching,
+// so that the compiler can vectorize the loop, and only then do we look through the results for the nearest hit.
+bool BoundingBoxTree::IntersectLeaf( const FlatNode& node, const FlatSegment& segment, SegmentHit& hit, bool anyIntersection ) const
 {
-	if( !rootNode )
-		return false;
+	const double* record[ TRIANGLE_RECORD_COMPONENTS ];
+	for( int i = 0; i < TRIANGLE_RECORD_COMPONENTS; i++ )
+		record[i] = GetTriangleRecords() + i * flatTriangleCount;
 
-	return rootNode->InsertTriangle( triangle );
+	const double* vertex0X = record[ RECORD_VERTEX_0_X ];
+	const double* vertex0Y = record[ RECORD_VERTEX_0_Y ];
+	const double* vertex0Z = record[ RECORD_VERTEX_0_Z ];
+	const double* vertex1X = record[ RECORD_VERTEX_1_X ];
+	const double* vertex1Y = record[ RECORD_VERTEX_1_Y ];
+	const double* vertex1Z = record[ RECORD_VERTEX_1_Z ];
+	const double* vertex2X = record[ RECORD_VERTEX_2_X ];
+	const double* vertex2Y = record[ RECORD_VERTEX_2_Y ];
+	const double* vertex2Z = record[ RECORD_VERTEX_2_Z ];
+
+	double directionX = segment.direction[0];
+	double directionY = segment.direction[1];
+	double directionZ = segment.direction[2];
+
+	bool foundHit = false;
+	int end = node.offset + node.count;
+
+	for( int first = node.offset; first < end; first += LEAF_BATCH_SIZE )
+	{
+		int size = MIN( LEAF_BATCH_SIZE, end - first );
+		double maxLambda = hit.lambda;
+
+		double lambda[ LEAF_BATCH_SIZE ], u[ LEAF_BATCH_SIZE ], v[ LEAF_BATCH_SIZE ];
+
+		for( int j = 0; j < size; j++ )
+		{
+			int i = first + j;
+
+			double edgeAX = vertex1X[i] - vertex0X[i];
+			double edgeAY = vertex1Y[i] - vertex0Y[i];
+			double edgeAZ = vertex1Z[i] - vertex0Z[i];
+			double edgeBX = vertex2X[i] - vertex0X[i];
+			double edgeBY = vertex2Y[i] - vertex0Y[i];
+			double edgeBZ = vertex2Z[i] - vertex0Z[i];
+
+			double pX = directionY * edgeBZ - directionZ * edgeBY;
+			double pY = directionZ * edgeBX - directionX * edgeBZ;
+			double pZ = directionX * edgeBY - directionY * edgeBX;
+
+			// A segment parallel to the triangle gives a zero determinant, and then the infinities and NaNs below fail every comparison.
+			double determinant = edgeAX * pX + edgeAY * pY + edgeAZ * pZ;
+			double invDeterminant = 1.0 / determinant;
+
+			double tX = segment.origin[0] - vertex0X[i];
+			double tY = segment.origin[1] - vertex0Y[i];
+			double tZ = segment.origin[2] - vertex0Z[i];
+
+			double qX = tY * edgeAZ - tZ * edgeAY;
+			double qY = tZ * edgeAX - tX * edgeAZ;
+			double qZ = tX * edgeAY - tY * edgeAX;
+
+			u[j] = ( tX * pX + tY * pY + tZ * pZ ) * invDeterminant;
+			v[j] = ( directionX * qX + directionY * qY + directionZ * qZ ) * invDeterminant;
+			double t = ( edgeBX * qX + edgeBY * qY + edgeBZ * qZ ) * invDeterminant;
+
+			bool inside = ( u[j] >= -EPSILON ) & ( v[j] >= -EPSILON ) & ( u[j] + v[j] <= 1.0 + EPSILON ) & ( t >= 0.0 ) & ( t <= maxLambda );
+			lambda[j] = inside ? t : HUGE_VAL;
+		}
+
+		// Of hits equally far along, the first in the records is kept, so that a segment finds the same one whatever order the leaves
+		// are visited in, and a packet finds what its segments would alone.
+		for( int j = 0; j < size; j++ )
+		{
+			if( lambda[j] != HUGE_VAL && ( hit.triangle < 0 || lambda[j] < hit.lambda || ( lambda[j] == hit.lambda && first + j < hit.triangle ) ) )
+			{
+				hit.triangle = first + j;
+				hit.lambda = lambda[j];
+				hit.u = u[j];
+				hit.v = v[j];
+				foundHit = true;
+
+				if( anyIntersection )
+					break;
+			}
+		}
+
+		if( foundHit && anyIntersection )
+			break;
+	}
+
+	if( foundHit )
+		hit.point.Set( segment.origin[0] + directionX * hit.lambda, segment.origin[1] + directionY * hit.lambda, segment.origin[2] + directionZ * hit.lambda );
+
+	return foundHit;
 }
 
-bool BoundingBoxTree::InsertTriangleList( const TriangleList& triangleList, const Vector* normalFilter /*= nullptr*/, double angleFilter /*= 0.0*/ )
+// The records must already be sized for the tree's triangles.
+void BoundingBoxTree::SetTriangleRecord( int index, const Triangle& triangle )
 {
-	for( TriangleList::const_iterator iter = triangleList.begin(); iter != triangleList.cend(); iter++ )
+	double* record = triangleRecordArray->data() + index;
+	for( int i = 0; i < 3; i++ )
 	{
-		const Triangle& triangle = *iter;
+		record[ ( RECORD_VERTEX_0_X + 3 * i ) * flatTriangleCount ] = triangle.vertex[i].x;
+		record[ ( RECORD_VERTEX_0_Y + 3 * i ) * flatTriangleCount ] = triangle.vertex[i].y;
+		record[ ( RECORD_VERTEX_0_Z + 3 * i ) * flatTriangleCount ] = triangle.vertex[i].z;
+	}
+}
 
-		if( normalFilter )
+void BoundingBoxTree::GetRecordVertices( int index, Vector* vertex ) const
+{
+	const double* record = GetTriangleRecords() + index;
+	for( int i = 0; i < 3; i++ )
+	{
+		vertex[i].Set(
+			record[ ( RECORD_VERTEX_0_X + 3 * i ) * flatTriangleCount ],
+			record[ ( RECORD_VERTEX_0_Y + 3 * i ) * flatTriangleCount ],
+			record[ ( RECORD_VERTEX_0_Z + 3 * i ) * flatTriangleCount ] );
+	}
+}
+
+/*static*/ double BoundingBoxTree::SquareDistanceToBox( const FlatNode& node, const double* position )
+{
+	double squareDistance = 0.0;
+	for( int i = 0; i < 3; i++ )
+	{
+		double delta = MAX( MAX( double( node.min[i] ) - position[i], position[i] - double( node.max[i] ) ), 0.0 );
+		squareDistance += delta * delta;
+	}
+
+	return squareDistance;
+}
+
+/*static*/ double BoundingBoxTree::SquareDistanceToBox( const AxisAlignedBox& box, const double* position )
+{
+	double min[3] = { box.negCorner.x, box.negCorner.y, box.negCorner.z };
+	double max[3] = { box.posCorner.x, box.posCorner.y, box.posCorner.z };
+
+	double squareDistance = 0.0;
+	for( int i = 0; i < 3; i++ )
+	{
+		double delta = MAX( MAX( min[i] - position[i], position[i] - max[i] ), 0.0 );
+		squareDistance += delta * delta;
+	}
+
+	return squareDistance;
+}
+
+/*static*/ void BoundingBoxTree::GetOtherNodeBox( const OverlapContext& context, const FlatNode& otherNode, double* min, double* max )
+{
+	if( context.transform )
+		TransformNodeBox( context.matrix, otherNode, min, max );
+	else
+	{
+		for( int i = 0; i < 3; i++ )
 		{
-			Vector normal;
-			triangle.GetNormal( normal );
+			min[i] = otherNode.min[i];
+			max[i] = otherNode.max[i];
+		}
+	}
+}
 
-			double angle = normal.AngleBetween( *normalFilter );
-			if( angle >= angleFilter )
+/*static*/ bool BoundingBoxTree::NodeOverlapsBox( const FlatNode& node, const double* min, const double* max )
+{
+	for( int i = 0; i < 3; i++ )
+		if( double( node.min[i] ) > max[i] || double( node.max[i] ) < min[i] )
+			return false;
+
+	return true;
+}
+
+// The rows of this are those of the transform's linear part, followed by its translation.
+/*static*/ void BoundingBoxTree::GetTransformMatrix( const AffineTransform& transform, double matrix[3][4] )
+{
+	const Vector* axis[3] = { &transform.linearTransform.xAxis, &transform.linearTransform.yAxis, &transform.linearTransform.zAxis };
+	for( int j = 0; j < 3; j++ )
+	{
+		matrix[0][j] = axis[j]->x;
+		matrix[1][j] = axis[j]->y;
+		matrix[2][j] = axis[j]->z;
+	}
+
+	matrix[0][3] = transform.translation.x;
+	matrix[1][3] = transform.translation.y;
+	matrix[2][3] = transform.translation.z;
+}
+
+// This gives the box bounding the given one after the transform, which reaches out from the transformed center along each axis as far as any corner does.
+/*static*/ void BoundingBoxTree::TransformNodeBox( const double matrix[3][4], const FlatNode& node, double* min, double* max )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		double center = matrix[i][3];
+		double extent = 0.0;
+		for( int j = 0; j < 3; j++ )
+		{
+			center += matrix[i][j] * 0.5 * ( double( node.min[j] ) + double( node.max[j] ) );
+			extent += fabs( matrix[i][j] ) * 0.5 * ( double( node.max[j] ) - double( node.min[j] ) );
+		}
+
+		min[i] = center - extent;
+		max[i] = center + extent;
+	}
+}
+
+// This fails if the segments aren't coherent enough to be worth tracing together, which we take to mean
+// that some pair of them head in opposite directions along some axis.
+bool BoundingBoxTree::SegmentPacket::Set( const LineSegment* lineSegments, int count )
+{
+	this->count = count;
+
+	for( int axis = 0; axis < 3; axis++ )
+		directionSign[ axis ] = 0;
+
+	for( int lane = 0; lane < MAX_PACKET_SIZE; lane++ )
+	{
+		if( lane >= count )
+		{
+			// Unused lanes get an empty parameter range, so that they never hit anything.
+			for( int axis = 0; axis < 3; axis++ )
+			{
+				origin[ axis ][ lane ] = 0.0;
+				invDirection[ axis ][ lane ] = 0.0;
+			}
+
+			lambda[ lane ] = -1.0;
+			continue;
+		}
+
+		const LineSegment& lineSegment = lineSegments[ lane ];
+		double start[3] = { lineSegment.vertex[0].x, lineSegment.vertex[0].y, lineSegment.vertex[0].z };
+		double end[3] = { lineSegment.vertex[1].x, lineSegment.vertex[1].y, lineSegment.vertex[1].z };
+
+		for( int axis = 0; axis < 3; axis++ )
+		{
+			double direction = end[ axis ] - start[ axis ];
+			origin[ axis ][ lane ] = start[ axis ];
+
+			// A huge reciprocal stands in for an infinite one, which would give NaNs for segments lying in a slab's face.
+			// The slab test then keeps the whole parameter range or none of it, depending on whether the segment is inside.
+			if( direction == 0.0 )
+			{
+				invDirection[ axis ][ lane ] = 1e300;
 				continue;
+			}
+
+			invDirection[ axis ][ lane ] = 1.0 / direction;
+
+			int sign = ( direction > 0.0 ) ? 1 : -1;
+			if( directionSign[ axis ] == 0 )
+				directionSign[ axis ] = sign;
+			else if( directionSign[ axis ] != sign )
+				return false;
 		}
 
-		if( !InsertTriangle( triangle ) )
-			return false;
+		lambda[ lane ] = 1.0;
 	}
 
 	return true;
 }
 
-bool BoundingBoxTree::FindIntersection( const LineSegment& lineSegment, const Triangle*& intersectedTriangle, Vector& intersectionPoint ) const
+// This is FlatSegment::HitsBox done for each segment of the packet in the given mask, two segments at a time if we can.
+// The arithmetic is the same, so a segment hits the box here if and only if it does there.
+unsigned int BoundingBoxTree::SegmentPacket::HitsBox( const FlatNode& node, unsigned int laneMask ) const
 {
-	if( !rootNode )
-		return false;
+	unsigned int hitMask = 0;
 
-	return rootNode->FindIntersection( lineSegment, intersectedTriangle, intersectionPoint );
+#if defined( BOUNDING_BOX_TREE_SSE2 )
+
+	__m128d min[3], max[3];
+	for( int axis = 0; axis < 3; axis++ )
+	{
+		min[ axis ] = _mm_set1_pd( double( node.min[ axis ] ) - EPSILON );
+		max[ axis ] = _mm_set1_pd( double( node.max[ axis ] ) + EPSILON );
+	}
+
+	for( int lane = 0; lane < count; lane += 2 )
+	{
+		if( ( laneMask & ( 3u << lane ) ) == 0 )
+			continue;
+
+		__m128d lambdaMin = _mm_setzero_pd();
+		__m128d lambdaMax = _mm_load_pd( &lambda[ lane ] );
+
+		for( int axis = 0; axis < 3; axis++ )
+		{
+			__m128d start = _mm_load_pd( &origin[ axis ][ lane ] );
+			__m128d scale = _mm_load_pd( &invDirection[ axis ][ lane ] );
+			__m128d lambdaA = _mm_mul_pd( _mm_sub_pd( min[ axis ], start ), scale );
+			__m128d lambdaB = _mm_mul_pd( _mm_sub_pd( max[ axis ], start ), scale );
+			lambdaMin = _mm_max_pd( lambdaMin, _mm_min_pd( lambdaA, lambdaB ) );
+			lambdaMax = _mm_min_pd( lambdaMax, _mm_max_pd( lambdaA, lambdaB ) );
+		}
+
+		hitMask |= ( unsigned int )_mm_movemask_pd( _mm_cmple_pd( lambdaMin, lambdaMax ) ) << lane;
+	}
+
+#else
+
+	for( int lane = 0; lane < count; lane++ )
+	{
+		if( ( laneMask & ( 1u << lane ) ) == 0 )
+			continue;
+
+		double lambdaMin = 0.0;
+		double lambdaMax = lambda[ lane ];
+
+		for( int axis = 0; axis < 3; axis++ )
+		{
+			double lambdaA = ( double( node.min[ axis ] ) - EPSILON - origin[ axis ][ lane ] ) * invDirection[ axis ][ lane ];
+			double lambdaB = ( double( node.max[ axis ] ) + EPSILON - origin[ axis ][ lane ] ) * invDirection[ axis ][ lane ];
+			lambdaMin = MAX( lambdaMin, MIN( lambdaA, lambdaB ) );
+			lambdaMax = MIN( lambdaMax, MAX( lambdaA, lambdaB ) );
+		}
+
+		if( lambdaMin <= lambdaMax )
+			hitMask |= 1u << lane;
+	}
+
+#endif
+
+	return hitMask & laneMask;
 }
 
-bool BoundingBoxTree::FindNearestTriangle( const Vector& point, const Triangle*& nearestTriangle, double maxDistance ) const
+double BoundingBoxTree::FlatNode::SurfaceArea( void ) const
 {
-	if( !rootNode )
-		return false;
+	double x = double( max[0] ) - double( min[0] );
+	double y = double( max[1] ) - double( min[1] );
+	double z = double( max[2] ) - double( min[2] );
+	return 2.0 * ( x * y + y * z + z * x );
+}
+
+void BoundingBoxTree::FlatSegment::Set( const LineSegment& lineSegment )
+{
+	origin[0] = lineSegment.vertex[0].x;
+	origin[1] = lineSegment.vertex[0].y;
+	origin[2] = lineSegment.vertex[0].z;
+
+	direction[0] = lineSegment.vertex[1].x - origin[0];
+	direction[1] = lineSegment.vertex[1].y - origin[1];
+	direction[2] = lineSegment.vertex[1].z - origin[2];
+
+	for( int i = 0; i < 3; i++ )
+		invDirection[i] = ( direction[i] != 0.0 ) ? 1.0 / direction[i] : 0.0;
+}
+
+// This is the slab test, clipping the segment's parameter range against each pair of faces in turn.
+// Like AxisAlignedBox::IntersectsWithLineSegment, it gives the box a little room for round-off.
+bool BoundingBoxTree::FlatSegment::HitsBox( const FlatNode& node, double maxLambda, double& entryLambda ) const
+{
+	double lambdaMin = 0.0;
+	double lambdaMax = maxLambda;
+
+	for( int i = 0; i < 3; i++ )
+	{
+		double min = double( node.min[i] ) - EPSILON;
+		double max = double( node.max[i] ) + EPSILON;
+
+		if( direction[i] == 0.0 )
+		{
+			if( origin[i] < min || origin[i] > max )
+				return false;
+			continue;
+		}
+
+		double lambdaA = ( min - origin[i] ) * invDirection[i];
+		double lambdaB = ( max - origin[i] ) * invDirection[i];
+		if( lambdaA > lambdaB )
+		{
+			double lambda = lambdaA;
+			lambdaA = lambdaB;
+			lambdaB = lambda;
+		}
+
+		lambdaMin = MAX( lambdaMin, lambdaA );
+		lambdaMax = MIN( lambdaMax, lambdaB );
+		if( lambdaMin > lambdaMax )
+			return false;
+	}
 
-	return rootNode->FindNearestTriangle( point, nearestTriangle, maxDistance );
+	entryLambda = lambdaMin;
+	return true;
 }
 
 //-----------------------------------------------------------------------------------------------------------
@@ -155,13 +2998,39 @@ BoundingBoxTree::BranchNode::BranchNode( void )
 
 /*virtual*/ bool BoundingBoxTree::BranchNode::FindIntersection( const LineSegment& lineSegment, const Triangle*& intersectedTriangle, Vector& intersectionPoint ) const
 {
-	if( boundingBox.IntersectsWithLineSegment( lineSegment ) )
+	if( !boundingBox.IntersectsWithLineSegment( lineSegment ) )
+		return false;
+
+	// Either side may have the nearer intersection, so we have to search both.
+	const Triangle* backTriangle = nullptr;
+	Vector backPoint;
+	bool backHit = backNode->FindIntersection( lineSegment, backTriangle, backPoint );
+
+	const Triangle* frontTriangle = nullptr;
+	Vector frontPoint;
+	bool frontHit = frontNode->FindIntersection( lineSegment, frontTriangle, frontPoint );
+
+	if( backHit && frontHit )
+	{
+		Vector backDelta, frontDelta;
+		backDelta.Subtract( backPoint, lineSegment.vertex[0] );
+		frontDelta.Subtract( frontPoint, lineSegment.vertex[0] );
+		if( frontDelta.Dot( frontDelta ) < backDelta.Dot( backDelta ) )
+			backHit = false;
+	}
+
+	if( backHit )
 	{
-		if( backNode->FindIntersection( lineSegment, intersectedTriangle, intersectionPoint ) )
-			return true;
+		intersectedTriangle = backTriangle;
+		intersectionPoint = backPoint;
+		return true;
+	}
 
-		if( frontNode->FindIntersection( lineSegment, intersectedTriangle, intersectionPoint ) )
-			return true;
+	if( frontHit )
+	{
+		intersectedTriangle = frontTriangle;
+		intersectionPoint = frontPoint;
+		return true;
 	}
 
 	return false;
@@ -169,16 +3038,33 @@ BoundingBoxTree::BranchNode::BranchNode( void )
 
 /*virtual*/ bool BoundingBoxTree::BranchNode::FindNearestTriangle( const Vector& point, const Triangle*& nearestTriangle, double maxDistance ) const
 {
-	if( boundingBox.ContainsPoint( point ) )
+	// The nearer child is searched first, and the farther one only if its box comes within the distance of what we found.
+	const Node* nearNode = backNode;
+	const Node* farNode = frontNode;
+	double nearDistance = nearNode->boundingBox.DistanceToPoint( point );
+	double farDistance = farNode->boundingBox.DistanceToPoint( point );
+	if( farDistance < nearDistance )
 	{
-		if( backNode->FindNearestTriangle( point, nearestTriangle, maxDistance ) )
-			return true;
+		std::swap( nearNode, farNode );
+		std::swap( nearDistance, farDistance );
+	}
 
-		if( frontNode->FindNearestTriangle( point, nearestTriangle, maxDistance ) )
-			return true;
+	bool foundTriangle = false;
+	if( nearDistance <= maxDistance && nearNode->FindNearestTriangle( point, nearestTriangle, maxDistance ) )
+	{
+		foundTriangle = true;
+		maxDistance = nearestTriangle->DistanceToPoint( point );
 	}
 
-	return false;
+	const Triangle* farTriangle = nullptr;
+	if( farDistance <= maxDistance && farNode->FindNearestTriangle( point, farTriangle, maxDistance ) )
+	{
+		if( !foundTriangle || farTriangle->DistanceToPoint( point ) < maxDistance )
+			nearestTriangle = farTriangle;
+		foundTriangle = true;
+	}
+
+	return foundTriangle;
 }
 
 //-----------------------------------------------------------------------------------------------------------
@@ -214,15 +3100,18 @@ BoundingBoxTree::LeafNode::LeafNode( void )
 	for( TriangleList::const_iterator iter = triangleList->cbegin(); iter != triangleList->cend(); iter++ )
 	{
 		const Triangle& triangle = *iter;
-		if( triangle.Intersect( lineSegment, intersectionPoint ) )
+
+		Vector point;
+		if( triangle.Intersect( lineSegment, point ) )
 		{
 			double lambda;
-			if( lineSegment.LerpInverse( lambda, intersectionPoint ) )
+			if( lineSegment.LerpInverse( lambda, point ) )
 			{
 				if( lambda < smallestLambda )
 				{
 					smallestLambda = lambda;
 					intersectedTriangle = &triangle;
+					intersectionPoint = point;
 				}
 			}
 		}
@@ -6,17 +6,26 @@
 #include "AxisAlignedBox.h"
 #include "Triangle.h"
 #include "Plane.h"
+#include <functional>
 
 namespace _3DMath
 {
 	class BoundingBoxTree;
 	class LineSegment;
 	class Renderer;
+	class TriangleMesh;
+	class ThreadPool;
+	class AffineTransform;
+	class InstancedBoundingBoxTree;
+	class CompactBoundingBoxTree;
+	class MappedFile;
 }
 
 class _3DMATH_API _3DMath::BoundingBoxTree
 {
 	friend Renderer;
+	friend InstancedBoundingBoxTree;
+	friend CompactBoundingBoxTree;
 
 public:
 
@@ -25,11 +34,71 @@ public:
 
 	void GenerateNodes( const AxisAlignedBox& rootBox, int depth );
 
+	// These build a compiled tree to fit the given triangles, with up to the given number in a leaf.
+	bool Build( const TriangleList& triangleList, int maxLeafSize = 4, ThreadPool* threadPool = nullptr );
+	bool Build( const TriangleMesh& triangleMesh, int maxLeafSize = 4, ThreadPool* threadPool = nullptr );
+
+	// This compiles a tree made with GenerateNodes and InsertTriangle, after which no more triangles can be inserted.
+	bool Compile( void );
+	bool IsCompiled( void ) const;
+
+	// This brings a tree built from a mesh up to date with the mesh as it has since moved, rebuilding any subtree whose box has grown by more
+	// than the given factor in area.  It fails, leaving the tree empty, if the mesh no longer has the tree's triangles.  Otherwise, any
+	// triangles it has handed back stay where they are, brought up to date, and still stand for the same mesh triangles.
+	bool Refit( const TriangleMesh& triangleMesh, double rebuildFactor = 0.0, ThreadPool* threadPool = nullptr );
+	bool CanRefit( void ) const;
+
+	// These save a compiled tree to a cache file and load it back.  Load fails, leaving the tree empty, unless the file has this
+	// format version and the given content hash.
+	bool Save( const std::string& file, uint64_t contentHash = 0 ) const;
+	bool Load( const std::string& file, uint64_t contentHash = 0 );
+
 	bool InsertTriangle( const Triangle& triangle );
 	bool InsertTriangleList( const TriangleList& triangleList, const Vector* normalFilter = nullptr, double angleFilter = 0.0 );
 
+	// This finds the intersection nearest the first vertex of the given segment.
 	bool FindIntersection( const LineSegment& lineSegment, const Triangle*& intersectedTriangle, Vector& intersectionPoint ) const;
+
+	// This only tells whether the segment hits anything, and so stops at the first intersection found.
+	bool IntersectsWithLineSegment( const LineSegment& lineSegment ) const;
+
+	// This gives for each segment what FindIntersection would, or a null triangle, tracing them in packets of up to sixteen, on the given
+	// thread pool, if any, and in a cache-friendly order, if asked.  Each result goes where its segment was given.
+	void FindIntersections( const LineSegment* lineSegments, int count, const Triangle** intersectedTriangles, Vector* intersectionPoints, int packetSize = 16, ThreadPool* threadPool = nullptr, bool sortQueries = false ) const;
+
+	// This finds the triangle nearest the given point, if any is within the given distance, along with the point of it
+	// nearest the given one, and, if asked, that point's barycentric coordinates.
 	bool FindNearestTriangle( const Vector& point, const Triangle*& nearestTriangle, double maxDistance ) const;
+	bool FindNearestTriangle( const Vector& point, const Triangle*& nearestTriangle, Vector& nearestPoint, double maxDistance, Vector* barycentricCoords = nullptr ) const;
+
+	// This gives for each point what FindNearestTriangle would, or a null triangle, running the points as FindIntersections does segments.
+	void FindNearestTrianglesToPoints( const Vector* points, int count, const Triangle** nearestTriangles, Vector* nearestPoints, double maxDistance, ThreadPool* threadPool = nullptr, bool sortQueries = false ) const;
+
+	// These are the queries to use on a tree built from a mesh, giving the index of the mesh triangle found and the barycentric
+	// coordinates of the point found on it.  They fail if the tree wasn't built from a mesh.
+	bool FindIntersection( const LineSegment& lineSegment, int& meshTriangle, Vector& intersectionPoint, Vector* barycentricCoords = nullptr ) const;
+	bool FindNearestTriangle( const Vector& point, int& meshTriangle, Vector& nearestPoint, double maxDistance, Vector* barycentricCoords = nullptr ) const;
+	int GetMeshTriangle( const Triangle* triangle ) const;
+
+	// This finds every triangle within the given distance of the given point, in no particular order, and returns how many
+	// there are, though only as many as fit are written to the given arrays.  The distances may be left out.
+	int FindTrianglesWithinDistance( const Vector& point, double distance, const Triangle** triangles, double* distances, int maxCount ) const;
+
+	// This finds up to the given number of triangles nearest the given point, and within the given distance of it, nearest first,
+	// returning how many it found.  The distances can't be left out here.
+	int FindNearestTriangles( const Vector& point, int count, const Triangle** triangles, double* distances, double maxDistance ) const;
+
+	struct TrianglePair
+	{
+		const Triangle* triangle;			// This is from this tree.
+		const Triangle* otherTriangle;		// This is from the other tree, as it was before the transform.
+	};
+
+	typedef std::vector< TrianglePair > TrianglePairArray;
+
+	// This finds every pair of intersecting triangles, one from this tree and one from the given one, with the given tree's triangles
+	// first put through the given transform, if any.  Both trees must be compiled.
+	bool FindIntersectingTriangles( const BoundingBoxTree& otherTree, TrianglePairArray& trianglePairArray, const AffineTransform* transform = nullptr, ThreadPool* threadPool = nullptr ) const;
 
 	class _3DMATH_API Node
 	{
@@ -79,7 +148,252 @@ private:
 
 	Node* CreateNode( const AxisAlignedBox& boundingBox, int depth );
 
+	// This is exactly 32 bytes, so that two nodes share a typical cache line.  The box is rounded outward
+	// from the double-precision one so that it still bounds everything beneath it.
+	struct FlatNode
+	{
+		enum { LEAF_AXIS = 3 };
+
+		bool IsLeaf( void ) const { return( axis == LEAF_AXIS ? true : false ); }
+		double SurfaceArea( void ) const;
+
+		float min[3], max[3];
+		int offset;					// The second child of a branch, or the first triangle of a leaf.
+		unsigned short count;		// This is the number of triangles in a leaf.
+		unsigned short axis;		// This is the axis along which a branch divides its triangles, or LEAF_AXIS.
+	};
+
+	typedef std::vector< FlatNode > FlatNodeArray;
+
+	struct FlatSegment
+	{
+		void Set( const LineSegment& lineSegment );
+		bool HitsBox( const FlatNode& node, double maxLambda, double& entryLambda ) const;
+
+		double origin[3], direction[3], invDirection[3];
+	};
+
+	// A traversal never holds more nodes on its stack than the tree is deep, so we allocate only for very deep trees.
+	template< typename EntryType >
+	class TraversalStack
+	{
+	public:
+
+		TraversalStack( int depth )
+		{
+			entry = buffer;
+			if( depth > STACK_BUFFER_SIZE )
+			{
+				heapArray.resize( depth );
+				entry = heapArray.data();
+			}
+			size = 0;
+		}
+
+		void Push( const EntryType& value ) { entry[ size++ ] = value; }
+		EntryType Pop( void ) { return entry[ --size ]; }
+		bool IsEmpty( void ) const { return( size == 0 ? true : false ); }
+
+	private:
+
+		enum { STACK_BUFFER_SIZE = 64 };
+
+		EntryType buffer[ STACK_BUFFER_SIZE ];
+		std::vector< EntryType > heapArray;
+		EntryType* entry;
+		int size;
+	};
+
+	struct TraversalEntry
+	{
+		int node;
+		double lambda;
+	};
+
+	struct NearCollector;
+	struct NearestCollector;
+	struct RangeCollector;
+	struct KNearestCollector;
+	struct TransformedNearestCollector;
+
+	enum { MAX_PACKET_SIZE = 16 };
+
+	// This holds a packet's segments laid out so that the same coordinate of neighboring segments can be loaded together.
+	struct SegmentPacket
+	{
+		bool Set( const LineSegment* lineSegments, int count );
+		unsigned int HitsBox( const FlatNode& node, unsigned int laneMask ) const;
+
+		alignas( 16 ) double origin[3][ MAX_PACKET_SIZE ];
+		alignas( 16 ) double invDirection[3][ MAX_PACKET_SIZE ];
+		alignas( 16 ) double lambda[ MAX_PACKET_SIZE ];
+		int directionSign[3];
+		int count;
+	};
+
+	struct PacketEntry
+	{
+		int node;
+		unsigned int laneMask;
+	};
+
+	struct SegmentHit
+	{
+		int triangle;		// This is the triangle's place in the records, or -1 if nothing was hit.
+		Vector point;
+		double lambda;
+		double u, v;
+	};
+
+	// The leaf triangles are kept as records of their vertices, with each coordinate in its own run of the record array
+	// so that a leaf's triangles can be tested together.
+	enum
+	{
+		RECORD_VERTEX_0_X, RECORD_VERTEX_0_Y, RECORD_VERTEX_0_Z,
+		RECORD_VERTEX_1_X, RECORD_VERTEX_1_Y, RECORD_VERTEX_1_Z,
+		RECORD_VERTEX_2_X, RECORD_VERTEX_2_Y, RECORD_VERTEX_2_Z,
+		TRIANGLE_RECORD_COMPONENTS
+	};
+
+	void ClearCompiledTree( void );
+	bool CompileNode( const Node* node, int depth );
+	static void SetFlatNodeBox( FlatNode& flatNode, const double* min, const double* max );
+
+	bool FindIntersectionCompiled( const LineSegment& lineSegment, const Triangle*& intersectedTriangle, Vector& intersectionPoint, bool anyIntersection ) const;
+	void TraceSegment( const FlatSegment& segment, int rootIndex, SegmentHit& hit, bool anyIntersection ) const;
+	void TracePacket( SegmentPacket& packet, const FlatSegment* segments, SegmentHit* hits ) const;
+	void TraceSegments( const LineSegment* lineSegments, int count, const Triangle** intersectedTriangles, Vector* intersectionPoints, int packetSize ) const;
+	template< typename GetPosition > static void SortByMortonCode( int count, const GetPosition& getPosition, std::vector< int >& orderArray );
+	static uint32_t GetMortonCode( const double* position, const double* min, const double* scale );
+	static void ParallelQueries( ThreadPool* threadPool, int count, const std::function< void( int, int ) >& rangeFunction );
+	bool IntersectLeaf( const FlatNode& node, const FlatSegment& segment, SegmentHit& hit, bool anyIntersection ) const;
+	void SetTriangleRecord( int index, const Triangle& triangle );
+	void GetRecordVertices( int index, Vector* vertex ) const;
+	template< typename Collector > void VisitNear( const double* position, Collector& collector ) const;
+	template< typename Collector > void VisitNearLeaf( const FlatNode& node, const double* position, Collector& collector ) const;
+	template< typename Collector > void VisitNearNode( const Node* node, const double* position, Collector& collector ) const;
+	static double SquareDistanceToBox( const FlatNode& node, const double* position );
+
+	// This is FindNearestTriangle as though the tree were put through the given transform, for InstancedBoundingBoxTree.  Anything
+	// nearer than the given distance replaces the given triangle and point, and the distance is reduced to match.
+	bool FindNearestTransformed( const Vector& point, const Vector& localPoint, const AffineTransform& transform, double minScale, const Triangle*& nearestTriangle, Vector& nearestPoint, double& squareDistance ) const;
+	static double SquareDistanceToBox( const AxisAlignedBox& box, const double* position );
+
+	struct NodePair
+	{
+		int node;
+		int otherNode;
+	};
+
+	struct OverlapContext
+	{
+		const BoundingBoxTree* otherTree;
+		const FlatNode* nodes;
+		const FlatNode* otherNodes;
+		const AffineTransform* transform;
+		double matrix[3][4];
+	};
+
+	void IntersectNodePair( const OverlapContext& context, const NodePair& rootPair, TrianglePairArray& trianglePairArray ) const;
+	int SplitNodePair( const OverlapContext& context, const NodePair& pair, NodePair* childPairs ) const;
+	void IntersectLeafPair( const OverlapContext& context, const NodePair& pair, TrianglePairArray& trianglePairArray ) const;
+	static void GetOtherNodeBox( const OverlapContext& context, const FlatNode& otherNode, double* min, double* max );
+	static bool NodeOverlapsBox( const FlatNode& node, const double* min, const double* max );
+	static void GetTransformMatrix( const AffineTransform& transform, double matrix[3][4] );
+	static void TransformNodeBox( const double matrix[3][4], const FlatNode& node, double* min, double* max );
+
+	struct BuildBox
+	{
+		void Set( const BuildBox& box );
+		void Grow( const BuildBox& box );
+		void GrowToIncludePoint( const double* point );
+		double SurfaceArea( void ) const;
+
+		double min[3], max[3];
+	};
+
+	struct BuildPrimitive
+	{
+		void Set( const Triangle& triangle, int index );
+
+		BuildBox box;
+		double center[3];
+		int triangle;
+	};
+
+	typedef std::vector< BuildPrimitive > BuildPrimitiveArray;
+
+	struct BuildSplit
+	{
+		BuildBox box;
+		int axis;		// This is -1 if the primitives are to be left together in a leaf.
+		int split;
+	};
+
+	struct BuildContext
+	{
+		BuildPrimitiveArray* primitiveArray;
+		int maxLeafSize;
+		int nearRootSize;		// Nodes with at least this many primitives are split with the thread pool's help.
+		ThreadPool* threadPool;
+	};
+
+	struct BuildBins;
+	struct BuildJob;
+
+	bool Build( const std::vector< Triangle >& triangleArray, const std::vector< int >* meshTriangleArray, int maxLeafSize, ThreadPool* threadPool );
+	static void BuildNode( const BuildContext& context, int begin, int end, int depth, FlatNodeArray& nodeArray, int& treeDepth );
+	static void SplitPrimitives( const BuildContext& context, int begin, int end, BuildSplit& buildSplit, bool useThreadPool );
+	void PlanBuildJob( const BuildContext& context, BuildJob* job, std::vector< BuildJob* >& pendingJobArray );
+	void RunBuildJob( const BuildContext& context, BuildJob* job );
+	void StitchBuildJob( const BuildJob* job );
+	static void BoundPrimitives( const BuildPrimitive* primitives, int begin, int end, BuildBox& box, BuildBox& centerBox );
+	static int StablePartition( BuildPrimitive* primitives, int count, const std::function< bool( const BuildPrimitive& ) >& isOnLeft, ThreadPool* threadPool );
+	static void ParallelFor( ThreadPool* threadPool, int count, const std::function< void( int, int ) >& rangeFunction );
+
+	struct CacheHeader;
+
+	const FlatNode* GetFlatNodes( void ) const;
+	int GetFlatNodeCount( void ) const;
+	const double* GetTriangleRecords( void ) const;
+	const int* GetMeshTriangles( void ) const;
+	const float* GetBuiltAreas( void ) const;
+	const Triangle* GetFlatTriangles( void ) const;
+	const Triangle* GetFlatTriangle( int index ) const;
+	int GetFlatTriangleSlot( int index ) const;
+	void MatchFlatTriangles( void );
+	static bool ValidateCache( const MappedFile& mappedFile, uint64_t contentHash );
+	void ReleaseMappedFile( void );
+
+	void RecordBuiltAreas( ThreadPool* threadPool );
+	void RefitNodes( ThreadPool* threadPool );
+	void RebuildSubtrees( const std::vector< int >& rootArray, ThreadPool* threadPool );
+	void RebuildSubtree( int index, FlatNodeArray& subtreeArray );
+	void UpdateTreeDepth( void );
+	int GetSubtreeEnd( int index ) const;
+
+	struct FlatTriangleState;
+
 	Node* rootNode;
+	FlatNodeArray* flatNodeArray;
+	std::vector< Triangle >* flatTriangleArray;		// This copies the records as triangles, but only once something asks for them.
+	FlatTriangleState* flatTriangleState;
+	std::vector< int >* flatTriangleSlotArray;		// This gives where each record's triangle is, once a refit has moved the records.
+	std::vector< int >* flatTriangleMeshArray;		// This gives the mesh triangle of each triangle, once a refit has moved the records.
+	std::vector< double >* triangleRecordArray;
+	std::vector< int >* meshTriangleArray;		// This is parallel to the records if the tree was built from a mesh.
+	std::vector< float >* builtAreaArray;		// This is parallel to the node array, giving the surface area of each box as built.
+	int flatTriangleCount;
+	int flatTreeDepth;
+	int flatMaxLeafSize;
+
+	// A tree loaded from a cache file uses these in place of the arrays above.
+	MappedFile* mappedFile;
+	const FlatNode* mappedNodes;
+	int mappedNodeCount;
+	const double* mappedRecords;
+	const int* mappedMeshTriangles;
+	const float* mappedBuiltAreas;
 };
 
 // BoundingBoxTree.h
\ No newline at end of file
@@ -41,7 +41,7 @@ bool BspTree::Generate( const TriangleMesh& triangleMesh )
 		vertexArray->push_back( ( *triangleMesh.vertexArray )[i] );
 
 	IndexTriangleList triangleList;
-	for( IndexTriangleList::const_iterator iter = triangleMesh.triangleList->cbegin(); iter != triangleMesh.triangleList->cend(); iter++ )
+	for( IndexTriangleArray::const_iterator iter = triangleMesh.triangleArray->cbegin(); iter != triangleMesh.triangleArray->cend(); iter++ )
 		triangleList.push_back( *iter );
 
 	try
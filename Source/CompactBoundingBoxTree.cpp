@@ -0,0 +1,660 @@
+// CompactBoundingBoxTree.cpp
+
+#include "CompactBoundingBoxTree.h"
+#include "LineSegment.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#	define COMPACT_BOUNDING_BOX_TREE_SSE2
+#	include <emmintrin.h>
+#endif
+
+using namespace _3DMath;
+
+CompactBoundingBoxTree::CompactBoundingBoxTree( void )
+{
+	nodeArray = new std::vector< WideNode >();
+	vertexArray = new std::vector< Vector >();
+	vertexIndexArray = new std::vector< int >();
+	meshTriangleArray = new std::vector< int >();
+	treeDepth = 0;
+}
+
+/*virtual*/ CompactBoundingBoxTree::~CompactBoundingBoxTree( void )
+{
+	delete nodeArray;
+	delete vertexArray;
+	delete vertexIndexArray;
+	delete meshTriangleArray;
+}
+
+void CompactBoundingBoxTree::Clear( void )
+{
+	nodeArray->clear();
+	vertexArray->clear();
+	vertexIndexArray->clear();
+	meshTriangleArray->clear();
+	treeDepth = 0;
+}
+
+bool CompactBoundingBoxTree::Build( const BoundingBoxTree& boxTree )
+{
+	Clear();
+
+	if( !boxTree.CanRefit() )
+		return false;
+
+	int count = boxTree.flatTriangleCount;
+	meshTriangleArray->assign( boxTree.GetMeshTriangles(), boxTree.GetMeshTriangles() + count );
+
+	std::vector< Vector > cornerArray( 3 * count );
+	for( int i = 0; i < count; i++ )
+		boxTree.GetRecordVertices( i, &cornerArray[ 3 * i ] );
+
+	// The triangles' corners are sorted so that those at the same vertex come together, comparing the bits of their coordinates,
+	// so that a vertex is shared only by corners that are exactly alike, and the triangles tested are exactly those of the given tree.
+	auto getBits = [ & ]( int corner, uint64_t* bits ) {
+		memcpy( bits, &cornerArray[ corner ].x, 3 * sizeof( double ) );
+	};
+
+	std::vector< int > sortedCornerArray( 3 * count );
+	for( int i = 0; i < 3 * count; i++ )
+		sortedCornerArray[i] = i;
+
+	std::sort( sortedCornerArray.begin(), sortedCornerArray.end(), [ & ]( int cornerA, int cornerB ) {
+		uint64_t bitsA[3], bitsB[3];
+		getBits( cornerA, bitsA );
+		getBits( cornerB, bitsB );
+		return std::lexicographical_compare( bitsA, bitsA + 3, bitsB, bitsB + 3 );
+	} );
+
+	vertexIndexArray->resize( 3 * count );
+	for( int i = 0; i < 3 * count; i++ )
+	{
+		int corner = sortedCornerArray[i];
+		if( i == 0 || memcmp( &cornerArray[ corner ].x, &cornerArray[ sortedCornerArray[ i - 1 ] ].x, 3 * sizeof( double ) ) != 0 )
+			vertexArray->push_back( cornerArray[ corner ] );
+
+		( *vertexIndexArray )[ corner ] = ( int )vertexArray->size() - 1;
+	}
+
+	vertexArray->shrink_to_fit();
+
+	nodeArray->reserve( boxTree.GetFlatNodeCount() / 3 + 1 );
+	BuildNode( boxTree.GetFlatNodes(), 0, 1 );
+	return true;
+}
+
+// This makes a node in place of the given binary one, opening up the largest of the boxes below it until it has four children, or
+// has only leaves left to open.  The children's boxes are put on a grid over the binary node's box, which bounds them all.
+int CompactBoundingBoxTree::BuildNode( const FlatNode* flatNodes, int flatIndex, int depth )
+{
+	treeDepth = MAX( treeDepth, depth );
+
+	const FlatNode& flatNode = flatNodes[ flatIndex ];
+
+	int flatChild[4];
+	int flatChildCount = 0;
+
+	if( flatNode.IsLeaf() )
+		flatChild[ flatChildCount++ ] = flatIndex;
+	else
+	{
+		flatChild[ flatChildCount++ ] = flatIndex + 1;
+		flatChild[ flatChildCount++ ] = flatNode.offset;
+
+		while( flatChildCount < 4 )
+		{
+			int largest = -1;
+			double largestArea = 0.0;
+			for( int i = 0; i < flatChildCount; i++ )
+			{
+				const FlatNode& child = flatNodes[ flatChild[i] ];
+				if( !child.IsLeaf() && ( largest < 0 || child.SurfaceArea() > largestArea ) )
+				{
+					largest = i;
+					largestArea = child.SurfaceArea();
+				}
+			}
+
+			if( largest < 0 )
+				break;
+
+			int index = flatChild[ largest ];
+			flatChild[ largest ] = index + 1;
+			flatChild[ flatChildCount++ ] = flatNodes[ index ].offset;
+		}
+	}
+
+	// The array may grow as we make the children, so we fill in the node on the side and store it last.
+	int index = ( int )nodeArray->size();
+	nodeArray->push_back( WideNode() );
+
+	WideNode node;
+	memset( &node, 0, sizeof( WideNode ) );
+	SetGrid( node, flatNode );
+
+	for( int i = 0; i < flatChildCount; i++ )
+	{
+		const FlatNode& child = flatNodes[ flatChild[i] ];
+		if( child.IsLeaf() && child.count == 0 )
+			continue;
+
+		int slot = node.childCount++;
+		SetChildBox( node, slot, child );
+
+		if( child.IsLeaf() )
+		{
+			node.child[ slot ] = child.offset;
+			node.count[ slot ] = child.count;
+		}
+		else
+			node.child[ slot ] = BuildNode( flatNodes, flatChild[i], depth + 1 );
+	}
+
+	( *nodeArray )[ index ] = node;
+	return index;
+}
+
+// The grid starts at the least corner of the box, and along each axis, its spacing is the least power of two that lets 255 steps
+// reach the far side.  A grid point is found the same way everywhere, as the corner plus a whole number of steps, where the product
+// is exact, so that points found while building and while searching agree to the last bit.
+/*static*/ void CompactBoundingBoxTree::SetGrid( WideNode& node, const FlatNode& flatNode )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		node.origin[i] = flatNode.min[i];
+
+		double origin = double( flatNode.min[i] );
+		double extent = double( flatNode.max[i] ) - origin;
+
+		int exponent = -128;
+		if( extent > 0.0 )
+		{
+			frexp( extent / 255.0, &exponent );
+			exponent = MIN( MAX( exponent - 1, -128 ), 127 );
+		}
+
+		while( exponent < 127 && origin + 255.0 * GetSpacing( int8_t( exponent ) ) < double( flatNode.max[i] ) )
+			exponent++;
+
+		while( exponent > -128 && origin + 255.0 * GetSpacing( int8_t( exponent - 1 ) ) >= double( flatNode.max[i] ) )
+			exponent--;
+
+		node.exponent[i] = int8_t( exponent );
+	}
+}
+
+// Each offset is first estimated, then stepped outward for as long as its grid point falls short of the box.
+/*static*/ void CompactBoundingBoxTree::SetChildBox( WideNode& node, int child, const FlatNode& flatNode )
+{
+	for( int i = 0; i < 3; i++ )
+	{
+		double origin = double( node.origin[i] );
+		double spacing = GetSpacing( node.exponent[i] );
+		double min = double( flatNode.min[i] );
+		double max = double( flatNode.max[i] );
+
+		int minOffset = int( MIN( MAX( floor( ( min - origin ) / spacing ), 0.0 ), 255.0 ) );
+		while( minOffset > 0 && origin + double( minOffset ) * spacing > min )
+			minOffset--;
+
+		int maxOffset = int( MIN( MAX( ceil( ( max - origin ) / spacing ), 0.0 ), 255.0 ) );
+		while( maxOffset < 255 && origin + double( maxOffset ) * spacing < max )
+			maxOffset++;
+
+		node.min[i][ child ] = uint8_t( minOffset );
+		node.max[i][ child ] = uint8_t( maxOffset );
+	}
+}
+
+// Every exponent an 8-bit integer can hold gives a normal double, so we can just write the exponent bits.
+/*static*/ double CompactBoundingBoxTree::GetSpacing( int8_t exponent )
+{
+	uint64_t bits = uint64_t( int( exponent ) + 1023 ) << 52;
+	double spacing;
+	memcpy( &spacing, &bits, sizeof( double ) );
+	return spacing;
+}
+
+int CompactBoundingBoxTree::GetNodeCount( void ) const
+{
+	return ( int )nodeArray->size();
+}
+
+size_t CompactBoundingBoxTree::GetMemoryFootprint( void ) const
+{
+	return	nodeArray->size() * sizeof( WideNode ) +
+			vertexArray->size() * sizeof( Vector ) +
+			vertexIndexArray->size() * sizeof( int ) +
+			meshTriangleArray->size() * sizeof( int );
+}
+
+void CompactBoundingBoxTree::GetTriangleVertices( int triangle, Vector* vertex ) const
+{
+	const int* vertexIndex = &( *vertexIndexArray )[ 3 * triangle ];
+	for( int i = 0; i < 3; i++ )
+		vertex[i] = ( *vertexArray )[ vertexIndex[i] ];
+}
+
+bool CompactBoundingBoxTree::FindIntersection( const LineSegment& lineSegment, int& meshTriangle, Vector& intersectionPoint, Vector* barycentricCoords /*= nullptr*/ ) const
+{
+	meshTriangle = -1;
+
+	if( nodeArray->size() == 0 )
+		return false;
+
+	FlatSegment segment;
+	segment.Set( lineSegment );
+
+	SegmentHit hit;
+	hit.triangle = -1;
+	hit.lambda = 1.0;
+
+	TraceSegment( segment, hit, false );
+
+	if( hit.triangle < 0 )
+		return false;
+
+	meshTriangle = ( *meshTriangleArray )[ hit.triangle ];
+	intersectionPoint = hit.point;
+
+	if( barycentricCoords )
+		barycentricCoords->Set( 1.0 - hit.u - hit.v, hit.u, hit.v );
+
+	return true;
+}
+
+bool CompactBoundingBoxTree::IntersectsWithLineSegment( const LineSegment& lineSegment ) const
+{
+	if( nodeArray->size() == 0 )
+		return false;
+
+	FlatSegment segment;
+	segment.Set( lineSegment );
+
+	SegmentHit hit;
+	hit.triangle = -1;
+	hit.lambda = 1.0;
+
+	TraceSegment( segment, hit, true );
+
+	return( hit.triangle >= 0 ? true : false );
+}
+
+// This is BoundingBoxTree::TraceSegment with four children to a node.  Those the segment passes through are put on the stack farthest
+// first, so that the nearest is taken off first.  Each node we come to adds at most three entries to the stack, so it never holds more
+// than three for each level of the tree.
+void CompactBoundingBoxTree::TraceSegment( const FlatSegment& segment, SegmentHit& hit, bool anyIntersection ) const
+{
+	const WideNode* nodes = nodeArray->data();
+
+	BoundingBoxTree::TraversalStack< TraversalEntry > stack( 3 * treeDepth + 1 );
+	int index = 0;
+
+	while( index >= 0 )
+	{
+		const WideNode& node = nodes[ index ];
+
+		double entryLambda[4];
+		int hitMask = HitChildren( node, segment, hit.lambda, entryLambda );
+
+		TraversalEntry entries[4];
+		int count = 0;
+		for( int i = 0; i < node.childCount; i++ )
+		{
+			if( !( hitMask & ( 1 << i ) ) )
+				continue;
+
+			int j = count++;
+			while( j > 0 && entries[ j - 1 ].distance < entryLambda[i] )
+			{
+				entries[j] = entries[ j - 1 ];
+				j--;
+			}
+
+			entries[j].child = node.child[i];
+			entries[j].count = node.count[i];
+			entries[j].distance = entryLambda[i];
+		}
+
+		for( int i = 0; i < count; i++ )
+			stack.Push( entries[i] );
+
+		index = -1;
+		while( !stack.IsEmpty() )
+		{
+			TraversalEntry entry = stack.Pop();
+			if( entry.distance > hit.lambda )
+				continue;
+
+			if( entry.count == 0 )
+			{
+				index = entry.child;
+				break;
+			}
+
+			if( IntersectLeaf( entry.child, entry.count, segment, hit, anyIntersection ) && anyIntersection )
+				return;
+		}
+	}
+}
+
+// This is FlatSegment::HitsBox for each of the node's children, with the same room for round-off, returning a bit for each child hit.
+int CompactBoundingBoxTree::HitChildren( const WideNode& node, const FlatSegment& segment, double maxLambda, double* entryLambda ) const
+{
+#if defined( COMPACT_BOUNDING_BOX_TREE_SSE2 )
+
+	// Each register holds two children's values, so four children take a pair of registers.
+	__m128d lambdaMin[2] = { _mm_setzero_pd(), _mm_setzero_pd() };
+	__m128d lambdaMax[2] = { _mm_set1_pd( maxLambda ), _mm_set1_pd( maxLambda ) };
+	__m128d inside[2] = { _mm_cmpeq_pd( lambdaMin[0], lambdaMin[0] ), _mm_cmpeq_pd( lambdaMin[0], lambdaMin[0] ) };
+
+	__m128i zero = _mm_setzero_si128();
+	__m128d epsilon = _mm_set1_pd( EPSILON );
+
+	for( int i = 0; i < 3; i++ )
+	{
+		int32_t minBytes, maxBytes;
+		memcpy( &minBytes, node.min[i], sizeof( int32_t ) );
+		memcpy( &maxBytes, node.max[i], sizeof( int32_t ) );
+
+		__m128i minOffset = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( minBytes ), zero ), zero );
+		__m128i maxOffset = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( maxBytes ), zero ), zero );
+
+		__m128d origin = _mm_set1_pd( double( node.origin[i] ) );
+		__m128d spacing = _mm_set1_pd( GetSpacing( node.exponent[i] ) );
+
+		__m128d min[2], max[2];
+		min[0] = _mm_sub_pd( _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( minOffset ), spacing ) ), epsilon );
+		min[1] = _mm_sub_pd( _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( _mm_shuffle_epi32( minOffset, 0xEE ) ), spacing ) ), epsilon );
+		max[0] = _mm_add_pd( _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( maxOffset ), spacing ) ), epsilon );
+		max[1] = _mm_add_pd( _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( _mm_shuffle_epi32( maxOffset, 0xEE ) ), spacing ) ), epsilon );
+
+		__m128d segmentOrigin = _mm_set1_pd( segment.origin[i] );
+
+		if( segment.direction[i] == 0.0 )
+		{
+			for( int j = 0; j < 2; j++ )
+				inside[j] = _mm_and_pd( inside[j], _mm_and_pd( _mm_cmple_pd( min[j], segmentOrigin ), _mm_cmple_pd( segmentOrigin, max[j] ) ) );
+
+			continue;
+		}
+
+		__m128d invDirection = _mm_set1_pd( segment.invDirection[i] );
+
+		for( int j = 0; j < 2; j++ )
+		{
+			__m128d lambdaA = _mm_mul_pd( _mm_sub_pd( min[j], segmentOrigin ), invDirection );
+			__m128d lambdaB = _mm_mul_pd( _mm_sub_pd( max[j], segmentOrigin ), invDirection );
+			lambdaMin[j] = _mm_max_pd( lambdaMin[j], _mm_min_pd( lambdaA, lambdaB ) );
+			lambdaMax[j] = _mm_min_pd( lambdaMax[j], _mm_max_pd( lambdaA, lambdaB ) );
+		}
+	}
+
+	int hitMask = 0;
+	for( int j = 0; j < 2; j++ )
+	{
+		__m128d hits = _mm_and_pd( inside[j], _mm_cmple_pd( lambdaMin[j], lambdaMax[j] ) );
+		hitMask |= _mm_movemask_pd( hits ) << ( 2 * j );
+		_mm_storeu_pd( entryLambda + 2 * j, lambdaMin[j] );
+	}
+
+	return hitMask & ( ( 1 << node.childCount ) - 1 );
+
+#else
+
+	int hitMask = 0;
+
+	for( int j = 0; j < node.childCount; j++ )
+	{
+		double lambdaMin = 0.0;
+		double lambdaMax = maxLambda;
+		bool hits = true;
+
+		for( int i = 0; i < 3 && hits; i++ )
+		{
+			double origin = double( node.origin[i] );
+			double spacing = GetSpacing( node.exponent[i] );
+			double min = ( origin + double( node.min[i][j] ) * spacing ) - EPSILON;
+			double max = ( origin + double( node.max[i][j] ) * spacing ) + EPSILON;
+
+			if( segment.direction[i] == 0.0 )
+			{
+				hits = ( segment.origin[i] >= min && segment.origin[i] <= max );
+				continue;
+			}
+
+			double lambdaA = ( min - segment.origin[i] ) * segment.invDirection[i];
+			double lambdaB = ( max - segment.origin[i] ) * segment.invDirection[i];
+			lambdaMin = MAX( lambdaMin, MIN( lambdaA, lambdaB ) );
+			lambdaMax = MIN( lambdaMax, MAX( lambdaA, lambdaB ) );
+			hits = ( lambdaMin <= lambdaMax );
+		}
+
+		entryLambda[j] = lambdaMin;
+		if( hits )
+			hitMask |= 1 << j;
+	}
+
+	return hitMask;
+
+#endif
+}
+
+// This is the same test as BoundingBoxTree::IntersectLeaf makes, but the edges are taken from the vertices as we go.
+bool CompactBoundingBoxTree::IntersectLeaf( int first, int count, const FlatSegment& segment, SegmentHit& hit, bool anyIntersection ) const
+{
+	const double* direction = segment.direction;
+	bool foundHit = false;
+
+	for( int i = first; i < first + count; i++ )
+	{
+		Vector vertex[3];
+		GetTriangleVertices( i, vertex );
+
+		double edgeA[3] = { vertex[1].x - vertex[0].x, vertex[1].y - vertex[0].y, vertex[1].z - vertex[0].z };
+		double edgeB[3] = { vertex[2].x - vertex[0].x, vertex[2].y - vertex[0].y, vertex[2].z - vertex[0].z };
+
+		double p[3] =
+		{
+			direction[1] * edgeB[2] - direction[2] * edgeB[1],
+			direction[2] * edgeB[0] - direction[0] * edgeB[2],
+			direction[0] * edgeB[1] - direction[1] * edgeB[0],
+		};
+
+		// A segment parallel to the triangle gives a zero determinant, and then the infinities and NaNs below fail every comparison.
+		double determinant = edgeA[0] * p[0] + edgeA[1] * p[1] + edgeA[2] * p[2];
+		double invDeterminant = 1.0 / determinant;
+
+		double t[3] = { segment.origin[0] - vertex[0].x, segment.origin[1] - vertex[0].y, segment.origin[2] - vertex[0].z };
+
+		double q[3] =
+		{
+			t[1] * edgeA[2] - t[2] * edgeA[1],
+			t[2] * edgeA[0] - t[0] * edgeA[2],
+			t[0] * edgeA[1] - t[1] * edgeA[0],
+		};
+
+		double u = ( t[0] * p[0] + t[1] * p[1] + t[2] * p[2] ) * invDeterminant;
+		double v = ( direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2] ) * invDeterminant;
+		double lambda = ( edgeB[0] * q[0] + edgeB[1] * q[1] + edgeB[2] * q[2] ) * invDeterminant;
+
+		if( u >= -EPSILON && v >= -EPSILON && u + v <= 1.0 + EPSILON && lambda >= 0.0 && lambda <= hit.lambda && ( hit.triangle < 0 || lambda < hit.lambda || ( lambda == hit.lambda && i < hit.triangle ) ) )
+		{
+			hit.triangle = i;
+			hit.lambda = lambda;
+			hit.u = u;
+			hit.v = v;
+			foundHit = true;
+
+			if( anyIntersection )
+				break;
+		}
+	}
+
+	if( foundHit )
+		hit.point.Set( segment.origin[0] + direction[0] * hit.lambda, segment.origin[1] + direction[1] * hit.lambda, segment.origin[2] + direction[2] * hit.lambda );
+
+	return foundHit;
+}
+
+// This is BoundingBoxTree's search for the nearest triangle, with four children to a node.
+bool CompactBoundingBoxTree::FindNearestTriangle( const Vector& point, int& meshTriangle, Vector& nearestPoint, double maxDistance, Vector* barycentricCoords /*= nullptr*/ ) const
+{
+	meshTriangle = -1;
+
+	if( nodeArray->size() == 0 || maxDistance < 0.0 )
+		return false;
+
+	const WideNode* nodes = nodeArray->data();
+	double position[3] = { point.x, point.y, point.z };
+	double squareRadius = maxDistance * maxDistance;
+	int nearestTriangle = -1;
+	double nearestU = 0.0, nearestV = 0.0;
+
+	BoundingBoxTree::TraversalStack< TraversalEntry > stack( 3 * treeDepth + 1 );
+	int index = 0;
+
+	while( index >= 0 )
+	{
+		const WideNode& node = nodes[ index ];
+
+		double squareDistance[4];
+		GetChildSquareDistances( node, position, squareDistance );
+
+		TraversalEntry entries[4];
+		int count = 0;
+		for( int i = 0; i < node.childCount; i++ )
+		{
+			if( squareDistance[i] > squareRadius )
+				continue;
+
+			int j = count++;
+			while( j > 0 && entries[ j - 1 ].distance < squareDistance[i] )
+			{
+				entries[j] = entries[ j - 1 ];
+				j--;
+			}
+
+			entries[j].child = node.child[i];
+			entries[j].count = node.count[i];
+			entries[j].distance = squareDistance[i];
+		}
+
+		for( int i = 0; i < count; i++ )
+			stack.Push( entries[i] );
+
+		index = -1;
+		while( !stack.IsEmpty() )
+		{
+			TraversalEntry entry = stack.Pop();
+			if( entry.distance > squareRadius )
+				continue;
+
+			if( entry.count == 0 )
+			{
+				index = entry.child;
+				break;
+			}
+
+			for( int i = entry.child; i < entry.child + entry.count; i++ )
+			{
+				Vector vertex[3];
+				GetTriangleVertices( i, vertex );
+
+				double base[3] = { vertex[0].x, vertex[0].y, vertex[0].z };
+				double edgeA[3] = { vertex[1].x - vertex[0].x, vertex[1].y - vertex[0].y, vertex[1].z - vertex[0].z };
+				double edgeB[3] = { vertex[2].x - vertex[0].x, vertex[2].y - vertex[0].y, vertex[2].z - vertex[0].z };
+
+				double u, v;
+				double squareDistance = Triangle::NearestPoint( position, base, edgeA, edgeB, u, v );
+				if( squareDistance < squareRadius || ( squareDistance == squareRadius && ( nearestTriangle < 0 || i < nearestTriangle ) ) )
+				{
+					nearestTriangle = i;
+					squareRadius = squareDistance;
+					nearestU = u;
+					nearestV = v;
+				}
+			}
+		}
+	}
+
+	if( nearestTriangle < 0 )
+		return false;
+
+	Vector vertex[3];
+	GetTriangleVertices( nearestTriangle, vertex );
+
+	double w = 1.0 - nearestU - nearestV;
+	nearestPoint.Set(
+		w * vertex[0].x + nearestU * vertex[1].x + nearestV * vertex[2].x,
+		w * vertex[0].y + nearestU * vertex[1].y + nearestV * vertex[2].y,
+		w * vertex[0].z + nearestU * vertex[1].z + nearestV * vertex[2].z );
+
+	if( barycentricCoords )
+		barycentricCoords->Set( w, nearestU, nearestV );
+
+	meshTriangle = ( *meshTriangleArray )[ nearestTriangle ];
+	return true;
+}
+
+void CompactBoundingBoxTree::GetChildSquareDistances( const WideNode& node, const double* position, double* squareDistance ) const
+{
+#if defined( COMPACT_BOUNDING_BOX_TREE_SSE2 )
+
+	__m128d sum[2] = { _mm_setzero_pd(), _mm_setzero_pd() };
+	__m128i zero = _mm_setzero_si128();
+
+	for( int i = 0; i < 3; i++ )
+	{
+		int32_t minBytes, maxBytes;
+		memcpy( &minBytes, node.min[i], sizeof( int32_t ) );
+		memcpy( &maxBytes, node.max[i], sizeof( int32_t ) );
+
+		__m128i minOffset = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( minBytes ), zero ), zero );
+		__m128i maxOffset = _mm_unpacklo_epi16( _mm_unpacklo_epi8( _mm_cvtsi32_si128( maxBytes ), zero ), zero );
+
+		__m128d origin = _mm_set1_pd( double( node.origin[i] ) );
+		__m128d spacing = _mm_set1_pd( GetSpacing( node.exponent[i] ) );
+		__m128d point = _mm_set1_pd( position[i] );
+
+		__m128d min[2], max[2];
+		min[0] = _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( minOffset ), spacing ) );
+		min[1] = _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( _mm_shuffle_epi32( minOffset, 0xEE ) ), spacing ) );
+		max[0] = _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( maxOffset ), spacing ) );
+		max[1] = _mm_add_pd( origin, _mm_mul_pd( _mm_cvtepi32_pd( _mm_shuffle_epi32( maxOffset, 0xEE ) ), spacing ) );
+
+		for( int j = 0; j < 2; j++ )
+		{
+			__m128d delta = _mm_max_pd( _mm_max_pd( _mm_sub_pd( min[j], point ), _mm_sub_pd( point, max[j] ) ), _mm_setzero_pd() );
+			sum[j] = _mm_add_pd( sum[j], _mm_mul_pd( delta, delta ) );
+		}
+	}
+
+	_mm_storeu_pd( squareDistance, sum[0] );
+	_mm_storeu_pd( squareDistance + 2, sum[1] );
+
+#else
+
+	for( int j = 0; j < 4; j++ )
+	{
+		squareDistance[j] = 0.0;
+
+		for( int i = 0; i < 3; i++ )
+		{
+			double origin = double( node.origin[i] );
+			double spacing = GetSpacing( node.exponent[i] );
+			double min = origin + double( node.min[i][j] ) * spacing;
+			double max = origin + double( node.max[i][j] ) * spacing;
+
+			double delta = MAX( MAX( min - position[i], position[i] - max ), 0.0 );
+			squareDistance[j] += delta * delta;
+		}
+	}
+
+#endif
+}
+
+// CompactBoundingBoxTree.cpp
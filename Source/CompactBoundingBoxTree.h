@@ -0,0 +1,84 @@
+// CompactBoundingBoxTree.h
+
+#pragma once
+
+#include "Defines.h"
+#include "BoundingBoxTree.h"
+
+namespace _3DMath
+{
+	class CompactBoundingBoxTree;
+	class LineSegment;
+}
+
+// This holds a compiled BoundingBoxTree in a fraction of the memory, to be queried in its place.  Each node has up to four children,
+// found by opening up the largest boxes below each binary node, so there are about a third as many nodes.  Each child's box is kept
+// as 8-bit offsets on a grid laid over its parent's box, with the grid spacing a power of two along each axis, and each offset rounded
+// outward, so the box given back always holds the one it was made from.  A node then takes 64 bytes, where the binary tree spends 32
+// bytes on each of about three times as many.  Each triangle is kept as the indices of its vertices, which are kept once each, where the
+// binary tree keeps 72 bytes of vertices per triangle.  The four children's boxes are tested together using SIMD instructions where available.
+class _3DMATH_API _3DMath::CompactBoundingBoxTree
+{
+public:
+
+	CompactBoundingBoxTree( void );
+	virtual ~CompactBoundingBoxTree( void );
+
+	void Clear( void );
+
+	// This fails if the given tree isn't compiled or wasn't built from a mesh.  The given tree may be discarded afterward.
+	bool Build( const BoundingBoxTree& boxTree );
+
+	// These are as for BoundingBoxTree on a tree built from a mesh, and find the same mesh triangles.
+	bool FindIntersection( const LineSegment& lineSegment, int& meshTriangle, Vector& intersectionPoint, Vector* barycentricCoords = nullptr ) const;
+	bool IntersectsWithLineSegment( const LineSegment& lineSegment ) const;
+	bool FindNearestTriangle( const Vector& point, int& meshTriangle, Vector& nearestPoint, double maxDistance, Vector* barycentricCoords = nullptr ) const;
+
+	int GetNodeCount( void ) const;
+
+	// This is the number of bytes taken up by the nodes, the triangles and their vertices.
+	size_t GetMemoryFootprint( void ) const;
+
+private:
+
+	typedef BoundingBoxTree::FlatNode FlatNode;
+	typedef BoundingBoxTree::FlatSegment FlatSegment;
+	typedef BoundingBoxTree::SegmentHit SegmentHit;
+
+	struct WideNode
+	{
+		float origin[3];			// This is the least corner of the node's own box.
+		int8_t exponent[3];			// The grid spacing along each axis is two to this power.
+		uint8_t childCount;
+		uint8_t min[3][4];
+		uint8_t max[3][4];
+		int child[4];				// This is the index of a child node, or the first triangle of a child leaf.
+		uint16_t count[4];			// This is the number of triangles in a child leaf, or zero for a child node.
+	};
+
+	struct TraversalEntry
+	{
+		int child;
+		int count;
+		double distance;			// This is how far along the segment the child's box is entered, or how far the point is from it.
+	};
+
+	int BuildNode( const FlatNode* flatNodes, int flatIndex, int depth );
+	static void SetGrid( WideNode& node, const FlatNode& flatNode );
+	static void SetChildBox( WideNode& node, int child, const FlatNode& flatNode );
+	static double GetSpacing( int8_t exponent );
+
+	void TraceSegment( const FlatSegment& segment, SegmentHit& hit, bool anyIntersection ) const;
+	int HitChildren( const WideNode& node, const FlatSegment& segment, double maxLambda, double* entryLambda ) const;
+	bool IntersectLeaf( int first, int count, const FlatSegment& segment, SegmentHit& hit, bool anyIntersection ) const;
+	void GetChildSquareDistances( const WideNode& node, const double* position, double* squareDistance ) const;
+	void GetTriangleVertices( int triangle, Vector* vertex ) const;
+
+	std::vector< WideNode >* nodeArray;
+	std::vector< Vector >* vertexArray;
+	std::vector< int >* vertexIndexArray;		// This gives three vertices for each triangle, in the order of the given tree's records.
+	std::vector< int >* meshTriangleArray;		// This is parallel to the triangles.
+	int treeDepth;
+};
+
+// CompactBoundingBoxTree.h
@@ -0,0 +1,293 @@
+// CompactMesh.cpp
+
+#include "CompactMesh.h"
+#include "TriangleMesh.h"
+#include "Vertex.h"
+
+using namespace _3DMath;
+
+CompactMesh::CompactMesh( void )
+{
+	positionFormat = POSITION_FORMAT_FLOAT;
+	attributeFlags = 0;
+	vertexCount = 0;
+	indexSize = 4;
+
+	floatPositionArray = new std::vector< float >();
+	quantizedPositionArray = new std::vector< uint16_t >();
+	normalArray = new std::vector< int16_t >();
+	colorArray = new std::vector< uint8_t >();
+	texCoordsArray = new std::vector< float >();
+	indexArray = new std::vector< uint8_t >();
+}
+
+/*virtual*/ CompactMesh::~CompactMesh( void )
+{
+	delete floatPositionArray;
+	delete quantizedPositionArray;
+	delete normalArray;
+	delete colorArray;
+	delete texCoordsArray;
+	delete indexArray;
+}
+
+void CompactMesh::Clear( void )
+{
+	vertexCount = 0;
+	attributeFlags = 0;
+
+	floatPositionArray->clear();
+	quantizedPositionArray->clear();
+	normalArray->clear();
+	colorArray->clear();
+	texCoordsArray->clear();
+	indexArray->clear();
+}
+
+void CompactMesh::SetFromTriangleMesh( const TriangleMesh& triangleMesh, PositionFormat positionFormat /*= POSITION_FORMAT_QUANTIZED_16*/, int attributeFlags /*= ATTRIBUTE_NORMAL | ATTRIBUTE_COLOR*/ )
+{
+	Clear();
+
+	this->positionFormat = positionFormat;
+	this->attributeFlags = attributeFlags;
+
+	vertexCount = ( int )triangleMesh.vertexArray->size();
+
+	boundingBox.negCorner.Set( 0.0, 0.0, 0.0 );
+	boundingBox.posCorner.Set( 0.0, 0.0, 0.0 );
+	triangleMesh.GenerateBoundingBox( boundingBox );
+
+	if( positionFormat == POSITION_FORMAT_FLOAT )
+	{
+		floatPositionArray->resize( 3 * vertexCount );
+		for( int i = 0; i < vertexCount; i++ )
+		{
+			const Vector& position = ( *triangleMesh.vertexArray )[i].position;
+			float* floatPosition = &( *floatPositionArray )[ 3 * i ];
+			floatPosition[0] = float( position.x );
+			floatPosition[1] = float( position.y );
+			floatPosition[2] = float( position.z );
+		}
+	}
+	else
+	{
+		Vector extent;
+		extent.Subtract( boundingBox.posCorner, boundingBox.negCorner );
+
+		double scale[3];
+		scale[0] = ( extent.x > 0.0 ) ? 65535.0 / extent.x : 0.0;
+		scale[1] = ( extent.y > 0.0 ) ? 65535.0 / extent.y : 0.0;
+		scale[2] = ( extent.z > 0.0 ) ? 65535.0 / extent.z : 0.0;
+
+		quantizedPositionArray->resize( 3 * vertexCount );
+		for( int i = 0; i < vertexCount; i++ )
+		{
+			Vector offset;
+			offset.Subtract( ( *triangleMesh.vertexArray )[i].position, boundingBox.negCorner );
+
+			double coordinate[3] = { offset.x * scale[0], offset.y * scale[1], offset.z * scale[2] };
+
+			uint16_t* quantizedPosition = &( *quantizedPositionArray )[ 3 * i ];
+			for( int j = 0; j < 3; j++ )
+				quantizedPosition[j] = uint16_t( MAX( 0.0, MIN( 65535.0, floor( coordinate[j] + 0.5 ) ) ) );
+		}
+	}
+
+	if( attributeFlags & ATTRIBUTE_NORMAL )
+	{
+		normalArray->resize( 2 * vertexCount );
+		for( int i = 0; i < vertexCount; i++ )
+			EncodeOctahedral( ( *triangleMesh.vertexArray )[i].normal, ( *normalArray )[ 2 * i ], ( *normalArray )[ 2 * i + 1 ] );
+	}
+
+	if( attributeFlags & ATTRIBUTE_COLOR )
+	{
+		colorArray->resize( 4 * vertexCount );
+		for( int i = 0; i < vertexCount; i++ )
+		{
+			const Vertex& vertex = ( *triangleMesh.vertexArray )[i];
+			double channel[4] = { vertex.color.x, vertex.color.y, vertex.color.z, vertex.alpha };
+
+			uint8_t* color = &( *colorArray )[ 4 * i ];
+			for( int j = 0; j < 4; j++ )
+				color[j] = uint8_t( floor( MAX( 0.0, MIN( 1.0, channel[j] ) ) * 255.0 + 0.5 ) );
+		}
+	}
+
+	if( attributeFlags & ATTRIBUTE_TEXCOORDS )
+	{
+		texCoordsArray->resize( 2 * vertexCount );
+		for( int i = 0; i < vertexCount; i++ )
+		{
+			const Vector& texCoords = ( *triangleMesh.vertexArray )[i].texCoords;
+			( *texCoordsArray )[ 2 * i ] = float( texCoords.x );
+			( *texCoordsArray )[ 2 * i + 1 ] = float( texCoords.y );
+		}
+	}
+
+	if( vertexCount <= 0x10000 )
+		indexSize = 2;
+	else if( vertexCount <= 0x1000000 )
+		indexSize = 3;
+	else
+		indexSize = 4;
+
+	// Indices are stored little-endian, whatever the machine.
+	indexArray->resize( 3 * indexSize * triangleMesh.triangleArray->size() );
+	uint8_t* indexBytes = indexArray->data();
+	for( int i = 0; i < ( signed )triangleMesh.triangleArray->size(); i++ )
+	{
+		for( int j = 0; j < 3; j++ )
+		{
+			uint32_t index = uint32_t( ( *triangleMesh.triangleArray )[i].vertex[j] );
+			for( int k = 0; k < indexSize; k++ )
+				*indexBytes++ = uint8_t( index >> ( 8 * k ) );
+		}
+	}
+}
+
+void CompactMesh::GetTriangleMesh( TriangleMesh& triangleMesh ) const
+{
+	triangleMesh.Clear();
+
+	triangleMesh.vertexArray->resize( vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+		GetVertex( i, ( *triangleMesh.vertexArray )[i] );
+
+	int triangleCount = GetTriangleCount();
+	triangleMesh.triangleArray->resize( triangleCount );
+	for( int i = 0; i < triangleCount; i++ )
+		GetTriangle( i, ( *triangleMesh.triangleArray )[i].vertex );
+}
+
+int CompactMesh::GetVertexCount( void ) const
+{
+	return vertexCount;
+}
+
+int CompactMesh::GetTriangleCount( void ) const
+{
+	return ( int )( indexArray->size() / ( 3 * indexSize ) );
+}
+
+CompactMesh::PositionFormat CompactMesh::GetPositionFormat( void ) const
+{
+	return positionFormat;
+}
+
+int CompactMesh::GetAttributeFlags( void ) const
+{
+	return attributeFlags;
+}
+
+const AxisAlignedBox& CompactMesh::GetBoundingBox( void ) const
+{
+	return boundingBox;
+}
+
+void CompactMesh::GetPosition( int index, Vector& position ) const
+{
+	if( positionFormat == POSITION_FORMAT_FLOAT )
+	{
+		const float* floatPosition = &( *floatPositionArray )[ 3 * index ];
+		position.Set( floatPosition[0], floatPosition[1], floatPosition[2] );
+	}
+	else
+	{
+		const uint16_t* quantizedPosition = &( *quantizedPositionArray )[ 3 * index ];
+
+		Vector extent;
+		extent.Subtract( boundingBox.posCorner, boundingBox.negCorner );
+
+		position.x = boundingBox.negCorner.x + extent.x * double( quantizedPosition[0] ) / 65535.0;
+		position.y = boundingBox.negCorner.y + extent.y * double( quantizedPosition[1] ) / 65535.0;
+		position.z = boundingBox.negCorner.z + extent.z * double( quantizedPosition[2] ) / 65535.0;
+	}
+}
+
+void CompactMesh::GetVertex( int index, Vertex& vertex ) const
+{
+	vertex = Vertex();
+
+	GetPosition( index, vertex.position );
+
+	if( attributeFlags & ATTRIBUTE_NORMAL )
+		DecodeOctahedral( ( *normalArray )[ 2 * index ], ( *normalArray )[ 2 * index + 1 ], vertex.normal );
+
+	if( attributeFlags & ATTRIBUTE_COLOR )
+	{
+		const uint8_t* color = &( *colorArray )[ 4 * index ];
+		vertex.color.Set( double( color[0] ) / 255.0, double( color[1] ) / 255.0, double( color[2] ) / 255.0 );
+		vertex.alpha = double( color[3] ) / 255.0;
+	}
+
+	if( attributeFlags & ATTRIBUTE_TEXCOORDS )
+		vertex.texCoords.Set( ( *texCoordsArray )[ 2 * index ], ( *texCoordsArray )[ 2 * index + 1 ], 0.0 );
+}
+
+void CompactMesh::GetTriangle( int index, int* vertex ) const
+{
+	const uint8_t* indexBytes = &( *indexArray )[ 3 * indexSize * index ];
+	for( int i = 0; i < 3; i++ )
+	{
+		uint32_t vertexIndex = 0;
+		for( int j = 0; j < indexSize; j++ )
+			vertexIndex |= uint32_t( *indexBytes++ ) << ( 8 * j );
+
+		vertex[i] = int( vertexIndex );
+	}
+}
+
+size_t CompactMesh::GetMemoryFootprint( void ) const
+{
+	return	floatPositionArray->size() * sizeof( float ) +
+			quantizedPositionArray->size() * sizeof( uint16_t ) +
+			normalArray->size() * sizeof( int16_t ) +
+			colorArray->size() * sizeof( uint8_t ) +
+			texCoordsArray->size() * sizeof( float ) +
+			indexArray->size();
+}
+
+// The octahedral encoding projects the unit sphere onto the octahedron |x|+|y|+|z|=1, then unfolds the
+// lower half of the octahedron over the corners of the square that the upper half projects onto.
+/*static*/ void CompactMesh::EncodeOctahedral( const Vector& normal, int16_t& x, int16_t& y )
+{
+	double length = fabs( normal.x ) + fabs( normal.y ) + fabs( normal.z );
+	if( length == 0.0 )
+	{
+		x = y = 0;
+		return;
+	}
+
+	double u = normal.x / length;
+	double v = normal.y / length;
+
+	if( normal.z < 0.0 )
+	{
+		double foldedU = ( 1.0 - fabs( v ) ) * ( u >= 0.0 ? 1.0 : -1.0 );
+		double foldedV = ( 1.0 - fabs( u ) ) * ( v >= 0.0 ? 1.0 : -1.0 );
+		u = foldedU;
+		v = foldedV;
+	}
+
+	x = int16_t( floor( MAX( -1.0, MIN( 1.0, u ) ) * 32767.0 + 0.5 ) );
+	y = int16_t( floor( MAX( -1.0, MIN( 1.0, v ) ) * 32767.0 + 0.5 ) );
+}
+
+/*static*/ void CompactMesh::DecodeOctahedral( int16_t x, int16_t y, Vector& normal )
+{
+	double u = MAX( -1.0, double( x ) / 32767.0 );
+	double v = MAX( -1.0, double( y ) / 32767.0 );
+
+	normal.Set( u, v, 1.0 - fabs( u ) - fabs( v ) );
+
+	if( normal.z < 0.0 )
+	{
+		normal.x = ( 1.0 - fabs( v ) ) * ( u >= 0.0 ? 1.0 : -1.0 );
+		normal.y = ( 1.0 - fabs( u ) ) * ( v >= 0.0 ? 1.0 : -1.0 );
+	}
+
+	normal.Normalize();
+}
+
+// CompactMesh.cpp
@@ -0,0 +1,84 @@
+// CompactMesh.h
+
+#pragma once
+
+#include "Defines.h"
+#include "Vector.h"
+#include "AxisAlignedBox.h"
+
+namespace _3DMath
+{
+	class CompactMesh;
+	class TriangleMesh;
+	class Vertex;
+}
+
+// This holds the same data as a triangle mesh in a fraction of the memory.  A full vertex takes over a
+// hundred bytes, being a handful of double-precision vectors, while here each attribute lives in its own
+// tightly packed stream, stored only if asked for.  Positions are single-precision floats, or 16-bit
+// integers spanning the mesh's bounding box; normals are octahedral-encoded into two 16-bit integers;
+// colors, alpha included, are 8 bits per channel; and texture coordinates are single-precision floats.
+// With quantized positions, normals and colors, a vertex takes 14 bytes.  Triangle indices are stored
+// in as few bytes as the vertex count allows, from two up to four.  Attributes that were not stored come
+// back with the default vertex values.
+class _3DMATH_API _3DMath::CompactMesh
+{
+public:
+
+	CompactMesh( void );
+	virtual ~CompactMesh( void );
+
+	enum PositionFormat
+	{
+		POSITION_FORMAT_FLOAT,
+		POSITION_FORMAT_QUANTIZED_16,
+	};
+
+	enum AttributeFlags
+	{
+		ATTRIBUTE_NORMAL			= 0x00000001,
+		ATTRIBUTE_COLOR				= 0x00000002,
+		ATTRIBUTE_TEXCOORDS			= 0x00000004,
+	};
+
+	void Clear( void );
+
+	// Quantized positions are within 1/131070th of the bounding box's extent along each axis of the original.
+	// Encoded normals are within about a hundredth of a degree of the originals, but a zero normal comes back
+	// as the +Z axis.
+	void SetFromTriangleMesh( const TriangleMesh& triangleMesh, PositionFormat positionFormat = POSITION_FORMAT_QUANTIZED_16, int attributeFlags = ATTRIBUTE_NORMAL | ATTRIBUTE_COLOR );
+	void GetTriangleMesh( TriangleMesh& triangleMesh ) const;
+
+	int GetVertexCount( void ) const;
+	int GetTriangleCount( void ) const;
+	PositionFormat GetPositionFormat( void ) const;
+	int GetAttributeFlags( void ) const;
+	const AxisAlignedBox& GetBoundingBox( void ) const;
+
+	void GetPosition( int index, Vector& position ) const;
+	void GetVertex( int index, Vertex& vertex ) const;
+	void GetTriangle( int index, int* vertex ) const;
+
+	// This is the number of bytes taken up by the vertex and index streams.
+	size_t GetMemoryFootprint( void ) const;
+
+	static void EncodeOctahedral( const Vector& normal, int16_t& x, int16_t& y );
+	static void DecodeOctahedral( int16_t x, int16_t y, Vector& normal );
+
+private:
+
+	PositionFormat positionFormat;
+	int attributeFlags;
+	int vertexCount;
+	AxisAlignedBox boundingBox;
+
+	std::vector< float >* floatPositionArray;
+	std::vector< uint16_t >* quantizedPositionArray;
+	std::vector< int16_t >* normalArray;
+	std::vector< uint8_t >* colorArray;
+	std::vector< float >* texCoordsArray;
+	int indexSize;
+	std::vector< uint8_t >* indexArray;
+};
+
+// CompactMesh.h
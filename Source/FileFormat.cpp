@@ -274,7 +274,7 @@ void PlyFormat::AddTriangles( TriangleMesh& triangleMesh, const LineArray::itera
 		int vertex1 = atoi( ( *bodyArray )[ 1 + i + 1 ].c_str() );
 		int vertex2 = atoi( ( *bodyArray )[ 1 + i + 2 ].c_str() );
 
-        triangleMesh.triangleList->push_back( IndexTriangle( vertex0, vertex1, vertex2 ) );
+        triangleMesh.triangleArray->push_back( IndexTriangle( vertex0, vertex1, vertex2 ) );
     }
 }
 
@@ -295,7 +295,7 @@ void PlyFormat::AddTriangles( TriangleMesh& triangleMesh, const LineArray::itera
 	stream << "property double b" << std::endl;
 	stream << "property double u" << std::endl;
 	stream << "property double v" << std::endl;
-	stream << "element face " << triangleMesh.triangleList->size() << std::endl;
+	stream << "element face " << triangleMesh.triangleArray->size() << std::endl;
 	stream << "property list uchar int vertex_indices" << std::endl;
 	stream << "end_header" << std::endl;
 
@@ -309,7 +309,7 @@ void PlyFormat::AddTriangles( TriangleMesh& triangleMesh, const LineArray::itera
 		stream << vertex.texCoords.x << " " << vertex.texCoords.y << std::endl;
 	}
 
-	for( IndexTriangleList::const_iterator iter = triangleMesh.triangleList->cbegin(); iter != triangleMesh.triangleList->cend(); iter++ )
+	for( IndexTriangleArray::const_iterator iter = triangleMesh.triangleArray->cbegin(); iter != triangleMesh.triangleArray->cend(); iter++ )
 	{
 		const IndexTriangle& triangle = *iter;
 
@@ -389,7 +389,7 @@ ObjFormat::ObjFormat( void )
 				// Choose an arbitrary tesselation of the face.
 				int vertexCount = ( signed )faceLine->size() - 1;
 				for( int i = 0; i < vertexCount - 2; i++ )
-					triangleMesh.triangleList->push_back( IndexTriangle( j, j + i + 1, j + i + 2 ) );
+					triangleMesh.triangleArray->push_back( IndexTriangle( j, j + i + 1, j + i + 2 ) );
 			}
 		}
 	}
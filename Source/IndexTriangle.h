@@ -42,6 +42,9 @@ public:
 namespace _3DMath
 {
 	typedef std::list< IndexTriangle > IndexTriangleList;
+
+	// Being just three integers, these pack tightly into a flat index buffer.
+	typedef std::vector< IndexTriangle > IndexTriangleArray;
 }
 
 // IndexTriangle.h
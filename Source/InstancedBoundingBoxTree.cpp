@@ -0,0 +1,469 @@
+// InstancedBoundingBoxTree.cpp
+
+#include "InstancedBoundingBoxTree.h"
+#include "LineSegment.h"
+
+using namespace _3DMath;
+
+InstancedBoundingBoxTree::InstancedBoundingBoxTree( void )
+{
+	instanceArray = new std::vector< Instance >();
+	instanceOrderArray = new std::vector< int >();
+	flatNodeArray = new BoundingBoxTree::FlatNodeArray();
+	flatTreeDepth = 0;
+}
+
+/*virtual*/ InstancedBoundingBoxTree::~InstancedBoundingBoxTree( void )
+{
+	delete instanceArray;
+	delete instanceOrderArray;
+	delete flatNodeArray;
+}
+
+void InstancedBoundingBoxTree::Clear( void )
+{
+	instanceArray->clear();
+	instanceOrderArray->clear();
+	flatNodeArray->clear();
+	flatTreeDepth = 0;
+}
+
+int InstancedBoundingBoxTree::AddInstance( const BoundingBoxTree* boxTree, const AffineTransform& transform )
+{
+	if( !boxTree || !boxTree->IsCompiled() )
+		return -1;
+
+	Instance instance;
+	instance.boxTree = boxTree;
+	if( !SetInstance( instance, transform ) )
+		return -1;
+
+	instanceArray->push_back( instance );
+	return ( int )instanceArray->size() - 1;
+}
+
+bool InstancedBoundingBoxTree::SetInstanceTransform( int instance, const AffineTransform& transform )
+{
+	if( instance < 0 || instance >= ( signed )instanceArray->size() )
+		return false;
+
+	return SetInstance( ( *instanceArray )[ instance ], transform );
+}
+
+int InstancedBoundingBoxTree::GetInstanceCount( void ) const
+{
+	return ( int )instanceArray->size();
+}
+
+const BoundingBoxTree* InstancedBoundingBoxTree::GetInstanceTree( int instance ) const
+{
+	if( instance < 0 || instance >= ( signed )instanceArray->size() )
+		return nullptr;
+
+	return ( *instanceArray )[ instance ].boxTree;
+}
+
+const AffineTransform* InstancedBoundingBoxTree::GetInstanceTransform( int instance ) const
+{
+	if( instance < 0 || instance >= ( signed )instanceArray->size() )
+		return nullptr;
+
+	return &( *instanceArray )[ instance ].transform;
+}
+
+bool InstancedBoundingBoxTree::SetInstance( Instance& instance, const AffineTransform& transform )
+{
+	AffineTransform inverseTransform;
+	if( !transform.GetInverse( inverseTransform ) )
+		return false;
+
+	// The least scale of a transform is the reciprocal of the greatest scale of its inverse.
+	double maxInverseScale = GetMaxScale( inverseTransform.linearTransform );
+	if( maxInverseScale <= 0.0 )
+		return false;
+
+	instance.transform = transform;
+	instance.inverseTransform = inverseTransform;
+	instance.minScale = ( 1.0 - EPSILON ) / maxInverseScale;
+
+	UpdateInstanceBox( instance );
+	return true;
+}
+
+// The instance's box in world space is the box about its tree's box after the transform,
+// which reaches out from its center along each axis as far as any of its corners do.
+/*static*/ void InstancedBoundingBoxTree::UpdateInstanceBox( Instance& instance )
+{
+	const AffineTransform& transform = instance.transform;
+	const FlatNode& rootNode = instance.boxTree->GetFlatNodes()[0];
+	Vector center, extent;
+	center.Set( 0.5 * ( double( rootNode.min[0] ) + double( rootNode.max[0] ) ), 0.5 * ( double( rootNode.min[1] ) + double( rootNode.max[1] ) ), 0.5 * ( double( rootNode.min[2] ) + double( rootNode.max[2] ) ) );
+	extent.Set( 0.5 * ( double( rootNode.max[0] ) - double( rootNode.min[0] ) ), 0.5 * ( double( rootNode.max[1] ) - double( rootNode.min[1] ) ), 0.5 * ( double( rootNode.max[2] ) - double( rootNode.min[2] ) ) );
+	transform.Transform( center );
+
+	const LinearTransform& linearTransform = transform.linearTransform;
+	double worldCenter[3] = { center.x, center.y, center.z };
+	double worldExtent[3] =
+	{
+		fabs( linearTransform.xAxis.x ) * extent.x + fabs( linearTransform.yAxis.x ) * extent.y + fabs( linearTransform.zAxis.x ) * extent.z,
+		fabs( linearTransform.xAxis.y ) * extent.x + fabs( linearTransform.yAxis.y ) * extent.y + fabs( linearTransform.zAxis.y ) * extent.z,
+		fabs( linearTransform.xAxis.z ) * extent.x + fabs( linearTransform.yAxis.z ) * extent.y + fabs( linearTransform.zAxis.z ) * extent.z,
+	};
+
+	double min[3], max[3];
+	for( int i = 0; i < 3; i++ )
+	{
+		double slack = EPSILON * ( fabs( worldCenter[i] ) + worldExtent[i] );
+		min[i] = worldCenter[i] - worldExtent[i] - slack;
+		max[i] = worldCenter[i] + worldExtent[i] + slack;
+	}
+
+	BoundingBoxTree::SetFlatNodeBox( instance.box, min, max );
+}
+
+// An instance's tree may have been refit since its box was last found, so both Build and Refit find the boxes again.
+bool InstancedBoundingBoxTree::UpdateInstanceBoxes( void )
+{
+	for( int i = 0; i < ( signed )instanceArray->size(); i++ )
+	{
+		Instance& instance = ( *instanceArray )[i];
+		if( !instance.boxTree->IsCompiled() )
+			return false;
+
+		UpdateInstanceBox( instance );
+	}
+
+	return true;
+}
+
+// The scales of a linear transform are the square roots of the eigenvalues of its transpose times itself, whose entries
+// are just the dot products of its axes.  We find the greatest eigenvalue of this symmetric matrix in closed form.
+/*static*/ double InstancedBoundingBoxTree::GetMaxScale( const LinearTransform& linearTransform )
+{
+	const Vector* axis[3] = { &linearTransform.xAxis, &linearTransform.yAxis, &linearTransform.zAxis };
+
+	double matrix[3][3];
+	for( int i = 0; i < 3; i++ )
+		for( int j = 0; j < 3; j++ )
+			matrix[i][j] = axis[i]->Dot( *axis[j] );
+
+	double mean = ( matrix[0][0] + matrix[1][1] + matrix[2][2] ) / 3.0;
+	double offDiagonal = matrix[0][1] * matrix[0][1] + matrix[0][2] * matrix[0][2] + matrix[1][2] * matrix[1][2];
+	double spread = sqrt( ( ( matrix[0][0] - mean ) * ( matrix[0][0] - mean ) + ( matrix[1][1] - mean ) * ( matrix[1][1] - mean ) + ( matrix[2][2] - mean ) * ( matrix[2][2] - mean ) + 2.0 * offDiagonal ) / 6.0 );
+
+	double eigenvalue = mean;
+	if( spread > 0.0 )
+	{
+		for( int i = 0; i < 3; i++ )
+		{
+			for( int j = 0; j < 3; j++ )
+				matrix[i][j] /= spread;
+			matrix[i][i] -= mean / spread;
+		}
+
+		double determinant =
+			matrix[0][0] * ( matrix[1][1] * matrix[2][2] - matrix[1][2] * matrix[2][1] ) -
+			matrix[0][1] * ( matrix[1][0] * matrix[2][2] - matrix[1][2] * matrix[2][0] ) +
+			matrix[0][2] * ( matrix[1][0] * matrix[2][1] - matrix[1][1] * matrix[2][0] );
+
+		double angle = acos( MIN( MAX( 0.5 * determinant, -1.0 ), 1.0 ) ) / 3.0;
+		eigenvalue = mean + 2.0 * spread * cos( angle );
+	}
+
+	return sqrt( MAX( eigenvalue, 0.0 ) );
+}
+
+bool InstancedBoundingBoxTree::Build( int maxLeafSize /*= 2*/ )
+{
+	flatNodeArray->clear();
+	instanceOrderArray->clear();
+	flatTreeDepth = 0;
+
+	int count = ( int )instanceArray->size();
+	if( count == 0 || !UpdateInstanceBoxes() )
+		return false;
+
+	BoundingBoxTree::BuildPrimitiveArray primitiveArray( count );
+	for( int i = 0; i < count; i++ )
+	{
+		const FlatNode& box = ( *instanceArray )[i].box;
+		BoundingBoxTree::BuildPrimitive& primitive = primitiveArray[i];
+
+		for( int j = 0; j < 3; j++ )
+		{
+			primitive.box.min[j] = box.min[j];
+			primitive.box.max[j] = box.max[j];
+			primitive.center[j] = 0.5 * ( primitive.box.min[j] + primitive.box.max[j] );
+		}
+
+		primitive.triangle = i;
+	}
+
+	BoundingBoxTree::BuildContext context;
+	context.primitiveArray = &primitiveArray;
+	context.maxLeafSize = MIN( MAX( maxLeafSize, 1 ), 0xFFFF );
+	context.nearRootSize = count + 1;
+	context.threadPool = nullptr;
+
+	BoundingBoxTree::BuildNode( context, 0, count, 1, *flatNodeArray, flatTreeDepth );
+
+	instanceOrderArray->resize( count );
+	for( int i = 0; i < count; i++ )
+		( *instanceOrderArray )[i] = primitiveArray[i].triangle;
+
+	return true;
+}
+
+bool InstancedBoundingBoxTree::Refit( void )
+{
+	if( flatNodeArray->size() == 0 || !UpdateInstanceBoxes() )
+		return false;
+
+	FlatNode* nodes = flatNodeArray->data();
+
+	// Both children of a branch come after it, so going from back to front, they're always refit before it is.
+	for( int i = ( signed )flatNodeArray->size() - 1; i >= 0; i-- )
+	{
+		FlatNode& node = nodes[i];
+
+		if( node.IsLeaf() )
+		{
+			for( int j = node.offset; j < node.offset + node.count; j++ )
+			{
+				const FlatNode& box = ( *instanceArray )[ ( *instanceOrderArray )[j] ].box;
+				for( int k = 0; k < 3; k++ )
+				{
+					node.min[k] = ( j == node.offset ) ? box.min[k] : MIN( node.min[k], box.min[k] );
+					node.max[k] = ( j == node.offset ) ? box.max[k] : MAX( node.max[k], box.max[k] );
+				}
+			}
+		}
+		else
+		{
+			const FlatNode& firstChild = nodes[ i + 1 ];
+			const FlatNode& secondChild = nodes[ node.offset ];
+			for( int k = 0; k < 3; k++ )
+			{
+				node.min[k] = MIN( firstChild.min[k], secondChild.min[k] );
+				node.max[k] = MAX( firstChild.max[k], secondChild.max[k] );
+			}
+		}
+	}
+
+	return true;
+}
+
+bool InstancedBoundingBoxTree::FindIntersection( const LineSegment& lineSegment, int& instance, const Triangle*& intersectedTriangle, Vector& intersectionPoint ) const
+{
+	BoundingBoxTree::SegmentHit hit;
+	TraceSegment( lineSegment, instance, hit, false );
+
+	if( hit.triangle < 0 )
+	{
+		intersectedTriangle = nullptr;
+		return false;
+	}
+
+	const Instance& hitInstance = ( *instanceArray )[ instance ];
+	intersectedTriangle = hitInstance.boxTree->GetFlatTriangle( hit.triangle );
+	hitInstance.transform.Transform( hit.point, intersectionPoint );
+	return true;
+}
+
+bool InstancedBoundingBoxTree::IntersectsWithLineSegment( const LineSegment& lineSegment ) const
+{
+	int instance;
+	BoundingBoxTree::SegmentHit hit;
+	TraceSegment( lineSegment, instance, hit, true );
+
+	return( hit.triangle >= 0 ? true : false );
+}
+
+// This is BoundingBoxTree::TraceSegment over the instances, handing the segment to each instance's tree in turn.  An affine
+// transform maps the segment onto its preimage point for point, so a hit is as far along the one as the other, and the
+// nearest hit so far can cut the segment short in every instance's space alike.
+void InstancedBoundingBoxTree::TraceSegment( const LineSegment& lineSegment, int& instance, BoundingBoxTree::SegmentHit& hit, bool anyIntersection ) const
+{
+	instance = -1;
+	hit.triangle = -1;
+	hit.lambda = 1.0;
+
+	if( flatNodeArray->size() == 0 )
+		return;
+
+	BoundingBoxTree::FlatSegment segment;
+	segment.Set( lineSegment );
+
+	const FlatNode* nodes = flatNodeArray->data();
+
+	double entryLambda;
+	if( !segment.HitsBox( nodes[0], hit.lambda, entryLambda ) )
+		return;
+
+	BoundingBoxTree::TraversalStack< BoundingBoxTree::TraversalEntry > stack( flatTreeDepth );
+	int index = 0;
+
+	while( index >= 0 )
+	{
+		const FlatNode& node = nodes[ index ];
+
+		if( node.IsLeaf() )
+		{
+			for( int i = node.offset; i < node.offset + node.count; i++ )
+			{
+				int candidateIndex = ( *instanceOrderArray )[i];
+				const Instance& candidate = ( *instanceArray )[ candidateIndex ];
+				if( !segment.HitsBox( candidate.box, hit.lambda, entryLambda ) )
+					continue;
+
+				LineSegment localLineSegment;
+				candidate.inverseTransform.Transform( lineSegment.vertex[0], localLineSegment.vertex[0] );
+				candidate.inverseTransform.Transform( lineSegment.vertex[1], localLineSegment.vertex[1] );
+
+				BoundingBoxTree::FlatSegment localSegment;
+				localSegment.Set( localLineSegment );
+
+				BoundingBoxTree::SegmentHit localHit;
+				localHit.triangle = -1;
+				localHit.lambda = hit.lambda;
+
+				candidate.boxTree->TraceSegment( localSegment, 0, localHit, anyIntersection );
+				if( localHit.triangle >= 0 )
+				{
+					hit = localHit;
+					instance = candidateIndex;
+					if( anyIntersection )
+						return;
+				}
+			}
+		}
+		else
+		{
+			int nearChild = index + 1;
+			int farChild = node.offset;
+			if( segment.direction[ node.axis ] < 0.0 )
+			{
+				nearChild = node.offset;
+				farChild = index + 1;
+			}
+
+			double nearLambda, farLambda;
+			bool hitsNearChild = segment.HitsBox( nodes[ nearChild ], hit.lambda, nearLambda );
+			bool hitsFarChild = segment.HitsBox( nodes[ farChild ], hit.lambda, farLambda );
+
+			if( hitsNearChild )
+			{
+				if( hitsFarChild )
+				{
+					BoundingBoxTree::TraversalEntry entry;
+					entry.node = farChild;
+					entry.lambda = farLambda;
+					stack.Push( entry );
+				}
+
+				index = nearChild;
+				continue;
+			}
+
+			if( hitsFarChild )
+			{
+				index = farChild;
+				continue;
+			}
+		}
+
+		index = -1;
+		while( !stack.IsEmpty() )
+		{
+			BoundingBoxTree::TraversalEntry entry = stack.Pop();
+			if( entry.lambda <= hit.lambda )
+			{
+				index = entry.node;
+				break;
+			}
+		}
+	}
+}
+
+bool InstancedBoundingBoxTree::FindNearestTriangle( const Vector& point, int& instance, const Triangle*& nearestTriangle, Vector& nearestPoint, double maxDistance ) const
+{
+	instance = -1;
+	nearestTriangle = nullptr;
+
+	if( flatNodeArray->size() == 0 || maxDistance < 0.0 )
+		return false;
+
+	double position[3] = { point.x, point.y, point.z };
+	double squareDistance = maxDistance * maxDistance;
+
+	const FlatNode* nodes = flatNodeArray->data();
+
+	if( BoundingBoxTree::SquareDistanceToBox( nodes[0], position ) > squareDistance )
+		return false;
+
+	BoundingBoxTree::TraversalStack< BoundingBoxTree::TraversalEntry > stack( flatTreeDepth );
+	int index = 0;
+
+	while( index >= 0 )
+	{
+		const FlatNode& node = nodes[ index ];
+
+		if( node.IsLeaf() )
+		{
+			for( int i = node.offset; i < node.offset + node.count; i++ )
+			{
+				int candidateIndex = ( *instanceOrderArray )[i];
+				const Instance& candidate = ( *instanceArray )[ candidateIndex ];
+				if( BoundingBoxTree::SquareDistanceToBox( candidate.box, position ) > squareDistance )
+					continue;
+
+				Vector localPoint;
+				candidate.inverseTransform.Transform( point, localPoint );
+
+				if( candidate.boxTree->FindNearestTransformed( point, localPoint, candidate.transform, candidate.minScale, nearestTriangle, nearestPoint, squareDistance ) )
+					instance = candidateIndex;
+			}
+		}
+		else
+		{
+			int nearChild = index + 1;
+			int farChild = node.offset;
+			double nearDistance = BoundingBoxTree::SquareDistanceToBox( nodes[ nearChild ], position );
+			double farDistance = BoundingBoxTree::SquareDistanceToBox( nodes[ farChild ], position );
+			if( farDistance < nearDistance )
+			{
+				std::swap( nearChild, farChild );
+				std::swap( nearDistance, farDistance );
+			}
+
+			if( nearDistance <= squareDistance )
+			{
+				if( farDistance <= squareDistance )
+				{
+					BoundingBoxTree::TraversalEntry entry;
+					entry.node = farChild;
+					entry.lambda = farDistance;
+					stack.Push( entry );
+				}
+
+				index = nearChild;
+				continue;
+			}
+		}
+
+		index = -1;
+		while( !stack.IsEmpty() )
+		{
+			BoundingBoxTree::TraversalEntry entry = stack.Pop();
+			if( entry.lambda <= squareDistance )
+			{
+				index = entry.node;
+				break;
+			}
+		}
+	}
+
+	return( instance >= 0 ? true : false );
+}
+
+// InstancedBoundingBoxTree.cpp
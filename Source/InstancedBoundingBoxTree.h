@@ -0,0 +1,72 @@
+// InstancedBoundingBoxTree.h
+
+#pragma once
+
+#include "Defines.h"
+#include "AffineTransform.h"
+#include "BoundingBoxTree.h"
+
+namespace _3DMath
+{
+	class InstancedBoundingBoxTree;
+	class LineSegment;
+}
+
+// This is a tree over instances of other trees, each placed by its own transform, so that a mesh used many times over needs
+// only the one tree, however many places it appears.  Queries descend this tree in world space, and each instance's tree in
+// its own space, mapping the segment or point into that space on the way down.  The instances' trees must be compiled, and
+// must outlive this tree.  Moving an instance calls only for a refit, but adding one calls for a rebuild.
+class _3DMATH_API _3DMath::InstancedBoundingBoxTree
+{
+public:
+
+	InstancedBoundingBoxTree( void );
+	virtual ~InstancedBoundingBoxTree( void );
+
+	void Clear( void );
+
+	// These fail, returning -1 or false, if the given tree isn't compiled or the given transform can't be inverted.
+	int AddInstance( const BoundingBoxTree* boxTree, const AffineTransform& transform );
+	bool SetInstanceTransform( int instance, const AffineTransform& transform );
+
+	int GetInstanceCount( void ) const;
+	const BoundingBoxTree* GetInstanceTree( int instance ) const;
+	const AffineTransform* GetInstanceTransform( int instance ) const;
+
+	// Build makes the tree over the instances from scratch, while Refit just recomputes its boxes to follow the instances as they
+	// move, or as their trees are refit, which is enough until they've moved a long way.  These fail if an instance's tree is empty.
+	bool Build( int maxLeafSize = 2 );
+	bool Refit( void );
+
+	// These are as for BoundingBoxTree, but the triangle found is given in the space of the instance
+	// it belongs to, while the point found is given in world space.
+	bool FindIntersection( const LineSegment& lineSegment, int& instance, const Triangle*& intersectedTriangle, Vector& intersectionPoint ) const;
+	bool IntersectsWithLineSegment( const LineSegment& lineSegment ) const;
+	bool FindNearestTriangle( const Vector& point, int& instance, const Triangle*& nearestTriangle, Vector& nearestPoint, double maxDistance ) const;
+
+private:
+
+	typedef BoundingBoxTree::FlatNode FlatNode;
+
+	struct Instance
+	{
+		const BoundingBoxTree* boxTree;
+		AffineTransform transform;
+		AffineTransform inverseTransform;
+		double minScale;		// This is the least factor by which the transform scales any distance.
+		FlatNode box;			// This bounds the instance in world space.
+	};
+
+	bool SetInstance( Instance& instance, const AffineTransform& transform );
+	static void UpdateInstanceBox( Instance& instance );
+	bool UpdateInstanceBoxes( void );
+	void TraceSegment( const LineSegment& lineSegment, int& instance, BoundingBoxTree::SegmentHit& hit, bool anyIntersection ) const;
+	static double GetMaxScale( const LinearTransform& linearTransform );
+
+	std::vector< Instance >* instanceArray;
+	std::vector< int >* instanceOrderArray;		// A leaf owns a contiguous range of this.
+	BoundingBoxTree::FlatNodeArray* flatNodeArray;
+	int flatTreeDepth;
+};
+
+// InstancedBoundingBoxTree.h
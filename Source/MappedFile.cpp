@@ -0,0 +1,127 @@
+// MappedFile.cpp
+
+#include "MappedFile.h"
+
+#if defined _WIN32
+#	include <windows.h>
+#else
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+using namespace _3DMath;
+
+MappedFile::MappedFile( void )
+{
+	data = nullptr;
+	size = 0;
+
+#if defined _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = nullptr;
+#endif
+}
+
+/*virtual*/ MappedFile::~MappedFile( void )
+{
+	Close();
+}
+
+// An empty file can't be mapped, so it can't be opened either.
+bool MappedFile::Open( const std::string& file )
+{
+	Close();
+
+#if defined _WIN32
+
+	fileHandle = CreateFileA( file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+	if( fileHandle == INVALID_HANDLE_VALUE )
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if( GetFileSizeEx( fileHandle, &fileSize ) && fileSize.QuadPart > 0 && uint64_t( fileSize.QuadPart ) <= SIZE_MAX )
+	{
+		mappingHandle = CreateFileMappingA( fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr );
+		if( mappingHandle )
+		{
+			data = ( const unsigned char* )MapViewOfFile( mappingHandle, FILE_MAP_READ, 0, 0, 0 );
+			size = ( size_t )fileSize.QuadPart;
+		}
+	}
+
+#else
+
+	int fileDescriptor = open( file.c_str(), O_RDONLY );
+	if( fileDescriptor < 0 )
+		return false;
+
+	struct stat fileStatus;
+	if( fstat( fileDescriptor, &fileStatus ) == 0 && fileStatus.st_size > 0 && uint64_t( fileStatus.st_size ) <= SIZE_MAX )
+	{
+		void* mapping = mmap( nullptr, ( size_t )fileStatus.st_size, PROT_READ, MAP_SHARED, fileDescriptor, 0 );
+		if( mapping != MAP_FAILED )
+		{
+			data = ( const unsigned char* )mapping;
+			size = ( size_t )fileStatus.st_size;
+		}
+	}
+
+	// The mapping holds on to the file by itself.
+	close( fileDescriptor );
+
+#endif
+
+	if( !data )
+	{
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+void MappedFile::Close( void )
+{
+#if defined _WIN32
+
+	if( data )
+		UnmapViewOfFile( data );
+
+	if( mappingHandle )
+		CloseHandle( mappingHandle );
+
+	if( fileHandle != INVALID_HANDLE_VALUE )
+		CloseHandle( fileHandle );
+
+	mappingHandle = nullptr;
+	fileHandle = INVALID_HANDLE_VALUE;
+
+#else
+
+	if( data )
+		munmap( ( void* )data, size );
+
+#endif
+
+	data = nullptr;
+	size = 0;
+}
+
+bool MappedFile::IsOpen( void ) const
+{
+	return( data ? true : false );
+}
+
+const unsigned char* MappedFile::GetData( void ) const
+{
+	return data;
+}
+
+size_t MappedFile::GetSize( void ) const
+{
+	return size;
+}
+
+// MappedFile.cpp
@@ -0,0 +1,40 @@
+// MappedFile.h
+
+#pragma once
+
+#include "Defines.h"
+
+namespace _3DMath
+{
+	class MappedFile;
+}
+
+// This maps a whole file into memory, read-only, so that its contents can be used right where they lie, with the operating
+// system paging them in only as they're touched, and sharing them among all processes that map the same file.  The data stays
+// valid until the file is closed, so long as nothing else truncates or rewrites the file in the meantime.
+class _3DMATH_API _3DMath::MappedFile
+{
+public:
+
+	MappedFile( void );
+	virtual ~MappedFile( void );
+
+	bool Open( const std::string& file );
+	void Close( void );
+	bool IsOpen( void ) const;
+
+	const unsigned char* GetData( void ) const;
+	size_t GetSize( void ) const;
+
+private:
+
+	const unsigned char* data;
+	size_t size;
+
+#if defined _WIN32
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+};
+
+// MappedFile.h
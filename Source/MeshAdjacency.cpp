@@ -0,0 +1,185 @@
+// MeshAdjacency.cpp
+
+#include "MeshAdjacency.h"
+#include "TriangleMesh.h"
+
+using namespace _3DMath;
+
+MeshAdjacency::MeshAdjacency( void )
+{
+	originArray = new std::vector< int >();
+	twinArray = new std::vector< int >();
+	vertexOffsetArray = new std::vector< int >();
+	outgoingHalfEdgeArray = new std::vector< int >();
+}
+
+/*virtual*/ MeshAdjacency::~MeshAdjacency( void )
+{
+	delete originArray;
+	delete twinArray;
+	delete vertexOffsetArray;
+	delete outgoingHalfEdgeArray;
+}
+
+void MeshAdjacency::Clear( void )
+{
+	originArray->clear();
+	twinArray->clear();
+	vertexOffsetArray->clear();
+	outgoingHalfEdgeArray->clear();
+}
+
+bool MeshAdjacency::Generate( const TriangleMesh& triangleMesh )
+{
+	return Generate( *triangleMesh.triangleArray, ( int )triangleMesh.vertexArray->size() );
+}
+
+bool MeshAdjacency::Generate( const IndexTriangleArray& triangleArray, int vertexCount )
+{
+	int halfEdgeCount = 3 * ( int )triangleArray.size();
+
+	originArray->resize( halfEdgeCount );
+	for( int i = 0; i < ( signed )triangleArray.size(); i++ )
+	{
+		for( int j = 0; j < 3; j++ )
+		{
+			int vertex = triangleArray[i].vertex[j];
+			if( vertex < 0 || vertex >= vertexCount )
+			{
+				Clear();
+				return false;
+			}
+
+			( *originArray )[ 3 * i + j ] = vertex;
+		}
+	}
+
+	// Bucket the half-edges by origin vertex with a counting sort.  Visiting them in
+	// order means each bucket lists its half-edges in order of increasing triangle index.
+	vertexOffsetArray->assign( vertexCount + 1, 0 );
+	for( int i = 0; i < halfEdgeCount; i++ )
+		( *vertexOffsetArray )[ ( *originArray )[i] + 1 ]++;
+
+	for( int i = 0; i < vertexCount; i++ )
+		( *vertexOffsetArray )[ i + 1 ] += ( *vertexOffsetArray )[i];
+
+	std::vector< int > cursorArray( vertexOffsetArray->begin(), vertexOffsetArray->end() - 1 );
+	outgoingHalfEdgeArray->resize( halfEdgeCount );
+	for( int i = 0; i < halfEdgeCount; i++ )
+		( *outgoingHalfEdgeArray )[ cursorArray[ ( *originArray )[i] ]++ ] = i;
+
+	// The twin of a half-edge from A to B, if any, is found among the half-edges leaving B.
+	twinArray->assign( halfEdgeCount, -1 );
+	for( int i = 0; i < halfEdgeCount; i++ )
+	{
+		if( ( *twinArray )[i] >= 0 )
+			continue;
+
+		int originVertex = ( *originArray )[i];
+		int terminalVertex = GetTerminalVertex( i );
+
+		int count = 0;
+		const int* outgoingHalfEdges = GetOutgoingHalfEdges( terminalVertex, count );
+		for( int j = 0; j < count; j++ )
+		{
+			int halfEdge = outgoingHalfEdges[j];
+			if( ( *twinArray )[ halfEdge ] < 0 && GetTerminalVertex( halfEdge ) == originVertex && halfEdge != i )
+			{
+				( *twinArray )[i] = halfEdge;
+				( *twinArray )[ halfEdge ] = i;
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+int MeshAdjacency::GetTriangleCount( void ) const
+{
+	return ( int )originArray->size() / 3;
+}
+
+int MeshAdjacency::GetVertexCount( void ) const
+{
+	return( vertexOffsetArray->size() > 0 ? ( int )vertexOffsetArray->size() - 1 : 0 );
+}
+
+int MeshAdjacency::GetTwinHalfEdge( int halfEdge ) const
+{
+	return ( *twinArray )[ halfEdge ];
+}
+
+int MeshAdjacency::GetOriginVertex( int halfEdge ) const
+{
+	return ( *originArray )[ halfEdge ];
+}
+
+int MeshAdjacency::GetTerminalVertex( int halfEdge ) const
+{
+	return ( *originArray )[ GetNextHalfEdge( halfEdge ) ];
+}
+
+int MeshAdjacency::GetAdjacentTriangle( int triangle, int edge ) const
+{
+	int twinHalfEdge = ( *twinArray )[ 3 * triangle + edge ];
+	return( twinHalfEdge >= 0 ? GetTriangle( twinHalfEdge ) : -1 );
+}
+
+bool MeshAdjacency::IsBoundaryEdge( int triangle, int edge ) const
+{
+	return( ( *twinArray )[ 3 * triangle + edge ] < 0 ? true : false );
+}
+
+bool MeshAdjacency::IsBoundaryVertex( int vertex ) const
+{
+	int count = 0;
+	const int* outgoingHalfEdges = GetOutgoingHalfEdges( vertex, count );
+
+	// A vertex is on the boundary if an edge leaving it or an edge arriving at it has no twin.
+	for( int i = 0; i < count; i++ )
+		if( ( *twinArray )[ outgoingHalfEdges[i] ] < 0 || ( *twinArray )[ GetPrevHalfEdge( outgoingHalfEdges[i] ) ] < 0 )
+			return true;
+
+	return false;
+}
+
+const int* MeshAdjacency::GetOutgoingHalfEdges( int vertex, int& count ) const
+{
+	int offset = ( *vertexOffsetArray )[ vertex ];
+	count = ( *vertexOffsetArray )[ vertex + 1 ] - offset;
+	return outgoingHalfEdgeArray->data() + offset;
+}
+
+void MeshAdjacency::GetVertexRing( int vertex, std::vector< int >& ringArray ) const
+{
+	ringArray.clear();
+
+	int count = 0;
+	const int* outgoingHalfEdges = GetOutgoingHalfEdges( vertex, count );
+
+	// Each neighbor is the far end of an edge leaving us or the near end of one arriving.
+	// Interior neighbors show up both ways, so we only take the latter on the boundary.
+	for( int i = 0; i < count; i++ )
+	{
+		int halfEdge = outgoingHalfEdges[i];
+		ringArray.push_back( GetTerminalVertex( halfEdge ) );
+
+		int prevHalfEdge = GetPrevHalfEdge( halfEdge );
+		if( ( *twinArray )[ prevHalfEdge ] < 0 )
+			ringArray.push_back( GetOriginVertex( prevHalfEdge ) );
+	}
+}
+
+void MeshAdjacency::GetVertexTriangles( int vertex, std::vector< int >& triangleArray ) const
+{
+	triangleArray.clear();
+
+	int count = 0;
+	const int* outgoingHalfEdges = GetOutgoingHalfEdges( vertex, count );
+
+	for( int i = 0; i < count; i++ )
+		triangleArray.push_back( GetTriangle( outgoingHalfEdges[i] ) );
+}
+
+// MeshAdjacency.cpp
@@ -0,0 +1,74 @@
+// MeshAdjacency.h
+
+#pragma once
+
+#include "Defines.h"
+#include "IndexTriangle.h"
+
+namespace _3DMath
+{
+	class MeshAdjacency;
+	class TriangleMesh;
+}
+
+// This is a half-edge style adjacency index over a triangle array.  Half-edge 3t+i is the
+// directed edge from vertex i to vertex (i+1)%3 of triangle t, so a half-edge also names
+// the corner of the triangle at which it starts, and we need store only its twin, if any.
+// We also store, for each vertex, the half-edges leaving it.  All of this is built in time
+// linear in the number of triangles (for meshes of bounded vertex degree), after which
+// neighbor and boundary queries are constant time, and vertex ring queries are linear in
+// the degree of the vertex.  The index is a snapshot; regenerate it if the mesh changes.
+class _3DMATH_API _3DMath::MeshAdjacency
+{
+public:
+
+	MeshAdjacency( void );
+	virtual ~MeshAdjacency( void );
+
+	void Clear( void );
+
+	// These fail, leaving the index empty, if a triangle refers to a vertex that isn't there.
+	bool Generate( const TriangleMesh& triangleMesh );
+	bool Generate( const IndexTriangleArray& triangleArray, int vertexCount );
+
+	int GetTriangleCount( void ) const;
+	int GetVertexCount( void ) const;
+
+	static int GetTriangle( int halfEdge )
+	{
+		return halfEdge / 3;
+	}
+
+	static int GetNextHalfEdge( int halfEdge )
+	{
+		return( ( halfEdge % 3 ) == 2 ? halfEdge - 2 : halfEdge + 1 );
+	}
+
+	static int GetPrevHalfEdge( int halfEdge )
+	{
+		return( ( halfEdge % 3 ) == 0 ? halfEdge + 2 : halfEdge - 1 );
+	}
+
+	int GetTwinHalfEdge( int halfEdge ) const;
+	int GetOriginVertex( int halfEdge ) const;
+	int GetTerminalVertex( int halfEdge ) const;
+
+	int GetAdjacentTriangle( int triangle, int edge ) const;
+	bool IsBoundaryEdge( int triangle, int edge ) const;
+	bool IsBoundaryVertex( int vertex ) const;
+
+	// These are the half-edges leaving the given vertex, in order of increasing triangle index.
+	const int* GetOutgoingHalfEdges( int vertex, int& count ) const;
+
+	void GetVertexRing( int vertex, std::vector< int >& ringArray ) const;
+	void GetVertexTriangles( int vertex, std::vector< int >& triangleArray ) const;
+
+private:
+
+	std::vector< int >* originArray;
+	std::vector< int >* twinArray;
+	std::vector< int >* vertexOffsetArray;
+	std::vector< int >* outgoingHalfEdgeArray;
+};
+
+// MeshAdjacency.h
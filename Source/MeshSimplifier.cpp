@@ -0,0 +1,432 @@
+// MeshSimplifier.cpp
+
+#include "MeshSimplifier.h"
+#include "MeshAdjacency.h"
+#include "Vertex.h"
+#include <algorithm>
+
+using namespace _3DMath;
+
+MeshSimplifier::MeshSimplifier( void )
+{
+	boundaryWeight = 1000.0;
+
+	positionArray = new std::vector< Vector >();
+	quadricArray = new std::vector< Quadric >();
+	stampArray = new std::vector< int >();
+	vertexTriangleArray = new std::vector< std::vector< int > >();
+	triangleArray = new IndexTriangleArray();
+	collapseQueue = new CollapseQueue();
+	triangleCount = 0;
+}
+
+/*virtual*/ MeshSimplifier::~MeshSimplifier( void )
+{
+	delete positionArray;
+	delete quadricArray;
+	delete stampArray;
+	delete vertexTriangleArray;
+	delete triangleArray;
+	delete collapseQueue;
+}
+
+bool MeshSimplifier::Simplify( const TriangleMesh& sourceMesh, TriangleMesh& targetMesh, int targetTriangleCount, double maxError /*= -1.0*/ )
+{
+	if( !Initialize( sourceMesh ) )
+		return false;
+
+	CollapseUntil( targetTriangleCount, maxError );
+	GenerateMesh( sourceMesh, targetMesh );
+	return true;
+}
+
+bool MeshSimplifier::GenerateLODChain( const TriangleMesh& sourceMesh, const std::vector< int >& targetTriangleCountArray, TriangleMeshList& lodMeshList, double maxError /*= -1.0*/ )
+{
+	if( !Initialize( sourceMesh ) )
+		return false;
+
+	for( int i = 0; i < ( signed )targetTriangleCountArray.size(); i++ )
+	{
+		CollapseUntil( targetTriangleCountArray[i], maxError );
+
+		TriangleMesh* lodMesh = new TriangleMesh();
+		GenerateMesh( sourceMesh, *lodMesh );
+		lodMeshList.push_back( lodMesh );
+	}
+
+	return true;
+}
+
+bool MeshSimplifier::Initialize( const TriangleMesh& sourceMesh )
+{
+	int vertexCount = ( int )sourceMesh.vertexArray->size();
+
+	for( int i = 0; i < sourceMesh.GetTriangleCount(); i++ )
+		for( int j = 0; j < 3; j++ )
+			if( !sourceMesh.ValidIndex( ( *sourceMesh.triangleArray )[i].vertex[j] ) )
+				return false;
+
+	std::vector< int > weldMap;
+	sourceMesh.GenerateWeldMap( weldMap );
+
+	positionArray->resize( vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+		( *positionArray )[i] = ( *sourceMesh.vertexArray )[i].position;
+
+	// Triangles that collapse under the weld never make it into our working copy.
+	triangleArray->clear();
+	for( IndexTriangleArray::const_iterator iter = sourceMesh.triangleArray->cbegin(); iter != sourceMesh.triangleArray->cend(); iter++ )
+	{
+		IndexTriangle indexTriangle = *iter;
+		for( int i = 0; i < 3; i++ )
+			indexTriangle.vertex[i] = weldMap[ indexTriangle.vertex[i] ];
+
+		if( indexTriangle.vertex[0] != indexTriangle.vertex[1] && indexTriangle.vertex[1] != indexTriangle.vertex[2] && indexTriangle.vertex[2] != indexTriangle.vertex[0] )
+			triangleArray->push_back( indexTriangle );
+	}
+
+	triangleCount = ( int )triangleArray->size();
+
+	stampArray->assign( vertexCount, 0 );
+	vertexTriangleArray->assign( vertexCount, std::vector< int >() );
+	for( int i = 0; i < triangleCount; i++ )
+		for( int j = 0; j < 3; j++ )
+			( *vertexTriangleArray )[ ( *triangleArray )[i].vertex[j] ].push_back( i );
+
+	// Every vertex starts out with the area-weighted planes of the triangles around it.
+	Quadric zeroQuadric;
+	for( int i = 0; i < 10; i++ )
+		zeroQuadric.coefficient[i] = 0.0;
+
+	quadricArray->assign( vertexCount, zeroQuadric );
+
+	std::vector< Vector > faceNormalArray( triangleCount );
+	for( int i = 0; i < triangleCount; i++ )
+	{
+		const IndexTriangle& indexTriangle = ( *triangleArray )[i];
+		const Vector& position0 = ( *positionArray )[ indexTriangle.vertex[0] ];
+
+		Vector edge0, edge1, normal;
+		edge0.Subtract( ( *positionArray )[ indexTriangle.vertex[1] ], position0 );
+		edge1.Subtract( ( *positionArray )[ indexTriangle.vertex[2] ], position0 );
+		normal.Cross( edge0, edge1 );
+
+		double area = 0.5 * normal.Length();
+		if( !normal.Normalize() )
+			normal.Set( 0.0, 0.0, 0.0 );
+
+		faceNormalArray[i] = normal;
+
+		Quadric quadric;
+		quadric.SetPlane( normal, -normal.Dot( position0 ), area );
+
+		for( int j = 0; j < 3; j++ )
+			( *quadricArray )[ indexTriangle.vertex[j] ].Add( quadric );
+	}
+
+	// Along open boundaries, add planes standing perpendicular to the surface through each boundary edge.
+	MeshAdjacency meshAdjacency;
+	meshAdjacency.Generate( *triangleArray, vertexCount );
+
+	for( int i = 0; i < 3 * triangleCount; i++ )
+	{
+		if( meshAdjacency.GetTwinHalfEdge( i ) >= 0 )
+			continue;
+
+		int vertex0 = meshAdjacency.GetOriginVertex( i );
+		int vertex1 = meshAdjacency.GetTerminalVertex( i );
+
+		Vector edge, normal;
+		edge.Subtract( ( *positionArray )[ vertex1 ], ( *positionArray )[ vertex0 ] );
+		normal.Cross( edge, faceNormalArray[ MeshAdjacency::GetTriangle( i ) ] );
+		if( !normal.Normalize() )
+			continue;
+
+		Quadric quadric;
+		quadric.SetPlane( normal, -normal.Dot( ( *positionArray )[ vertex0 ] ), boundaryWeight * edge.Dot( edge ) );
+
+		( *quadricArray )[ vertex0 ].Add( quadric );
+		( *quadricArray )[ vertex1 ].Add( quadric );
+	}
+
+	*collapseQueue = CollapseQueue();
+
+	for( int i = 0; i < 3 * triangleCount; i++ )
+	{
+		int twinHalfEdge = meshAdjacency.GetTwinHalfEdge( i );
+		if( twinHalfEdge < 0 || i < twinHalfEdge )
+			QueueCollapse( meshAdjacency.GetOriginVertex( i ), meshAdjacency.GetTerminalVertex( i ) );
+	}
+
+	return true;
+}
+
+void MeshSimplifier::QueueCollapse( int vertex0, int vertex1 )
+{
+	Quadric quadric = ( *quadricArray )[ vertex0 ];
+	quadric.Add( ( *quadricArray )[ vertex1 ] );
+
+	Collapse collapse;
+	collapse.vertex[0] = vertex0;
+	collapse.vertex[1] = vertex1;
+	collapse.stamp[0] = ( *stampArray )[ vertex0 ];
+	collapse.stamp[1] = ( *stampArray )[ vertex1 ];
+
+	// If the quadric has no unique minimum, as happens where the surface is flat, we settle
+	// for the best of the edge's end-points and mid-point.
+	if( quadric.Minimize( collapse.position ) )
+		collapse.cost = quadric.Evaluate( collapse.position );
+	else
+	{
+		const Vector& position0 = ( *positionArray )[ vertex0 ];
+		const Vector& position1 = ( *positionArray )[ vertex1 ];
+
+		Vector midPoint;
+		midPoint.Lerp( position0, position1, 0.5 );
+
+		const Vector* candidate[3] = { &position0, &position1, &midPoint };
+
+		collapse.cost = -1.0;
+		for( int i = 0; i < 3; i++ )
+		{
+			double cost = quadric.Evaluate( *candidate[i] );
+			if( collapse.cost < 0.0 || cost < collapse.cost )
+			{
+				collapse.cost = cost;
+				collapse.position = *candidate[i];
+			}
+		}
+	}
+
+	collapse.cost = MAX( collapse.cost, 0.0 );
+	collapseQueue->push( collapse );
+}
+
+void MeshSimplifier::CollapseUntil( int targetTriangleCount, double maxError )
+{
+	while( triangleCount > targetTriangleCount && collapseQueue->size() > 0 )
+	{
+		Collapse collapse = collapseQueue->top();
+
+		// Collapses queued before either of their vertices last changed are out of date.
+		if( collapse.stamp[0] != ( *stampArray )[ collapse.vertex[0] ] || collapse.stamp[1] != ( *stampArray )[ collapse.vertex[1] ] )
+		{
+			collapseQueue->pop();
+			continue;
+		}
+
+		if( maxError >= 0.0 && collapse.cost > maxError )
+			break;
+
+		collapseQueue->pop();
+		CollapseEdge( collapse );
+	}
+}
+
+void MeshSimplifier::GatherNeighbors( int vertex, std::vector< int >& neighborArray )
+{
+	// Drop any triangles that have since been collapsed away while we're here.
+	std::vector< int >& triangleList = ( *vertexTriangleArray )[ vertex ];
+	int count = 0;
+	for( int i = 0; i < ( signed )triangleList.size(); i++ )
+		if( ( *triangleArray )[ triangleList[i] ].vertex[0] >= 0 )
+			triangleList[ count++ ] = triangleList[i];
+	triangleList.resize( count );
+
+	neighborArray.clear();
+	for( int i = 0; i < count; i++ )
+	{
+		const IndexTriangle& indexTriangle = ( *triangleArray )[ triangleList[i] ];
+		for( int j = 0; j < 3; j++ )
+			if( indexTriangle.vertex[j] != vertex )
+				neighborArray.push_back( indexTriangle.vertex[j] );
+	}
+
+	std::sort( neighborArray.begin(), neighborArray.end() );
+	neighborArray.erase( std::unique( neighborArray.begin(), neighborArray.end() ), neighborArray.end() );
+}
+
+bool MeshSimplifier::CollapseEdge( const Collapse& collapse )
+{
+	int keptVertex = collapse.vertex[0];
+	int lostVertex = collapse.vertex[1];
+
+	std::vector< int > keptNeighborArray, lostNeighborArray;
+	GatherNeighbors( keptVertex, keptNeighborArray );
+	GatherNeighbors( lostVertex, lostNeighborArray );
+
+	std::vector< int >& keptTriangleList = ( *vertexTriangleArray )[ keptVertex ];
+	std::vector< int >& lostTriangleList = ( *vertexTriangleArray )[ lostVertex ];
+
+	int sharedCount = 0;
+	for( int i = 0; i < ( signed )lostTriangleList.size(); i++ )
+		if( ( *triangleArray )[ lostTriangleList[i] ].HasVertex( keptVertex ) )
+			sharedCount++;
+
+	if( sharedCount == 0 )
+		return false;
+
+	// The link condition: the vertices adjacent to both ends of the edge must be exactly those
+	// opposite the edge in the triangles that share it.  Otherwise the collapse pinches the surface.
+	std::vector< int > commonNeighborArray;
+	std::set_intersection( keptNeighborArray.begin(), keptNeighborArray.end(), lostNeighborArray.begin(), lostNeighborArray.end(), std::back_inserter( commonNeighborArray ) );
+	if( ( signed )commonNeighborArray.size() != sharedCount )
+		return false;
+
+	// Don't let any triangle that survives the collapse flip over or get squashed flat.
+	for( int i = 0; i < 2; i++ )
+	{
+		int vertex = collapse.vertex[i];
+		const std::vector< int >& triangleList = ( *vertexTriangleArray )[ vertex ];
+		for( int j = 0; j < ( signed )triangleList.size(); j++ )
+		{
+			const IndexTriangle& indexTriangle = ( *triangleArray )[ triangleList[j] ];
+			if( indexTriangle.HasVertex( collapse.vertex[ 1 - i ] ) )
+				continue;
+
+			Vector position[3];
+			for( int k = 0; k < 3; k++ )
+				position[k] = ( *positionArray )[ indexTriangle.vertex[k] ];
+
+			Vector edge0, edge1, oldNormal, newNormal;
+			edge0.Subtract( position[1], position[0] );
+			edge1.Subtract( position[2], position[0] );
+			oldNormal.Cross( edge0, edge1 );
+
+			for( int k = 0; k < 3; k++ )
+				if( indexTriangle.vertex[k] == vertex )
+					position[k] = collapse.position;
+
+			edge0.Subtract( position[1], position[0] );
+			edge1.Subtract( position[2], position[0] );
+			newNormal.Cross( edge0, edge1 );
+
+			if( !oldNormal.Normalize() || !newNormal.Normalize() || newNormal.Dot( oldNormal ) < 0.2 )
+				return false;
+		}
+	}
+
+	for( int i = 0; i < ( signed )lostTriangleList.size(); i++ )
+	{
+		IndexTriangle& indexTriangle = ( *triangleArray )[ lostTriangleList[i] ];
+		if( indexTriangle.HasVertex( keptVertex ) )
+		{
+			indexTriangle.vertex[0] = indexTriangle.vertex[1] = indexTriangle.vertex[2] = -1;
+			triangleCount--;
+		}
+		else
+		{
+			for( int j = 0; j < 3; j++ )
+				if( indexTriangle.vertex[j] == lostVertex )
+					indexTriangle.vertex[j] = keptVertex;
+
+			keptTriangleList.push_back( lostTriangleList[i] );
+		}
+	}
+
+	lostTriangleList.clear();
+
+	( *positionArray )[ keptVertex ] = collapse.position;
+	( *quadricArray )[ keptVertex ].Add( ( *quadricArray )[ lostVertex ] );
+	( *stampArray )[ keptVertex ]++;
+	( *stampArray )[ lostVertex ] = -1;
+
+	// Only the edges touching the kept vertex have changed cost.
+	GatherNeighbors( keptVertex, keptNeighborArray );
+	for( int i = 0; i < ( signed )keptNeighborArray.size(); i++ )
+		QueueCollapse( keptVertex, keptNeighborArray[i] );
+
+	return true;
+}
+
+void MeshSimplifier::GenerateMesh( const TriangleMesh& sourceMesh, TriangleMesh& targetMesh ) const
+{
+	// We build the new mesh off to the side, since the target may be the source.
+	VertexArray newVertexArray;
+	IndexTriangleArray newTriangleArray;
+	newTriangleArray.reserve( triangleCount );
+
+	std::vector< int > indexMap( positionArray->size(), -1 );
+
+	for( IndexTriangleArray::const_iterator iter = triangleArray->cbegin(); iter != triangleArray->cend(); iter++ )
+	{
+		IndexTriangle indexTriangle = *iter;
+		if( indexTriangle.vertex[0] < 0 )
+			continue;
+
+		for( int i = 0; i < 3; i++ )
+		{
+			int& index = indexMap[ indexTriangle.vertex[i] ];
+			if( index < 0 )
+			{
+				index = ( int )newVertexArray.size();
+				Vertex vertex = ( *sourceMesh.vertexArray )[ indexTriangle.vertex[i] ];
+				vertex.position = ( *positionArray )[ indexTriangle.vertex[i] ];
+				newVertexArray.push_back( vertex );
+			}
+
+			indexTriangle.vertex[i] = index;
+		}
+
+		newTriangleArray.push_back( indexTriangle );
+	}
+
+	targetMesh.Clear();
+	targetMesh.vertexArray->swap( newVertexArray );
+	targetMesh.triangleArray->swap( newTriangleArray );
+}
+
+// The coefficients are those of the symmetric matrix [ a b c d ]^T [ a b c d ], upper triangle, row by row.
+void MeshSimplifier::Quadric::SetPlane( const Vector& unitNormal, double distance, double weight )
+{
+	double plane[4] = { unitNormal.x, unitNormal.y, unitNormal.z, distance };
+
+	int k = 0;
+	for( int i = 0; i < 4; i++ )
+		for( int j = i; j < 4; j++ )
+			coefficient[ k++ ] = weight * plane[i] * plane[j];
+}
+
+void MeshSimplifier::Quadric::Add( const Quadric& quadric )
+{
+	for( int i = 0; i < 10; i++ )
+		coefficient[i] += quadric.coefficient[i];
+}
+
+double MeshSimplifier::Quadric::Evaluate( const Vector& position ) const
+{
+	const double* q = coefficient;
+	double x = position.x, y = position.y, z = position.z;
+
+	return	x * ( q[0] * x + 2.0 * ( q[1] * y + q[2] * z + q[3] ) ) +
+			y * ( q[4] * y + 2.0 * ( q[5] * z + q[6] ) ) +
+			z * ( q[7] * z + 2.0 * q[8] ) +
+			q[9];
+}
+
+bool MeshSimplifier::Quadric::Minimize( Vector& position ) const
+{
+	const double* q = coefficient;
+
+	// Solve the 3x3 system for where the gradient vanishes using Cramer's rule.
+	double cofactor00 = q[4] * q[7] - q[5] * q[5];
+	double cofactor01 = q[2] * q[5] - q[1] * q[7];
+	double cofactor02 = q[1] * q[5] - q[2] * q[4];
+	double determinant = q[0] * cofactor00 + q[1] * cofactor01 + q[2] * cofactor02;
+
+	double scale = MAX( fabs( q[0] ), MAX( fabs( q[4] ), fabs( q[7] ) ) );
+	if( fabs( determinant ) <= 1e-9 * scale * scale * scale )
+		return false;
+
+	double cofactor11 = q[0] * q[7] - q[2] * q[2];
+	double cofactor12 = q[1] * q[2] - q[0] * q[5];
+	double cofactor22 = q[0] * q[4] - q[1] * q[1];
+
+	double inverseDeterminant = 1.0 / determinant;
+	position.x = -( cofactor00 * q[3] + cofactor01 * q[6] + cofactor02 * q[8] ) * inverseDeterminant;
+	position.y = -( cofactor01 * q[3] + cofactor11 * q[6] + cofactor12 * q[8] ) * inverseDeterminant;
+	position.z = -( cofactor02 * q[3] + cofactor12 * q[6] + cofactor22 * q[8] ) * inverseDeterminant;
+	return true;
+}
+
+// MeshSimplifier.cpp
@@ -0,0 +1,85 @@
+// MeshSimplifier.h
+
+#pragma once
+
+#include "Defines.h"
+#include "Vector.h"
+#include "IndexTriangle.h"
+#include "TriangleMesh.h"
+#include <queue>
+
+namespace _3DMath
+{
+	class MeshSimplifier;
+}
+
+// This reduces the triangle count of a mesh by repeatedly collapsing whichever edge costs the least
+// to collapse, as measured by the Garland-Heckbert quadric error metric.  Each vertex carries a
+// quadric summing the squared distances to the planes of the original triangles around it, so the
+// cost of merging two vertices, and the best place to put the result, are found from the sum of
+// their quadrics without looking back at the original mesh.  Collapses that would fold the surface
+// over on itself, or pinch it into something non-manifold, are skipped.  Vertices are welded before
+// we begin, so attribute seams do not hold the mesh together; each surviving vertex keeps the
+// attributes of the source vertex it came from, with only its position changed.
+class _3DMATH_API _3DMath::MeshSimplifier
+{
+public:
+
+	MeshSimplifier( void );
+	virtual ~MeshSimplifier( void );
+
+	// This stops once no more than the given number of triangles remain, or once the next collapse
+	// would cost more than the given error bound, whichever comes first.  The error is a sum of squared
+	// distances, so it is in units of area.  A negative bound means no bound.  The source and target
+	// meshes may be one and the same.
+	bool Simplify( const TriangleMesh& sourceMesh, TriangleMesh& targetMesh, int targetTriangleCount, double maxError = -1.0 );
+
+	// This simplifies in one pass, appending a mesh to the given list each time the triangle count falls
+	// to the next of the given targets, which should decrease.  If the error bound is hit first, the
+	// remaining levels are all copies of the last mesh we could make.  The caller owns the new meshes.
+	bool GenerateLODChain( const TriangleMesh& sourceMesh, const std::vector< int >& targetTriangleCountArray, TriangleMeshList& lodMeshList, double maxError = -1.0 );
+
+	double boundaryWeight;		// This scales the planes that keep open boundaries from shrinking away.
+
+private:
+
+	struct Quadric
+	{
+		void SetPlane( const Vector& unitNormal, double distance, double weight );
+		void Add( const Quadric& quadric );
+		double Evaluate( const Vector& position ) const;
+		bool Minimize( Vector& position ) const;
+
+		double coefficient[10];
+	};
+
+	struct Collapse
+	{
+		// The priority queue pops its greatest element, so we order collapses by decreasing cost.
+		bool operator<( const Collapse& collapse ) const { return cost > collapse.cost; }
+
+		double cost;
+		int vertex[2];
+		int stamp[2];
+		Vector position;
+	};
+
+	typedef std::priority_queue< Collapse > CollapseQueue;
+
+	bool Initialize( const TriangleMesh& sourceMesh );
+	void QueueCollapse( int vertex0, int vertex1 );
+	bool CollapseEdge( const Collapse& collapse );
+	void CollapseUntil( int targetTriangleCount, double maxError );
+	void GatherNeighbors( int vertex, std::vector< int >& neighborArray );
+	void GenerateMesh( const TriangleMesh& sourceMesh, TriangleMesh& targetMesh ) const;
+
+	std::vector< Vector >* positionArray;
+	std::vector< Quadric >* quadricArray;
+	std::vector< int >* stampArray;
+	std::vector< std::vector< int > >* vertexTriangleArray;
+	IndexTriangleArray* triangleArray;
+	CollapseQueue* collapseQueue;
+	int triangleCount;
+};
+
+// MeshSimplifier.h
@@ -141,6 +141,9 @@ void ParticleSystem::IntegrateParticles( const _3DMath::TimeKeeper& timeKeeper )
 
 void ParticleSystem::ResolveCollisions( void )
 {
+	for( CollisionObjectList::iterator collisionIter = collisionObjectList->begin(); collisionIter != collisionObjectList->end(); collisionIter++ )
+		( *collisionIter )->Update();
+
 	ParticleList::iterator iter = particleList->begin();
 	while( iter != particleList->end() )
 	{
@@ -576,6 +579,10 @@ ParticleSystem::CollisionObject::CollisionObject( void )
 {
 }
 
+/*virtual*/ void ParticleSystem::CollisionObject::Update( void )
+{
+}
+
 //-------------------------------------------------------------------------------------------------
 //                                            CollisionPlane
 //-------------------------------------------------------------------------------------------------
@@ -624,7 +631,7 @@ ParticleSystem::ConvexTriangleMeshCollisionObject::ConvexTriangleMeshCollisionOb
 
 	int count = 0;
 
-	for( IndexTriangleList::const_iterator iter = mesh->triangleList->cbegin(); iter != mesh->triangleList->cend(); iter++ )
+	for( IndexTriangleArray::const_iterator iter = mesh->triangleArray->cbegin(); iter != mesh->triangleArray->cend(); iter++ )
 	{
 		const IndexTriangle& indexTriangle = *iter;
 		
@@ -635,12 +642,12 @@ ParticleSystem::ConvexTriangleMeshCollisionObject::ConvexTriangleMeshCollisionOb
 			count++;
 	}
 
-	if( count < ( signed )mesh->triangleList->size() )
+	if( count < ( signed )mesh->triangleArray->size() )
 		return false;
 
 	double smallestDistance = -1.0;
 
-	for( IndexTriangleList::const_iterator iter = mesh->triangleList->cbegin(); iter != mesh->triangleList->cend(); iter++ )
+	for( IndexTriangleArray::const_iterator iter = mesh->triangleArray->cbegin(); iter != mesh->triangleArray->cend(); iter++ )
 	{
 		const IndexTriangle& indexTriangle = *iter;
 		
@@ -668,6 +675,8 @@ ParticleSystem::ConvexTriangleMeshCollisionObject::ConvexTriangleMeshCollisionOb
 ParticleSystem::BoundingBoxTreeCollisionObject::BoundingBoxTreeCollisionObject( void )
 {
 	boxTree = nullptr;
+	mesh = nullptr;
+	rebuildFactor = 0.0;
 	detectionDistance = 1.0;		// If this is too small, we'll tunnel.
 }
 
@@ -675,6 +684,12 @@ ParticleSystem::BoundingBoxTreeCollisionObject::BoundingBoxTreeCollisionObject(
 {
 }
 
+/*virtual*/ void ParticleSystem::BoundingBoxTreeCollisionObject::Update( void )
+{
+	if( boxTree && mesh )
+		boxTree->Refit( *mesh, rebuildFactor );
+}
+
 /*virtual*/ bool ParticleSystem::BoundingBoxTreeCollisionObject::ResolveCollision( const LineSegment& lineOfMotion, Vector& contactPosition, Vector& contactUnitNormal )
 {
 	if( !boxTree )
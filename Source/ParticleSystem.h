@@ -190,6 +190,9 @@ public:
 		CollisionObject( void );
 		virtual ~CollisionObject( void );
 
+		// This is called once per simulation step, before any collisions are resolved against the object.
+		virtual void Update( void );
+
 		virtual bool ResolveCollision( const LineSegment& lineOfMotion, Vector& contactPosition, Vector& contactUnitNormal ) = 0;
 
 		double friction;
@@ -227,9 +230,12 @@ public:
 		BoundingBoxTreeCollisionObject( void );
 		virtual ~BoundingBoxTreeCollisionObject( void );
 
+		virtual void Update( void ) override;
 		virtual bool ResolveCollision( const LineSegment& lineOfMotion, Vector& contactPosition, Vector& contactUnitNormal ) override;
 
 		BoundingBoxTree* boxTree;
+		const TriangleMesh* mesh;	// If the tree was built from a mesh that deforms, set this to have the tree refit to it every step.
+		double rebuildFactor;		// This is passed along to the tree's Refit method.
 		double detectionDistance;
 	};
 
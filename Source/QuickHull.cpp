@@ -0,0 +1,363 @@
+// QuickHull.cpp
+
+#include "QuickHull.h"
+#include "LinearTransform.h"
+#include "Line.h"
+
+using namespace _3DMath;
+
+QuickHull::QuickHull( void )
+{
+	faceArray = new FaceArray();
+	newFaceByStartVertex = new std::vector< int >();
+	visitStamp = 0;
+}
+
+/*virtual*/ QuickHull::~QuickHull( void )
+{
+	delete faceArray;
+	delete newFaceByStartVertex;
+}
+
+bool QuickHull::Generate( const VertexArray& vertexArray, IndexTriangleArray& triangleArray, int* tetrahedron /*= nullptr*/, double eps /*= EPSILON*/ )
+{
+	triangleArray.clear();
+	faceArray->clear();
+	visitStamp = 0;
+
+	int initialTetrahedron[4];
+	if( !FindInitialTetrahedron( vertexArray, initialTetrahedron, eps ) )
+		return false;
+
+	if( tetrahedron )
+		for( int i = 0; i < 4; i++ )
+			tetrahedron[i] = initialTetrahedron[i];
+
+	int i0 = initialTetrahedron[0];
+	int i1 = initialTetrahedron[1];
+	int i2 = initialTetrahedron[2];
+	int i3 = initialTetrahedron[3];
+
+	AddFace( vertexArray, i0, i1, i3 );
+	AddFace( vertexArray, i0, i3, i2 );
+	AddFace( vertexArray, i0, i2, i1 );
+	AddFace( vertexArray, i1, i2, i3 );
+
+	for( int i = 0; i < 4; i++ )
+		for( int j = 0; j < 3; j++ )
+			for( int k = i + 1; k < 4; k++ )
+				if( ( *faceArray )[i].adjacentFace[j] < 0 )
+					LinkFaces( i, j, k );
+
+	std::vector< int > initialFaceArray;
+	for( int i = 0; i < 4; i++ )
+		initialFaceArray.push_back( i );
+
+	for( int i = 0; i < ( signed )vertexArray.size(); i++ )
+		if( i != i0 && i != i1 && i != i2 && i != i3 )
+			AssignConflict( vertexArray, i, initialFaceArray, eps );
+
+	newFaceByStartVertex->assign( vertexArray.size(), -1 );
+
+	// New faces are only ever appended, and a face is deleted as soon as we process
+	// it, so a single pass over the growing face array processes every face we need to.
+	for( int i = 0; i < ( signed )faceArray->size(); i++ )
+	{
+		const Face& face = ( *faceArray )[i];
+		if( face.deleted || face.conflictArray.size() == 0 )
+			continue;
+
+		if( !AddPointToHull( vertexArray, i, eps ) )
+		{
+			faceArray->clear();
+			return false;
+		}
+	}
+
+	for( int i = 0; i < ( signed )faceArray->size(); i++ )
+	{
+		const Face& face = ( *faceArray )[i];
+		if( !face.deleted )
+			triangleArray.push_back( IndexTriangle( face.vertex[0], face.vertex[1], face.vertex[2] ) );
+	}
+
+	faceArray->clear();
+	return true;
+}
+
+bool QuickHull::FindInitialTetrahedron( const VertexArray& vertexArray, int* tetrahedron, double eps ) const
+{
+	if( vertexArray.size() < 4 )
+		return false;
+
+	// Start with the pair of axis-extreme points that are furthest apart.
+	int extremeArray[6] = { 0, 0, 0, 0, 0, 0 };
+	for( int i = 1; i < ( signed )vertexArray.size(); i++ )
+	{
+		const Vector& position = vertexArray[i].position;
+
+		if( position.x < vertexArray[ extremeArray[0] ].position.x ) extremeArray[0] = i;
+		if( position.x > vertexArray[ extremeArray[1] ].position.x ) extremeArray[1] = i;
+		if( position.y < vertexArray[ extremeArray[2] ].position.y ) extremeArray[2] = i;
+		if( position.y > vertexArray[ extremeArray[3] ].position.y ) extremeArray[3] = i;
+		if( position.z < vertexArray[ extremeArray[4] ].position.z ) extremeArray[4] = i;
+		if( position.z > vertexArray[ extremeArray[5] ].position.z ) extremeArray[5] = i;
+	}
+
+	double largestDistance = 0.0;
+	for( int i = 0; i < 6; i++ )
+	{
+		for( int j = i + 1; j < 6; j++ )
+		{
+			double distance = vertexArray[ extremeArray[i] ].position.Distance( vertexArray[ extremeArray[j] ].position );
+			if( distance > largestDistance )
+			{
+				largestDistance = distance;
+				tetrahedron[0] = extremeArray[i];
+				tetrahedron[1] = extremeArray[j];
+			}
+		}
+	}
+
+	if( largestDistance < eps )
+		return false;
+
+	// Next, take the point furthest from the line through those two.
+	Line line( vertexArray[ tetrahedron[0] ].position, vertexArray[ tetrahedron[1] ].position - vertexArray[ tetrahedron[0] ].position );
+	line.normal.Normalize();
+
+	largestDistance = 0.0;
+	for( int i = 0; i < ( signed )vertexArray.size(); i++ )
+	{
+		double distance = line.ShortestDistance( vertexArray[i].position );
+		if( distance > largestDistance )
+		{
+			largestDistance = distance;
+			tetrahedron[2] = i;
+		}
+	}
+
+	if( largestDistance < eps )
+		return false;
+
+	// Lastly, take the point furthest from the plane through all three.
+	Triangle triangle( vertexArray[ tetrahedron[0] ].position, vertexArray[ tetrahedron[1] ].position, vertexArray[ tetrahedron[2] ].position );
+	Plane plane;
+	triangle.GetPlane( plane );
+
+	largestDistance = 0.0;
+	for( int i = 0; i < ( signed )vertexArray.size(); i++ )
+	{
+		double distance = fabs( plane.Distance( vertexArray[i].position ) );
+		if( distance > largestDistance )
+		{
+			largestDistance = distance;
+			tetrahedron[3] = i;
+		}
+	}
+
+	if( largestDistance < eps )
+		return false;
+
+	LinearTransform linearTransform;
+	linearTransform.xAxis.Subtract( vertexArray[ tetrahedron[1] ].position, vertexArray[ tetrahedron[0] ].position );
+	linearTransform.yAxis.Subtract( vertexArray[ tetrahedron[2] ].position, vertexArray[ tetrahedron[0] ].position );
+	linearTransform.zAxis.Subtract( vertexArray[ tetrahedron[3] ].position, vertexArray[ tetrahedron[0] ].position );
+
+	// Make sure the tetrahedron is positively oriented so that our initial faces point outward.
+	double det = linearTransform.Determinant();
+	if( det < 0.0 )
+	{
+		int index = tetrahedron[1];
+		tetrahedron[1] = tetrahedron[2];
+		tetrahedron[2] = index;
+		det = -det;
+	}
+
+	// As with any tetrahedron we start from, we want one no where near degenerate.
+	if( det <= eps )
+		return false;
+
+	return true;
+}
+
+int QuickHull::AddFace( const VertexArray& vertexArray, int vertex0, int vertex1, int vertex2 )
+{
+	faceArray->push_back( Face() );
+
+	Face& face = faceArray->back();
+	face.vertex[0] = vertex0;
+	face.vertex[1] = vertex1;
+	face.vertex[2] = vertex2;
+
+	for( int i = 0; i < 3; i++ )
+		face.adjacentFace[i] = -1;
+
+	face.visitStamp = -1;
+	face.visible = false;
+	face.deleted = false;
+
+	Triangle triangle( vertexArray[ vertex0 ].position, vertexArray[ vertex1 ].position, vertexArray[ vertex2 ].position );
+	triangle.GetPlane( face.plane );
+
+	return ( int )faceArray->size() - 1;
+}
+
+// If the other face has the given edge of the given face (in the opposite direction),
+// then this makes the two faces adjacent across that edge.
+bool QuickHull::LinkFaces( int face, int edge, int otherFace )
+{
+	Face& faceA = ( *faceArray )[ face ];
+	Face& faceB = ( *faceArray )[ otherFace ];
+
+	int vertex0 = faceA.vertex[ edge ];
+	int vertex1 = faceA.vertex[ ( edge + 1 ) % 3 ];
+
+	for( int i = 0; i < 3; i++ )
+	{
+		if( faceB.vertex[i] == vertex1 && faceB.vertex[ ( i + 1 ) % 3 ] == vertex0 )
+		{
+			faceA.adjacentFace[ edge ] = otherFace;
+			faceB.adjacentFace[i] = face;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void QuickHull::AssignConflict( const VertexArray& vertexArray, int point, const std::vector< int >& candidateFaceArray, double eps )
+{
+	const Vector& position = vertexArray[ point ].position;
+
+	// A point that no candidate face can see is inside the hull for good.
+	for( int i = 0; i < ( signed )candidateFaceArray.size(); i++ )
+	{
+		Face& face = ( *faceArray )[ candidateFaceArray[i] ];
+		if( face.plane.Distance( position ) > eps )
+		{
+			face.conflictArray.push_back( point );
+			return;
+		}
+	}
+}
+
+bool QuickHull::AddPointToHull( const VertexArray& vertexArray, int face, double eps )
+{
+	// Of the points this face can see, the furthest is certainly on the final hull.
+	int eyePoint = -1;
+	double largestDistance = 0.0;
+
+	const std::vector< int >& conflictArray = ( *faceArray )[ face ].conflictArray;
+	for( int i = 0; i < ( signed )conflictArray.size(); i++ )
+	{
+		double distance = ( *faceArray )[ face ].plane.Distance( vertexArray[ conflictArray[i] ].position );
+		if( distance > largestDistance )
+		{
+			largestDistance = distance;
+			eyePoint = conflictArray[i];
+		}
+	}
+
+	const Vector& eye = vertexArray[ eyePoint ].position;
+
+	// Flood out from the given face to find every face the eye point can see.
+	visitStamp++;
+
+	std::vector< int > visibleFaceArray;
+	visibleFaceArray.push_back( face );
+	( *faceArray )[ face ].visitStamp = visitStamp;
+	( *faceArray )[ face ].visible = true;
+
+	struct HorizonEdge
+	{
+		int face, edge;
+	};
+
+	std::vector< HorizonEdge > horizonArray;
+
+	for( int i = 0; i < ( signed )visibleFaceArray.size(); i++ )
+	{
+		for( int j = 0; j < 3; j++ )
+		{
+			int adjacentFace = ( *faceArray )[ visibleFaceArray[i] ].adjacentFace[j];
+			Face& otherFace = ( *faceArray )[ adjacentFace ];
+
+			if( otherFace.visitStamp != visitStamp )
+			{
+				otherFace.visitStamp = visitStamp;
+				otherFace.visible = ( otherFace.plane.Distance( eye ) > 0.0 );
+				if( otherFace.visible )
+					visibleFaceArray.push_back( adjacentFace );
+			}
+
+			if( !otherFace.visible )
+			{
+				HorizonEdge horizonEdge;
+				horizonEdge.face = visibleFaceArray[i];
+				horizonEdge.edge = j;
+				horizonArray.push_back( horizonEdge );
+			}
+		}
+	}
+
+	// Cone the horizon to the eye point, keeping each new face's adjacency up to date.
+	std::vector< int > newFaceArray;
+
+	for( int i = 0; i < ( signed )horizonArray.size(); i++ )
+	{
+		const HorizonEdge& horizonEdge = horizonArray[i];
+
+		int vertex0 = ( *faceArray )[ horizonEdge.face ].vertex[ horizonEdge.edge ];
+		int vertex1 = ( *faceArray )[ horizonEdge.face ].vertex[ ( horizonEdge.edge + 1 ) % 3 ];
+		int adjacentFace = ( *faceArray )[ horizonEdge.face ].adjacentFace[ horizonEdge.edge ];
+
+		// If the horizon visits a vertex twice, then round-off has made the visible region
+		// something other than a disc, and we can't go on without corrupting the hull.
+		if( ( *newFaceByStartVertex )[ vertex0 ] >= 0 )
+		{
+			for( int j = 0; j < ( signed )newFaceArray.size(); j++ )
+				( *newFaceByStartVertex )[ ( *faceArray )[ newFaceArray[j] ].vertex[0] ] = -1;
+			return false;
+		}
+
+		int newFace = AddFace( vertexArray, vertex0, vertex1, eyePoint );
+		newFaceArray.push_back( newFace );
+		( *newFaceByStartVertex )[ vertex0 ] = newFace;
+
+		if( !LinkFaces( newFace, 0, adjacentFace ) )
+			return false;
+	}
+
+	for( int i = 0; i < ( signed )newFaceArray.size(); i++ )
+	{
+		Face& newFace = ( *faceArray )[ newFaceArray[i] ];
+
+		int nextFace = ( *newFaceByStartVertex )[ newFace.vertex[1] ];
+		if( nextFace < 0 )
+			return false;
+
+		newFace.adjacentFace[1] = nextFace;
+		( *faceArray )[ nextFace ].adjacentFace[2] = newFaceArray[i];
+	}
+
+	for( int i = 0; i < ( signed )newFaceArray.size(); i++ )
+		( *newFaceByStartVertex )[ ( *faceArray )[ newFaceArray[i] ].vertex[0] ] = -1;
+
+	// Hand the points seen by the faces we're removing over to the new faces.
+	for( int i = 0; i < ( signed )visibleFaceArray.size(); i++ )
+	{
+		std::vector< int > orphanArray;
+		orphanArray.swap( ( *faceArray )[ visibleFaceArray[i] ].conflictArray );
+
+		for( int j = 0; j < ( signed )orphanArray.size(); j++ )
+			if( orphanArray[j] != eyePoint )
+				AssignConflict( vertexArray, orphanArray[j], newFaceArray, eps );
+
+		( *faceArray )[ visibleFaceArray[i] ].deleted = true;
+	}
+
+	return true;
+}
+
+// QuickHull.cpp
@@ -0,0 +1,58 @@
+// QuickHull.h
+
+#pragma once
+
+#include "Defines.h"
+#include "Vertex.h"
+#include "IndexTriangle.h"
+#include "Plane.h"
+
+namespace _3DMath
+{
+	class QuickHull;
+}
+
+// This finds the convex hull of a point cloud using the Quickhull algorithm.  Each face of the
+// hull-in-progress keeps a list of the points it can see (its conflict list), so a point is only
+// ever tested against faces near where it was last found, and each face knows its three neighbors,
+// so the region of faces visible from a new hull point, and its horizon, are found by walking that
+// region alone.  The expected running time is O(n log n).
+class _3DMATH_API _3DMath::QuickHull
+{
+public:
+
+	QuickHull( void );
+	virtual ~QuickHull( void );
+
+	// The resulting triangles index into the given vertex array, and wind counter-clockwise when
+	// viewed from outside the hull.  If given, the tetrahedron array receives the indices of the
+	// four points from which the hull was grown.
+	bool Generate( const VertexArray& vertexArray, IndexTriangleArray& triangleArray, int* tetrahedron = nullptr, double eps = EPSILON );
+
+private:
+
+	struct Face
+	{
+		int vertex[3];
+		int adjacentFace[3];		// This is the face on the other side of the edge from vertex[i] to vertex[(i+1)%3].
+		Plane plane;
+		std::vector< int > conflictArray;
+		int visitStamp;
+		bool visible;
+		bool deleted;
+	};
+
+	typedef std::vector< Face > FaceArray;
+
+	bool FindInitialTetrahedron( const VertexArray& vertexArray, int* tetrahedron, double eps ) const;
+	int AddFace( const VertexArray& vertexArray, int vertex0, int vertex1, int vertex2 );
+	void AssignConflict( const VertexArray& vertexArray, int point, const std::vector< int >& candidateFaceArray, double eps );
+	bool AddPointToHull( const VertexArray& vertexArray, int face, double eps );
+	bool LinkFaces( int face, int edge, int otherFace );
+
+	FaceArray* faceArray;
+	std::vector< int >* newFaceByStartVertex;
+	int visitStamp;
+};
+
+// QuickHull.h
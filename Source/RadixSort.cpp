@@ -0,0 +1,139 @@
+// RadixSort.cpp
+
+#include "RadixSort.h"
+#include "ThreadPool.h"
+#include <algorithm>
+
+using namespace _3DMath;
+
+template< typename Key >
+static void RadixSortKeys( std::vector< Key >& keyArray, ThreadPool* threadPool )
+{
+	int keyCount = ( int )keyArray.size();
+	if( keyCount < 2 )
+		return;
+
+	// Small arrays aren't worth the fixed cost of the histograms.
+	if( keyCount < 256 )
+	{
+		std::sort( keyArray.begin(), keyArray.end() );
+		return;
+	}
+
+	// Each chunk of the keys gets its own histogram, so that chunks may be counted and scattered
+	// independently.  Offsets are assigned to chunks in order, which keeps every pass stable.
+	int chunkCount = 1;
+	if( threadPool )
+		chunkCount = MIN( threadPool->GetThreadCount(), MAX( keyCount / 16384, 1 ) );
+
+	int chunkSize = ( keyCount + chunkCount - 1 ) / chunkCount;
+
+	std::vector< Key > scratchArray( keyCount );
+	std::vector< int > histogramArray( chunkCount * 256 );
+
+	Key* sourceKeys = keyArray.data();
+	Key* targetKeys = scratchArray.data();
+
+	// Bits on which every key agrees with the first key need no pass.
+	std::vector< Key > differenceArray( chunkCount, 0 );
+	Key firstKey = sourceKeys[0];
+	auto differenceFunction = [ & ]( int begin, int end )
+	{
+		for( int chunk = begin; chunk < end; chunk++ )
+		{
+			Key difference = 0;
+			int keyEnd = MIN( ( chunk + 1 ) * chunkSize, keyCount );
+			for( int i = chunk * chunkSize; i < keyEnd; i++ )
+				difference |= sourceKeys[i] ^ firstKey;
+			differenceArray[ chunk ] = difference;
+		}
+	};
+
+	if( threadPool )
+		threadPool->ParallelFor( chunkCount, 1, differenceFunction );
+	else
+		differenceFunction( 0, chunkCount );
+
+	Key difference = 0;
+	for( int chunk = 0; chunk < chunkCount; chunk++ )
+		difference |= differenceArray[ chunk ];
+
+	for( int shift = 0; shift < ( signed )sizeof( Key ) * 8; shift += 8 )
+	{
+		if( ( ( difference >> shift ) & 0xFF ) == 0 )
+			continue;
+
+		auto countFunction = [ & ]( int begin, int end )
+		{
+			for( int chunk = begin; chunk < end; chunk++ )
+			{
+				int* histogram = &histogramArray[ chunk * 256 ];
+				for( int i = 0; i < 256; i++ )
+					histogram[i] = 0;
+
+				int keyEnd = MIN( ( chunk + 1 ) * chunkSize, keyCount );
+				for( int i = chunk * chunkSize; i < keyEnd; i++ )
+					histogram[ ( sourceKeys[i] >> shift ) & 0xFF ]++;
+			}
+		};
+
+		if( threadPool )
+			threadPool->ParallelFor( chunkCount, 1, countFunction );
+		else
+			countFunction( 0, chunkCount );
+
+		int offset = 0;
+		for( int digit = 0; digit < 256; digit++ )
+		{
+			for( int chunk = 0; chunk < chunkCount; chunk++ )
+			{
+				int& count = histogramArray[ chunk * 256 + digit ];
+				int chunkOffset = offset;
+				offset += count;
+				count = chunkOffset;
+			}
+		}
+
+		auto scatterFunction = [ & ]( int begin, int end )
+		{
+			for( int chunk = begin; chunk < end; chunk++ )
+			{
+				int* histogram = &histogramArray[ chunk * 256 ];
+				int keyEnd = MIN( ( chunk + 1 ) * chunkSize, keyCount );
+				for( int i = chunk * chunkSize; i < keyEnd; i++ )
+				{
+					Key key = sourceKeys[i];
+					targetKeys[ histogram[ ( key >> shift ) & 0xFF ]++ ] = key;
+				}
+			}
+		};
+
+		if( threadPool )
+			threadPool->ParallelFor( chunkCount, 1, scatterFunction );
+		else
+			scatterFunction( 0, chunkCount );
+
+		std::swap( sourceKeys, targetKeys );
+	}
+
+	if( sourceKeys != keyArray.data() )
+		keyArray.swap( scratchArray );
+}
+
+void _3DMath::RadixSort( std::vector< uint64_t >& keyArray, ThreadPool* threadPool /*= nullptr*/ )
+{
+	RadixSortKeys( keyArray, threadPool );
+}
+
+void _3DMath::RadixSort( std::vector< uint32_t >& keyArray, ThreadPool* threadPool /*= nullptr*/ )
+{
+	RadixSortKeys( keyArray, threadPool );
+}
+
+void _3DMath::RadixSortUnique( std::vector< uint64_t >& keyArray, ThreadPool* threadPool /*= nullptr*/ )
+{
+	RadixSortKeys( keyArray, threadPool );
+	keyArray.erase( std::unique( keyArray.begin(), keyArray.end() ), keyArray.end() );
+}
+
+// RadixSort.cpp
@@ -0,0 +1,22 @@
+// RadixSort.h
+
+#pragma once
+
+#include "Defines.h"
+
+namespace _3DMath
+{
+	class ThreadPool;
+
+	// These sort unsigned integer keys in ascending order with a least-significant-digit radix sort,
+	// eight bits at a time.  Passes over digits on which all keys agree are skipped, so keys spanning
+	// only a few low-order bytes, such as packed vertex index pairs, sort in proportionately few passes.
+	// Given a thread pool, each pass histograms and scatters disjoint chunks of the keys in parallel.
+	_3DMATH_API void RadixSort( std::vector< uint64_t >& keyArray, ThreadPool* threadPool = nullptr );
+	_3DMATH_API void RadixSort( std::vector< uint32_t >& keyArray, ThreadPool* threadPool = nullptr );
+
+	// This sorts the keys and then removes duplicates.
+	_3DMATH_API void RadixSortUnique( std::vector< uint64_t >& keyArray, ThreadPool* threadPool = nullptr );
+}
+
+// RadixSort.h
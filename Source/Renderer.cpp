@@ -21,12 +21,12 @@ using namespace _3DMath;
 Renderer::Renderer( void )
 {
 	drawStyle = DRAW_STYLE_SOLID;
-	cachedEdgeSet = new TriangleMesh::EdgeSet;
+	cachedEdgeArray = new TriangleMesh::EdgeArray;
 }
 
 /*virtual*/ Renderer::~Renderer( void )
 {
-	delete cachedEdgeSet;
+	delete cachedEdgeArray;
 }
 
 void Renderer::DrawVector( const Vector& vector, const Vector& position, const Vector& color, double alpha /*= 1.0*/, double arrowRadius /*= 1.0*/, int arrowSegments /*= 8*/ )
@@ -322,8 +322,8 @@ void Renderer::DrawTriangleMesh( const TriangleMesh& triangleMesh, int drawFlags
 
 			BeginDrawMode( DRAW_MODE_TRIANGLES );
 
-			IndexTriangleList::iterator iter = triangleMesh.triangleList->begin();
-			while( iter != triangleMesh.triangleList->end() )
+			IndexTriangleArray::const_iterator iter = triangleMesh.triangleArray->cbegin();
+			while( iter != triangleMesh.triangleArray->cend() )
 			{
 				const IndexTriangle& triangle = *iter;
 				
@@ -356,12 +356,12 @@ void Renderer::DrawTriangleMesh( const TriangleMesh& triangleMesh, int drawFlags
 		}
 		case DRAW_STYLE_WIRE_FRAME:
 		{
-			if( cachedEdgeSet->size() == 0 )
-				triangleMesh.GenerateEdgeSet( *cachedEdgeSet );
+			if( cachedEdgeArray->size() == 0 )
+				triangleMesh.GenerateEdgeArray( *cachedEdgeArray );
 
 			BeginDrawMode( DRAW_MODE_LINES );
 			
-			for( TriangleMesh::EdgeSet::iterator iter = cachedEdgeSet->begin(); iter != cachedEdgeSet->end(); iter++ )
+			for( TriangleMesh::EdgeArray::const_iterator iter = cachedEdgeArray->cbegin(); iter != cachedEdgeArray->cend(); iter++ )
 			{
 				uint64_t edgePair = *iter;
 
@@ -398,8 +398,8 @@ void Renderer::DrawTriangleMesh( const TriangleMesh& triangleMesh, int drawFlags
 
 	if( drawFlags & DRAW_NORMALS )
 	{
-		IndexTriangleList::iterator iter = triangleMesh.triangleList->begin();
-		while( iter != triangleMesh.triangleList->end() )
+		IndexTriangleArray::const_iterator iter = triangleMesh.triangleArray->cbegin();
+		while( iter != triangleMesh.triangleArray->cend() )
 		{
 			const IndexTriangle& indexTriangle = *iter;
 
@@ -437,6 +437,47 @@ void Renderer::DrawParticleSystem( const ParticleSystem& particleSystem, int dra
 
 void Renderer::DrawBoundingBoxTree( const BoundingBoxTree& boxTree, int drawFlags/*= DRAW_BOXES*/ )
 {
+	if( boxTree.IsCompiled() )
+	{
+		for( int i = 0; i < boxTree.GetFlatNodeCount(); i++ )
+		{
+			const BoundingBoxTree::FlatNode& flatNode = boxTree.GetFlatNodes()[i];
+			if( !flatNode.IsLeaf() )
+				continue;
+
+			if( drawFlags & DRAW_BOXES )
+			{
+				AxisAlignedBox box( Vector( flatNode.min[0], flatNode.min[1], flatNode.min[2] ), Vector( flatNode.max[0], flatNode.max[1], flatNode.max[2] ) );
+				box.Render( *this );
+			}
+
+			if( drawFlags & DRAW_TRIANGLES )
+			{
+				Vector color;
+				random.VectorInInterval( 0.5, 1.0, color );
+				Color( color );
+
+				BeginDrawMode( DRAW_MODE_TRIANGLES );
+
+				for( int j = flatNode.offset; j < flatNode.offset + flatNode.count; j++ )
+				{
+					Vector vertex[3];
+					boxTree.GetRecordVertices( j, vertex );
+
+					for( int k = 0; k < 3; k++ )
+						IssueVertex( Vertex( vertex[k] ) );
+				}
+
+				EndDrawMode();
+			}
+		}
+
+		return;
+	}
+
+	if( !boxTree.rootNode )
+		return;
+
 	typedef std::list< const BoundingBoxTree::Node* > NodeList;
 
 	NodeList nodeQueue;
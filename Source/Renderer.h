@@ -103,7 +103,7 @@ public:
 
 	void CorrectUV( double texCoordAnchor, double& texCoord );
 
-	std::set< uint64_t >* cachedEdgeSet;
+	std::vector< uint64_t >* cachedEdgeArray;
 	Random random;
 };
 
@@ -0,0 +1,168 @@
+// SpatialHash.cpp
+
+#include "SpatialHash.h"
+
+using namespace _3DMath;
+
+SpatialHash::SpatialHash( double cellSize /*= EPSILON*/ )
+{
+	this->cellSize = ( cellSize > 0.0 ) ? cellSize : EPSILON;
+	entryArray = new EntryArray();
+	bucketArray = new std::vector< int >();
+}
+
+/*virtual*/ SpatialHash::~SpatialHash( void )
+{
+	delete entryArray;
+	delete bucketArray;
+}
+
+void SpatialHash::Clear( void )
+{
+	entryArray->clear();
+	bucketArray->clear();
+}
+
+void SpatialHash::SetCellSize( double cellSize )
+{
+	Clear();
+
+	this->cellSize = ( cellSize > 0.0 ) ? cellSize : EPSILON;
+}
+
+double SpatialHash::GetCellSize( void ) const
+{
+	return cellSize;
+}
+
+int SpatialHash::GetEntryCount( void ) const
+{
+	return ( int )entryArray->size();
+}
+
+void SpatialHash::Reserve( int entryCount )
+{
+	entryArray->reserve( entryCount );
+
+	if( entryCount > ( signed )bucketArray->size() )
+		Rehash( entryCount );
+}
+
+int64_t SpatialHash::GetCell( double coordinate ) const
+{
+	return ( int64_t )floor( coordinate / cellSize );
+}
+
+int SpatialHash::GetBucket( int64_t i, int64_t j, int64_t k ) const
+{
+	// These are the primes from the classic Teschner et al. spatial hashing paper.  Cell
+	// coordinates often share low-order zero bits, so we finish with a bit mixer to make
+	// sure every bit of the hash influences the bucket we pick.
+	uint64_t hash = ( uint64_t( i ) * 73856093ULL ) ^ ( uint64_t( j ) * 19349663ULL ) ^ ( uint64_t( k ) * 83492791ULL );
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	return int( hash & uint64_t( bucketArray->size() - 1 ) );
+}
+
+void SpatialHash::Rehash( int bucketCount )
+{
+	int powerOfTwo = 16;
+	while( powerOfTwo < bucketCount )
+		powerOfTwo <<= 1;
+
+	bucketArray->assign( powerOfTwo, -1 );
+
+	for( int i = 0; i < ( signed )entryArray->size(); i++ )
+	{
+		Entry& entry = ( *entryArray )[i];
+
+		int bucket = GetBucket( GetCell( entry.x ), GetCell( entry.y ), GetCell( entry.z ) );
+		entry.next = ( *bucketArray )[ bucket ];
+		( *bucketArray )[ bucket ] = i;
+	}
+}
+
+void SpatialHash::Insert( const Vector& position, int index )
+{
+	// Keep the load factor at or below one so that chains stay short.
+	if( entryArray->size() >= bucketArray->size() )
+		Rehash( 2 * ( int )entryArray->size() );
+
+	int bucket = GetBucket( GetCell( position.x ), GetCell( position.y ), GetCell( position.z ) );
+
+	Entry entry;
+	entry.x = position.x;
+	entry.y = position.y;
+	entry.z = position.z;
+	entry.index = index;
+	entry.next = ( *bucketArray )[ bucket ];
+	entryArray->push_back( entry );
+
+	( *bucketArray )[ bucket ] = ( int )entryArray->size() - 1;
+}
+
+int SpatialHash::FindIndex( const Vector& position, double eps /*= EPSILON*/ ) const
+{
+	if( entryArray->size() == 0 )
+		return -1;
+
+	double epsSquared = eps * eps;
+	int foundIndex = -1;
+
+	// When the distance is large next to the cells, there are more cells to visit than entries to check, so we just check every entry.
+	double coordinate[3] = { position.x, position.y, position.z };
+	double cellCount = 1.0;
+	for( int i = 0; i < 3; i++ )
+		cellCount *= floor( ( coordinate[i] + eps ) / cellSize ) - floor( ( coordinate[i] - eps ) / cellSize ) + 1.0;
+
+	if( !( cellCount <= double( entryArray->size() ) ) )
+	{
+		for( int e = 0; e < ( signed )entryArray->size(); e++ )
+		{
+			const Entry& entry = ( *entryArray )[e];
+			if( foundIndex >= 0 && entry.index >= foundIndex )
+				continue;
+
+			double dx = entry.x - position.x;
+			double dy = entry.y - position.y;
+			double dz = entry.z - position.z;
+			if( dx * dx + dy * dy + dz * dz < epsSquared )
+				foundIndex = entry.index;
+		}
+
+		return foundIndex;
+	}
+
+	// Any point within the given distance must live in a cell overlapping the box of that radius about the given point.
+	int64_t minCell[3] = { GetCell( position.x - eps ), GetCell( position.y - eps ), GetCell( position.z - eps ) };
+	int64_t maxCell[3] = { GetCell( position.x + eps ), GetCell( position.y + eps ), GetCell( position.z + eps ) };
+
+	for( int64_t i = minCell[0]; i <= maxCell[0]; i++ )
+	{
+		for( int64_t j = minCell[1]; j <= maxCell[1]; j++ )
+		{
+			for( int64_t k = minCell[2]; k <= maxCell[2]; k++ )
+			{
+				int bucket = GetBucket( i, j, k );
+
+				for( int e = ( *bucketArray )[ bucket ]; e >= 0; e = ( *entryArray )[e].next )
+				{
+					const Entry& entry = ( *entryArray )[e];
+					if( foundIndex >= 0 && entry.index >= foundIndex )
+						continue;
+
+					double dx = entry.x - position.x;
+					double dy = entry.y - position.y;
+					double dz = entry.z - position.z;
+					if( dx * dx + dy * dy + dz * dz < epsSquared )
+						foundIndex = entry.index;
+				}
+			}
+		}
+	}
+
+	return foundIndex;
+}
+
+// SpatialHash.cpp
@@ -0,0 +1,57 @@
+// SpatialHash.h
+
+#pragma once
+
+#include "Defines.h"
+#include "Vector.h"
+
+namespace _3DMath
+{
+	class SpatialHash;
+}
+
+// This buckets points into a uniform grid of cubical cells so that we can find
+// all previously inserted points near a given point by visiting only the cells
+// in its neighborhood.  Cells are hashed into a flat bucket table, and entries
+// sharing a bucket are chained together through an index, so that inserting a
+// point never costs us a heap allocation beyond the occasional table growth.
+class _3DMATH_API _3DMath::SpatialHash
+{
+public:
+
+	SpatialHash( double cellSize = EPSILON );
+	virtual ~SpatialHash( void );
+
+	void Clear( void );
+	void SetCellSize( double cellSize );
+	double GetCellSize( void ) const;
+	int GetEntryCount( void ) const;
+	void Reserve( int entryCount );
+
+	void Insert( const Vector& position, int index );
+
+	// Of all inserted points strictly within the given distance of the given position,
+	// this returns the smallest index associated with one of them, or -1 if there are none.
+	int FindIndex( const Vector& position, double eps = EPSILON ) const;
+
+	struct Entry
+	{
+		double x, y, z;
+		int index;
+		int next;
+	};
+
+	typedef std::vector< Entry > EntryArray;
+
+private:
+
+	int64_t GetCell( double coordinate ) const;
+	int GetBucket( int64_t i, int64_t j, int64_t k ) const;
+	void Rehash( int bucketCount );
+
+	double cellSize;
+	EntryArray* entryArray;
+	std::vector< int >* bucketArray;
+};
+
+// SpatialHash.h
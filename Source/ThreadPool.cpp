@@ -0,0 +1,306 @@
+// ThreadPool.cpp
+
+#include "ThreadPool.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+
+using namespace _3DMath;
+
+static thread_local bool insideParallelFor = false;
+static thread_local const ThreadPool* taskPool = nullptr;
+static thread_local int taskQueueIndex = 0;
+
+struct ThreadPool::TaskQueue
+{
+	std::mutex mutex;
+	std::deque< Task > taskDeque;
+};
+
+struct ThreadPool::State
+{
+	std::vector< std::thread > threadArray;
+	std::vector< TaskQueue* > taskQueueArray;
+	std::mutex jobMutex;
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	const RangeFunction* rangeFunction;
+	int count;
+	int grainSize;
+	std::atomic< int > nextBegin;
+	std::atomic< int > pendingTaskCount;
+	std::atomic< int > queuedTaskCount;
+	std::atomic< int > idleTaskThreadCount;
+	std::mutex taskMutex;
+	std::condition_variable taskCondition;
+	bool runningTasks;
+	int activeWorkerCount;
+	int generation;
+	bool quit;
+};
+
+
+ThreadPool::ThreadPool( int threadCount /*= 0*/ )
+{
+	if( threadCount <= 0 )
+		threadCount = ( int )std::thread::hardware_concurrency();
+
+	if( threadCount <= 0 )
+		threadCount = 1;
+
+	state = new State();
+	state->rangeFunction = nullptr;
+	state->count = 0;
+	state->grainSize = 1;
+	state->nextBegin = 0;
+	state->pendingTaskCount = 0;
+	state->queuedTaskCount = 0;
+	state->idleTaskThreadCount = 0;
+	state->runningTasks = false;
+	state->activeWorkerCount = 0;
+	state->generation = 0;
+	state->quit = false;
+
+	for( int i = 0; i < threadCount; i++ )
+		state->taskQueueArray.push_back( new TaskQueue() );
+
+	for( int i = 1; i < threadCount; i++ )
+		state->threadArray.push_back( std::thread( &ThreadPool::WorkerMain, this, i ) );
+}
+
+/*virtual*/ ThreadPool::~ThreadPool( void )
+{
+	{
+		std::lock_guard< std::mutex > lock( state->mutex );
+		state->quit = true;
+	}
+
+	state->wakeCondition.notify_all();
+
+	for( int i = 0; i < ( signed )state->threadArray.size(); i++ )
+		state->threadArray[i].join();
+
+	for( int i = 0; i < ( signed )state->taskQueueArray.size(); i++ )
+		delete state->taskQueueArray[i];
+
+	delete state;
+}
+
+int ThreadPool::GetThreadCount( void ) const
+{
+	return ( int )state->threadArray.size() + 1;
+}
+
+void ThreadPool::ParallelFor( int count, int grainSize, const RangeFunction& rangeFunction )
+{
+	if( count <= 0 )
+		return;
+
+	if( grainSize < 1 )
+		grainSize = 1;
+
+	if( state->threadArray.size() == 0 || count <= grainSize || insideParallelFor )
+	{
+		for( int begin = 0; begin < count; begin += grainSize )
+			rangeFunction( begin, MIN( begin + grainSize, count ) );
+		return;
+	}
+
+	// Only one loop runs on the pool at a time; other threads wanting it must wait their turn.
+	std::lock_guard< std::mutex > jobLock( state->jobMutex );
+
+	{
+		std::lock_guard< std::mutex > lock( state->mutex );
+		state->rangeFunction = &rangeFunction;
+		state->count = count;
+		state->grainSize = grainSize;
+		state->nextBegin = 0;
+		state->runningTasks = false;
+		state->activeWorkerCount = ( int )state->threadArray.size();
+		state->generation++;
+	}
+
+	state->wakeCondition.notify_all();
+
+	insideParallelFor = true;
+	RunJob(0);
+	insideParallelFor = false;
+
+	std::unique_lock< std::mutex > lock( state->mutex );
+	state->doneCondition.wait( lock, [ this ]() { return state->activeWorkerCount == 0; } );
+	state->rangeFunction = nullptr;
+}
+
+void ThreadPool::RunTasks( const Task& task )
+{
+	if( state->threadArray.size() == 0 || insideParallelFor )
+	{
+		// Tasks spawned from here must run on the spot too, or we'd return before they had.
+		const ThreadPool* outerTaskPool = taskPool;
+		taskPool = nullptr;
+		task();
+		taskPool = outerTaskPool;
+		return;
+	}
+
+	std::lock_guard< std::mutex > jobLock( state->jobMutex );
+
+	state->pendingTaskCount = 1;
+	state->queuedTaskCount = 1;
+	state->taskQueueArray[0]->taskDeque.push_back( task );
+
+	{
+		std::lock_guard< std::mutex > lock( state->mutex );
+		state->runningTasks = true;
+		state->activeWorkerCount = ( int )state->threadArray.size();
+		state->generation++;
+	}
+
+	state->wakeCondition.notify_all();
+
+	insideParallelFor = true;
+	RunJob(0);
+	insideParallelFor = false;
+
+	std::unique_lock< std::mutex > lock( state->mutex );
+	state->doneCondition.wait( lock, [ this ]() { return state->activeWorkerCount == 0; } );
+	state->runningTasks = false;
+}
+
+void ThreadPool::SpawnTask( const Task& task )
+{
+	if( taskPool != this )
+	{
+		task();
+		return;
+	}
+
+	state->pendingTaskCount++;
+
+	{
+		TaskQueue* taskQueue = state->taskQueueArray[ taskQueueIndex ];
+		std::lock_guard< std::mutex > lock( taskQueue->mutex );
+		taskQueue->taskDeque.push_back( task );
+	}
+
+	// A thread counts itself idle before it last looks for a task, so either it sees this one, or we see it and wake it.
+	// Taking its lock, if only for a moment, makes sure it's already waiting when we do.
+	state->queuedTaskCount++;
+	if( state->idleTaskThreadCount > 0 )
+	{
+		{
+			std::lock_guard< std::mutex > lock( state->taskMutex );
+		}
+
+		state->taskCondition.notify_one();
+	}
+}
+
+void ThreadPool::RunTaskLoop( int threadIndex )
+{
+	taskPool = this;
+	taskQueueIndex = threadIndex;
+
+	int threadCount = ( int )state->taskQueueArray.size();
+
+	// A task is only counted as done once it has returned, and so after any tasks it spawned were queued.
+	while( state->pendingTaskCount > 0 )
+	{
+		Task task;
+
+		for( int i = 0; i < threadCount && !task; i++ )
+		{
+			TaskQueue* taskQueue = state->taskQueueArray[ ( threadIndex + i ) % threadCount ];
+			std::lock_guard< std::mutex > lock( taskQueue->mutex );
+			if( taskQueue->taskDeque.size() == 0 )
+				continue;
+
+			if( i == 0 )
+			{
+				task = taskQueue->taskDeque.back();
+				taskQueue->taskDeque.pop_back();
+			}
+			else
+			{
+				task = taskQueue->taskDeque.front();
+				taskQueue->taskDeque.pop_front();
+			}
+
+			state->queuedTaskCount--;
+		}
+
+		// With nothing to take, a thread sleeps until another spawns a task, or the last of them finishes.
+		if( !task )
+		{
+			std::unique_lock< std::mutex > lock( state->taskMutex );
+			state->idleTaskThreadCount++;
+			state->taskCondition.wait( lock, [ this ]() { return state->queuedTaskCount > 0 || state->pendingTaskCount == 0; } );
+			state->idleTaskThreadCount--;
+			continue;
+		}
+
+		task();
+
+		if( --state->pendingTaskCount == 0 )
+		{
+			{
+				std::lock_guard< std::mutex > lock( state->taskMutex );
+			}
+
+			state->taskCondition.notify_all();
+		}
+	}
+
+	taskPool = nullptr;
+}
+
+void ThreadPool::RunJob( int threadIndex )
+{
+	if( state->runningTasks )
+	{
+		RunTaskLoop( threadIndex );
+		return;
+	}
+
+	// Ranges are handed out first-come, first-served, so faster threads simply take more of them.
+	while( true )
+	{
+		int begin = state->nextBegin.fetch_add( state->grainSize );
+		if( begin >= state->count )
+			break;
+
+		( *state->rangeFunction )( begin, MIN( begin + state->grainSize, state->count ) );
+	}
+}
+
+void ThreadPool::WorkerMain( int threadIndex )
+{
+	insideParallelFor = true;
+
+	int generation = 0;
+
+	while( true )
+	{
+		{
+			std::unique_lock< std::mutex > lock( state->mutex );
+			state->wakeCondition.wait( lock, [ & ]() { return state->quit || state->generation != generation; } );
+			if( state->quit )
+				return;
+
+			generation = state->generation;
+		}
+
+		RunJob( threadIndex );
+
+		{
+			std::lock_guard< std::mutex > lock( state->mutex );
+			if( --state->activeWorkerCount == 0 )
+				state->doneCondition.notify_one();
+		}
+	}
+}
+
+// ThreadPool.cpp
@@ -0,0 +1,54 @@
+// ThreadPool.h
+
+#pragma once
+
+#include "Defines.h"
+#include <functional>
+
+namespace _3DMath
+{
+	class ThreadPool;
+}
+
+// This is a fixed set of worker threads for data-parallel loops.  Algorithms that can make
+// use of it take an optional thread pool pointer; given none, they simply run serially on the
+// calling thread.  The calling thread takes part in the work, so a pool of N threads starts
+// N-1 workers.  A parallel loop issued from within another one runs serially, so it is safe
+// for parallel algorithms to call one another.
+class _3DMATH_API _3DMath::ThreadPool
+{
+public:
+
+	ThreadPool( int threadCount = 0 );		// Zero means one thread per hardware thread.
+	virtual ~ThreadPool( void );
+
+	int GetThreadCount( void ) const;
+
+	typedef std::function< void( int begin, int end ) > RangeFunction;
+
+	// This calls the given function on disjoint sub-ranges covering [0,count), each no
+	// longer than the given grain size, and returns once all of them have been processed.
+	void ParallelFor( int count, int grainSize, const RangeFunction& rangeFunction );
+
+	typedef std::function< void( void ) > Task;
+
+	// This runs the given task, and every task spawned while it runs, and returns once all of them have finished.
+	// This suits divide-and-conquer work of uneven sizes.  Each thread keeps its own queue of the tasks it spawns and
+	// works from the newest end of it, and a thread with nothing to do steals the oldest task from another's queue, or
+	// sleeps until a task is spawned.  A task spawned outside of a RunTasks call, or within a serial one, is simply run on the spot.
+	void RunTasks( const Task& task );
+	void SpawnTask( const Task& task );
+
+private:
+
+	struct State;
+	struct TaskQueue;
+
+	void WorkerMain( int threadIndex );
+	void RunJob( int threadIndex );
+	void RunTaskLoop( int threadIndex );
+
+	State* state;
+};
+
+// ThreadPool.h
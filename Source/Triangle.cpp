@@ -3,7 +3,6 @@
 #include "Triangle.h"
 #include "LineSegment.h"
 #include "Plane.h"
-#include "Line.h"
 
 using namespace _3DMath;
 
@@ -114,6 +113,318 @@ bool Triangle::Intersect( const LineSegment& lineSegment, Vector& intersectionPo
 	return ContainsPoint( intersectionPoint, eps );
 }
 
+// This is Moller's test.  Each triangle must reach both sides of the other's plane, or touch it, and if so, each crosses
+// the line where the planes meet in a segment, and the triangles intersect just when those segments overlap.
+bool Triangle::Intersect( const Triangle& triangle, double eps /*= EPSILON*/ ) const
+{
+	// A triangle with next to no area has no plane to speak of, and would fool the test below, so we take it as a segment instead.
+	Vector segment[2][2];
+	bool degenerate = GetDegenerateSegment( segment[0][0], segment[0][1], eps );
+	bool otherDegenerate = triangle.GetDegenerateSegment( segment[1][0], segment[1][1], eps );
+
+	if( degenerate && otherDegenerate )
+		return( SquareDistanceBetweenSegments( segment[0][0], segment[0][1], segment[1][0], segment[1][1] ) <= eps * eps );
+	if( degenerate )
+		return triangle.IntersectSegment( segment[0][0], segment[0][1], eps );
+	if( otherDegenerate )
+		return IntersectSegment( segment[1][0], segment[1][1], eps );
+
+	const Triangle* triangles[2] = { this, &triangle };
+	Vector normal[2];
+	double distance[2][3];
+
+	for( int i = 0; i < 2; i++ )
+	{
+		const Triangle* other = triangles[ 1 - i ];
+		Vector edgeA, edgeB;
+		edgeA.Subtract( other->vertex[1], other->vertex[0] );
+		edgeB.Subtract( other->vertex[2], other->vertex[0] );
+		normal[ 1 - i ].Cross( edgeA, edgeB );
+
+		// These are the distances from the other triangle's plane scaled by the length of its normal, so we scale the tolerance the same.
+		double tolerance = eps * normal[ 1 - i ].Length();
+
+		for( int j = 0; j < 3; j++ )
+		{
+			Vector vector;
+			vector.Subtract( triangles[i]->vertex[j], other->vertex[0] );
+			distance[i][j] = normal[ 1 - i ].Dot( vector );
+			if( fabs( distance[i][j] ) < tolerance )
+				distance[i][j] = 0.0;
+		}
+
+		if( ( distance[i][0] > 0.0 && distance[i][1] > 0.0 && distance[i][2] > 0.0 ) ||
+			( distance[i][0] < 0.0 && distance[i][1] < 0.0 && distance[i][2] < 0.0 ) )
+		{
+			return false;
+		}
+	}
+
+	if( distance[0][0] == 0.0 && distance[0][1] == 0.0 && distance[0][2] == 0.0 )
+		return IntersectCoplanar( triangle, normal[1] );
+
+	// Projecting onto the coordinate axis most nearly along the line where the planes meet orders points on it just as well.
+	Vector direction;
+	direction.Cross( normal[0], normal[1] );
+
+	int axis = 0;
+	if( fabs( direction.y ) > fabs( direction.x ) )
+		axis = 1;
+	if( fabs( direction.z ) > fabs( axis == 0 ? direction.x : direction.y ) )
+		axis = 2;
+
+	double min[2], max[2];
+	for( int i = 0; i < 2; i++ )
+	{
+		double projection[3];
+		for( int j = 0; j < 3; j++ )
+			projection[j] = ( axis == 0 ) ? triangles[i]->vertex[j].x : ( ( axis == 1 ) ? triangles[i]->vertex[j].y : triangles[i]->vertex[j].z );
+
+		GetInterval( projection, distance[i], min[i], max[i] );
+	}
+
+	return( min[0] <= max[1] && min[1] <= max[0] );
+}
+
+// This finds where along the line a triangle crosses it, using the one vertex on its own side of the plane, if any, or else one on it.
+/*static*/ void Triangle::GetInterval( const double* projection, const double* distance, double& min, double& max )
+{
+	int i = 0;
+	if( distance[0] * distance[1] > 0.0 )
+		i = 2;
+	else if( distance[0] * distance[2] > 0.0 )
+		i = 1;
+	else if( distance[1] * distance[2] > 0.0 || distance[0] != 0.0 )
+		i = 0;
+	else if( distance[1] != 0.0 )
+		i = 1;
+	else
+		i = 2;
+
+	int j = ( i + 1 ) % 3;
+	int k = ( i + 2 ) % 3;
+
+	// The lone vertex is on the plane if its distance is zero, and then the other two aren't on it, so we never divide by zero.
+	min = projection[i];
+	max = projection[i];
+	if( distance[i] != 0.0 )
+	{
+		min = projection[i] + ( projection[j] - projection[i] ) * distance[i] / ( distance[i] - distance[j] );
+		max = projection[i] + ( projection[k] - projection[i] ) * distance[i] / ( distance[i] - distance[k] );
+	}
+	else if( distance[j] == 0.0 )
+		max = projection[j];
+	else if( distance[k] == 0.0 )
+		max = projection[k];
+
+	if( min > max )
+		std::swap( min, max );
+}
+
+// Triangles in the same plane intersect just when an edge of one crosses an edge of the other, or one lies within the other.
+// We test this in whichever coordinate plane the triangles are least foreshortened in.
+bool Triangle::IntersectCoplanar( const Triangle& triangle, const Vector& normal ) const
+{
+	int axisA = 1, axisB = 2;
+	if( fabs( normal.y ) > fabs( normal.x ) && fabs( normal.y ) >= fabs( normal.z ) )
+		axisA = 0;
+	else if( fabs( normal.z ) > fabs( normal.x ) && fabs( normal.z ) > fabs( normal.y ) )
+	{
+		axisA = 0;
+		axisB = 1;
+	}
+
+	double point[2][3][2];
+	const Triangle* triangles[2] = { this, &triangle };
+	for( int i = 0; i < 2; i++ )
+	{
+		for( int j = 0; j < 3; j++ )
+		{
+			const Vector& vertex = triangles[i]->vertex[j];
+			double coords[3] = { vertex.x, vertex.y, vertex.z };
+			point[i][j][0] = coords[ axisA ];
+			point[i][j][1] = coords[ axisB ];
+		}
+	}
+
+	auto cross = []( const double* origin, const double* a, const double* b ) {
+		return( a[0] - origin[0] ) * ( b[1] - origin[1] ) - ( a[1] - origin[1] ) * ( b[0] - origin[0] );
+	};
+
+	for( int i = 0; i < 3; i++ )
+	{
+		const double* a0 = point[0][i];
+		const double* a1 = point[0][ ( i + 1 ) % 3 ];
+
+		for( int j = 0; j < 3; j++ )
+		{
+			const double* b0 = point[1][j];
+			const double* b1 = point[1][ ( j + 1 ) % 3 ];
+
+			double sideB0 = cross( a0, a1, b0 );
+			double sideB1 = cross( a0, a1, b1 );
+			double sideA0 = cross( b0, b1, a0 );
+			double sideA1 = cross( b0, b1, a1 );
+
+			if( sideB0 * sideB1 <= 0.0 && sideA0 * sideA1 <= 0.0 )
+			{
+				if( sideB0 != 0.0 || sideB1 != 0.0 )
+					return true;
+
+				// The edges are on one line, so they meet only if they overlap along it.
+				int k = ( fabs( a1[0] - a0[0] ) >= fabs( a1[1] - a0[1] ) ) ? 0 : 1;
+				if( MAX( b0[k], b1[k] ) >= MIN( a0[k], a1[k] ) && MIN( b0[k], b1[k] ) <= MAX( a0[k], a1[k] ) )
+					return true;
+			}
+		}
+	}
+
+	// With no edges crossing, either one triangle holds the other, or they're apart, and it's enough to test a vertex of each.
+	for( int i = 0; i < 2; i++ )
+	{
+		const double* vertex = point[ 1 - i ][0];
+		const double ( *corner )[2] = point[i];
+
+		double side0 = cross( corner[0], corner[1], vertex );
+		double side1 = cross( corner[1], corner[2], vertex );
+		double side2 = cross( corner[2], corner[0], vertex );
+
+		if( ( side0 >= 0.0 && side1 >= 0.0 && side2 >= 0.0 ) || ( side0 <= 0.0 && side1 <= 0.0 && side2 <= 0.0 ) )
+			return true;
+	}
+
+	return false;
+}
+
+// A triangle is taken to have no area if it's thinner, across its longest edge, than the given distance times that edge's length.
+// Its vertices then all lie within that distance of its longest edge, which is given as the segment that stands in for it.
+bool Triangle::GetDegenerateSegment( Vector& pointA, Vector& pointB, double eps ) const
+{
+	Vector edgeA, edgeB, normal;
+	edgeA.Subtract( vertex[1], vertex[0] );
+	edgeB.Subtract( vertex[2], vertex[0] );
+	normal.Cross( edgeA, edgeB );
+
+	int longest = 0;
+	double longestSquareLength = 0.0;
+	for( int i = 0; i < 3; i++ )
+	{
+		Vector edge;
+		edge.Subtract( vertex[ ( i + 1 ) % 3 ], vertex[i] );
+		double squareLength = edge.Dot( edge );
+		if( squareLength > longestSquareLength )
+		{
+			longest = i;
+			longestSquareLength = squareLength;
+		}
+	}
+
+	if( normal.Length() > eps * longestSquareLength )
+		return false;
+
+	pointA = vertex[ longest ];
+	pointB = vertex[ ( longest + 1 ) % 3 ];
+	return true;
+}
+
+// The segment comes within the given distance of the triangle just when it crosses the triangle's plane within that distance of
+// the triangle, or one of its ends comes that near the triangle, or one of the triangle's edges comes that near the segment.
+bool Triangle::IntersectSegment( const Vector& pointA, const Vector& pointB, double eps ) const
+{
+	Vector edgeA, edgeB, normal;
+	edgeA.Subtract( vertex[1], vertex[0] );
+	edgeB.Subtract( vertex[2], vertex[0] );
+	normal.Cross( edgeA, edgeB );
+	normal.Normalize();
+
+	Vector vectorA, vectorB;
+	vectorA.Subtract( pointA, vertex[0] );
+	vectorB.Subtract( pointB, vertex[0] );
+	double distanceA = normal.Dot( vectorA );
+	double distanceB = normal.Dot( vectorB );
+
+	if( ( distanceA > eps && distanceB > eps ) || ( distanceA < -eps && distanceB < -eps ) )
+		return false;
+
+	double squareEps = eps * eps;
+	Vector nearestPoint, delta;
+
+	if( distanceA * distanceB <= 0.0 && distanceA != distanceB )
+	{
+		Vector crossingPoint;
+		crossingPoint.Lerp( pointA, pointB, distanceA / ( distanceA - distanceB ) );
+		NearestPoint( crossingPoint, nearestPoint );
+		delta.Subtract( crossingPoint, nearestPoint );
+		if( delta.Dot( delta ) <= squareEps )
+			return true;
+	}
+
+	const Vector* point[2] = { &pointA, &pointB };
+	for( int i = 0; i < 2; i++ )
+	{
+		NearestPoint( *point[i], nearestPoint );
+		delta.Subtract( *point[i], nearestPoint );
+		if( delta.Dot( delta ) <= squareEps )
+			return true;
+	}
+
+	for( int i = 0; i < 3; i++ )
+		if( SquareDistanceBetweenSegments( vertex[i], vertex[ ( i + 1 ) % 3 ], pointA, pointB ) <= squareEps )
+			return true;
+
+	return false;
+}
+
+// This clamps the nearest points of the two lines to the segments, one after the other, and copes with either segment being a point.
+/*static*/ double Triangle::SquareDistanceBetweenSegments( const Vector& pointA, const Vector& pointB, const Vector& pointC, const Vector& pointD )
+{
+	Vector direction[2], offset;
+	direction[0].Subtract( pointB, pointA );
+	direction[1].Subtract( pointD, pointC );
+	offset.Subtract( pointA, pointC );
+
+	double a = direction[0].Dot( direction[0] );
+	double e = direction[1].Dot( direction[1] );
+	double f = direction[1].Dot( offset );
+
+	double s = 0.0, t = 0.0;
+	if( a == 0.0 && e == 0.0 )
+		s = t = 0.0;
+	else if( a == 0.0 )
+		t = MIN( MAX( f / e, 0.0 ), 1.0 );
+	else
+	{
+		double c = direction[0].Dot( offset );
+		if( e == 0.0 )
+			s = MIN( MAX( -c / a, 0.0 ), 1.0 );
+		else
+		{
+			double b = direction[0].Dot( direction[1] );
+			double denominator = a * e - b * b;
+
+			s = ( denominator > 0.0 ) ? MIN( MAX( ( b * f - c * e ) / denominator, 0.0 ), 1.0 ) : 0.0;
+			t = ( b * s + f ) / e;
+
+			if( t < 0.0 )
+			{
+				t = 0.0;
+				s = MIN( MAX( -c / a, 0.0 ), 1.0 );
+			}
+			else if( t > 1.0 )
+			{
+				t = 1.0;
+				s = MIN( MAX( ( b - c ) / a, 0.0 ), 1.0 );
+			}
+		}
+	}
+
+	Vector nearestPoint[2], delta;
+	nearestPoint[0].AddScale( pointA, direction[0], s );
+	nearestPoint[1].AddScale( pointC, direction[1], t );
+	delta.Subtract( nearestPoint[0], nearestPoint[1] );
+	return delta.Dot( delta );
+}
+
 void Triangle::GetEdges( LineSegment* edges ) const
 {
 	for( int i = 0; i < 3; i++ )
@@ -126,36 +437,123 @@ void Triangle::GetEdges( LineSegment* edges ) const
 
 double Triangle::DistanceToPoint( const Vector& point ) const
 {
-	Plane plane;
-	GetPlane( plane );
+	Vector nearestPoint;
+	NearestPoint( point, nearestPoint );
+	return nearestPoint.Distance( point );
+}
 
-	double distance = fabs( plane.Distance( point ) );
-	Vector nearestPoint = point;
-	plane.NearestPoint( nearestPoint );
-	if( ContainsPoint( nearestPoint ) )
-		return distance;
+void Triangle::NearestPoint( const Vector& point, Vector& nearestPoint, Vector* barycentricCoords /*= nullptr*/ ) const
+{
+	double position[3] = { point.x, point.y, point.z };
+	double base[3] = { vertex[0].x, vertex[0].y, vertex[0].z };
+	double edgeA[3] = { vertex[1].x - vertex[0].x, vertex[1].y - vertex[0].y, vertex[1].z - vertex[0].z };
+	double edgeB[3] = { vertex[2].x - vertex[0].x, vertex[2].y - vertex[0].y, vertex[2].z - vertex[0].z };
 
-	LineSegment edges[3];
-	GetEdges( edges );
+	double u, v;
+	NearestPoint( position, base, edgeA, edgeB, u, v );
 
-	for( int i = 0; i < 3; i++ )
+	nearestPoint.Set( base[0] + u * edgeA[0] + v * edgeB[0], base[1] + u * edgeA[1] + v * edgeB[1], base[2] + u * edgeA[2] + v * edgeB[2] );
+
+	if( barycentricCoords )
+		barycentricCoords->Set( 1.0 - u - v, u, v );
+}
+
+// We work out which feature of the triangle, a corner, an edge or the face, is nearest the point from the signs of a few dot
+// products, as in Ericson's "Real-Time Collision Detection," section 5.1.5, and then project the point onto that feature.
+/*static*/ double Triangle::NearestPoint( const double* point, const double* base, const double* edgeA, const double* edgeB, double& u, double& v )
+{
+	double offset[3] = { point[0] - base[0], point[1] - base[1], point[2] - base[2] };
+
+	double aa = edgeA[0] * edgeA[0] + edgeA[1] * edgeA[1] + edgeA[2] * edgeA[2];
+	double ab = edgeA[0] * edgeB[0] + edgeA[1] * edgeB[1] + edgeA[2] * edgeB[2];
+	double bb = edgeB[0] * edgeB[0] + edgeB[1] * edgeB[1] + edgeB[2] * edgeB[2];
+	double pa = offset[0] * edgeA[0] + offset[1] * edgeA[1] + offset[2] * edgeA[2];
+	double pb = offset[0] * edgeB[0] + offset[1] * edgeB[1] + offset[2] * edgeB[2];
+
+	// These are the dot products of the edges with the point's offset from the other two corners.
+	double d1 = pa, d2 = pb;
+	double d3 = pa - aa, d4 = pb - ab;
+	double d5 = pa - ab, d6 = pb - bb;
+
+	double vc = d1 * d4 - d3 * d2;
+	double vb = d5 * d2 - d1 * d6;
+	double va = d3 * d6 - d5 * d4;
+
+	auto squareDistance = [ & ]( double u, double v ) {
+		double delta[3];
+		for( int i = 0; i < 3; i++ )
+			delta[i] = offset[i] - u * edgeA[i] - v * edgeB[i];
+		return delta[0] * delta[0] + delta[1] * delta[1] + delta[2] * delta[2];
+	};
+
+	// This is the square of twice the triangle's area.  A triangle with next to no area has no face to speak of,
+	// so the nearest point is on whichever of its edges is nearest.
+	double det = aa * bb - ab * ab;
+	if( det <= EPSILON * EPSILON * aa * bb )
 	{
-		Line line( edges[i] );
-		distance = line.ShortestDistance( point );
-		if( edges[i].ContainsPoint( point ) )
-			return distance;
-	}
+		double t[3];
+		t[0] = aa > 0.0 ? MIN( MAX( d1 / aa, 0.0 ), 1.0 ) : 0.0;
+		t[1] = bb > 0.0 ? MIN( MAX( d2 / bb, 0.0 ), 1.0 ) : 0.0;
+		t[2] = ( d4 - d3 ) + ( d5 - d6 ) > 0.0 ? MIN( MAX( ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) ), 0.0 ), 1.0 ) : 0.0;
 
-	double smallestDistance = 0.0;
+		double edgeU[3] = { t[0], 0.0, 1.0 - t[2] };
+		double edgeV[3] = { 0.0, t[1], t[2] };
 
-	for( int i = 0; i < 3; i++ )
+		u = edgeU[0];
+		v = edgeV[0];
+		double smallestSquareDistance = squareDistance( u, v );
+		for( int i = 1; i < 3; i++ )
+		{
+			double distance = squareDistance( edgeU[i], edgeV[i] );
+			if( distance < smallestSquareDistance )
+			{
+				smallestSquareDistance = distance;
+				u = edgeU[i];
+				v = edgeV[i];
+			}
+		}
+
+		return smallestSquareDistance;
+	}
+
+	if( d1 <= 0.0 && d2 <= 0.0 )
+	{
+		u = 0.0;
+		v = 0.0;
+	}
+	else if( d3 >= 0.0 && d4 <= d3 )
+	{
+		u = 1.0;
+		v = 0.0;
+	}
+	else if( vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0 )
+	{
+		u = d1 / ( d1 - d3 );
+		v = 0.0;
+	}
+	else if( d6 >= 0.0 && d5 <= d6 )
+	{
+		u = 0.0;
+		v = 1.0;
+	}
+	else if( vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0 )
+	{
+		u = 0.0;
+		v = d2 / ( d2 - d6 );
+	}
+	else if( va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0 )
+	{
+		v = ( d4 - d3 ) / ( ( d4 - d3 ) + ( d5 - d6 ) );
+		u = 1.0 - v;
+	}
+	else
 	{
-		distance = vertex[i].Distance( point );
-		if( distance < smallestDistance || smallestDistance == 0.0 )
-			smallestDistance = distance;
+		double scale = 1.0 / ( va + vb + vc );
+		u = vb * scale;
+		v = vc * scale;
 	}
 
-	return smallestDistance;
+	return squareDistance( u, v );
 }
 
 // Triangle.cpp
\ No newline at end of file
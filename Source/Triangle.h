@@ -29,9 +29,29 @@ public:
 	bool ProperlyContainsPoint( const Vector& point, double eps = EPSILON ) const;
 	bool IsDegenerate( double eps = EPSILON ) const;
 	bool Intersect( const LineSegment& lineSegment, Vector& intersectionPoint, double eps = EPSILON ) const;
+
+	// This tells whether the two triangles touch or cross, counting any vertex within the given distance of the other's plane as on it.
+	// A triangle with next to no area is taken as a segment, and meets the other only if it comes within the given distance of it.
+	bool Intersect( const Triangle& triangle, double eps = EPSILON ) const;
 	double DistanceToPoint( const Vector& point ) const;
 
+	// This finds the point of the triangle nearest the given point.  Its barycentric coordinates, if asked for,
+	// are the weights of the vertices that give the point.
+	void NearestPoint( const Vector& point, Vector& nearestPoint, Vector* barycentricCoords = nullptr ) const;
+
+	// This does the same for a triangle given by a corner and the two edges leaving it, giving the nearest point as the
+	// amounts of each edge to add to the corner, and returning the square of its distance from the given point.
+	static double NearestPoint( const double* point, const double* base, const double* edgeA, const double* edgeB, double& u, double& v );
+
 	Vector vertex[3];
+
+private:
+
+	static void GetInterval( const double* projection, const double* distance, double& min, double& max );
+	bool IntersectCoplanar( const Triangle& triangle, const Vector& normal ) const;
+	bool GetDegenerateSegment( Vector& pointA, Vector& pointB, double eps ) const;
+	bool IntersectSegment( const Vector& pointA, const Vector& pointB, double eps ) const;
+	static double SquareDistanceBetweenSegments( const Vector& pointA, const Vector& pointB, const Vector& pointC, const Vector& pointD );
 };
 
 namespace _3DMath
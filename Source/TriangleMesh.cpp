@@ -7,36 +7,45 @@
 #include "AffineTransform.h"
 #include "Renderer.h"
 #include "AxisAlignedBox.h"
+#include "SpatialHash.h"
+#include "QuickHull.h"
+#include "MeshAdjacency.h"
+#include "ThreadPool.h"
+#include "RadixSort.h"
+#include "MeshSimplifier.h"
 
 using namespace _3DMath;
 
 TriangleMesh::TriangleMesh( void )
 {
 	vertexArray = new VertexArray();
-	triangleList = new IndexTriangleList();
+	triangleArray = new IndexTriangleArray();
+	positionIndex = nullptr;
 }
 
 /*virtual*/ TriangleMesh::~TriangleMesh( void )
 {
 	delete vertexArray;
-	delete triangleList;
+	delete triangleArray;
+	delete positionIndex;
 }
 
 void TriangleMesh::Clear( void )
 {
 	vertexArray->clear();
-	triangleList->clear();
+	triangleArray->clear();
+
+	InvalidatePositionIndex();
 }
 
 void TriangleMesh::Clone( const TriangleMesh& triangleMesh )
 {
 	Clear();
 
-	for( int i = 0; i < ( signed )triangleMesh.vertexArray->size(); i++ )
-		vertexArray->push_back( ( *triangleMesh.vertexArray )[i] );
+	*vertexArray = *triangleMesh.vertexArray;
+	*triangleArray = *triangleMesh.triangleArray;
 
-	for( IndexTriangleList::const_iterator iter = triangleMesh.triangleList->cbegin(); iter != triangleMesh.triangleList->cend(); iter++ )
-		triangleList->push_back( *iter );
+	InvalidatePositionIndex();
 }
 
 bool TriangleMesh::GenerateBoundingBox( AxisAlignedBox& boundingBox ) const
@@ -53,9 +62,43 @@ bool TriangleMesh::GenerateBoundingBox( AxisAlignedBox& boundingBox ) const
 	return true;
 }
 
+// This is the 64-bit FNV-1a hash of the counts, the positions and the triangles' indices, in that order.
+uint64_t TriangleMesh::CalculateContentHash( void ) const
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	auto hashBytes = [ &hash ]( const void* data, size_t size ) {
+		const unsigned char* byte = ( const unsigned char* )data;
+		for( size_t i = 0; i < size; i++ )
+		{
+			hash ^= byte[i];
+			hash *= 0x100000001B3ULL;
+		}
+	};
+
+	uint64_t count[2] = { vertexArray->size(), triangleArray->size() };
+	hashBytes( count, sizeof( count ) );
+
+	for( int i = 0; i < ( signed )vertexArray->size(); i++ )
+	{
+		const Vector& position = ( *vertexArray )[i].position;
+		double coords[3] = { position.x, position.y, position.z };
+		hashBytes( coords, sizeof( coords ) );
+	}
+
+	for( int i = 0; i < ( signed )triangleArray->size(); i++ )
+	{
+		const IndexTriangle& indexTriangle = ( *triangleArray )[i];
+		int32_t vertex[3] = { indexTriangle.vertex[0], indexTriangle.vertex[1], indexTriangle.vertex[2] };
+		hashBytes( vertex, sizeof( vertex ) );
+	}
+
+	return hash;
+}
+
 void TriangleMesh::GenerateTriangleList( TriangleList& triangleList, bool skipDegenerates /*= true*/ ) const
 {
-	for( IndexTriangleList::const_iterator iter = this->triangleList->cbegin(); iter != this->triangleList->cend(); iter++ )
+	for( IndexTriangleArray::const_iterator iter = triangleArray->cbegin(); iter != triangleArray->cend(); iter++ )
 	{
 		const IndexTriangle& indexTriangle = *iter;
 		Triangle triangle;
@@ -68,146 +111,66 @@ void TriangleMesh::GenerateTriangleList( TriangleList& triangleList, bool skipDe
 
 bool TriangleMesh::FindConvexHull( void )
 {
-	if( vertexArray->size() < 4 )
-		return false;
-
-	triangleList->clear();
-
-	VertexArray* newVertexArray = nullptr;
-
-	bool tetrahedronFound = false;
+	triangleArray->clear();
 
-	int i0, i1, i2, i3;
+	QuickHull quickHull;
+	IndexTriangleArray hullTriangleArray;
+	int tetrahedron[4];
 
-	for( i0 = 0; i0 < ( signed )vertexArray->size(); i0++ )
-	{
-		for( i1 = 0; i1 < ( signed )vertexArray->size(); i1++ )
-		{
-			if( i1 == i0 )
-				continue;
-
-			for( i2 = 0; i2 < ( signed )vertexArray->size(); i2++ )
-			{
-				if( i2 == i0 || i2 == i1 )
-					continue;
-
-				for( i3 = 0; i3 < ( signed )vertexArray->size(); i3++ )
-				{
-					if( i3 == i0 || i3 == i1 || i3 == i2 )
-						continue;
-
-					LinearTransform linearTransform;
-
-					linearTransform.xAxis.Subtract( ( *vertexArray )[i1].position, ( *vertexArray )[i0].position );
-					linearTransform.yAxis.Subtract( ( *vertexArray )[i2].position, ( *vertexArray )[i0].position );
-					linearTransform.zAxis.Subtract( ( *vertexArray )[i3].position, ( *vertexArray )[i0].position );
-
-					// In the strictest sense, it need only be greater than zero,
-					// but I want a tetrahedron that is no where near degenerate.
-					double det = linearTransform.Determinant();
-					if( det > EPSILON )
-					{
-						newVertexArray = new VertexArray();
-
-						newVertexArray->push_back( ( *vertexArray )[i0] );
-						newVertexArray->push_back( ( *vertexArray )[i1] );
-						newVertexArray->push_back( ( *vertexArray )[i2] );
-						newVertexArray->push_back( ( *vertexArray )[i3] );
-
-						AddOrRemoveTriangle( IndexTriangle( 0, 1, 3 ) );
-						AddOrRemoveTriangle( IndexTriangle( 0, 3, 2 ) );
-						AddOrRemoveTriangle( IndexTriangle( 0, 2, 1 ) );
-						AddOrRemoveTriangle( IndexTriangle( 1, 2, 3 ) );
-
-						tetrahedronFound = true;
-						break;
-					}
-				}
-
-				if( tetrahedronFound )
-					break;
-			}
-
-			if( tetrahedronFound )
-				break;
-		}
+	if( !quickHull.Generate( *vertexArray, hullTriangleArray, tetrahedron ) )
+		return false;
 
-		if( tetrahedronFound )
-			break;
-	}
+	// We used to grow the hull from a tetrahedron one point at a time, taking points from the
+	// back of the array, and callers may have come to depend on the resulting vertex order, so
+	// we keep it: the tetrahedron comes first, followed by the remaining points in reverse.
+	std::vector< int > newIndexArray( vertexArray->size(), -1 );
+	for( int i = 0; i < 4; i++ )
+		newIndexArray[ tetrahedron[i] ] = i;
 
-	if( !tetrahedronFound )
-		return false;
+	VertexArray* newVertexArray = new VertexArray();
+	newVertexArray->reserve( vertexArray->size() );
 
-	VertexArray pointCloud;
+	for( int i = 0; i < 4; i++ )
+		newVertexArray->push_back( ( *vertexArray )[ tetrahedron[i] ] );
 
-	for( int i = 0; i < ( signed )vertexArray->size(); i++ )
+	for( int i = ( signed )vertexArray->size() - 1; i >= 0; i-- )
 	{
-		if( i == i0 || i == i1 || i == i2 || i == i3 )
+		if( newIndexArray[i] >= 0 )
 			continue;
 
-		pointCloud.push_back( ( *vertexArray )[i] );
+		newIndexArray[i] = ( int )newVertexArray->size();
+		newVertexArray->push_back( ( *vertexArray )[i] );
 	}
 
-	delete vertexArray;
-	vertexArray = nullptr;
+	triangleArray->reserve( hullTriangleArray.size() );
 
-	while( pointCloud.size() > 0 )
+	for( IndexTriangleArray::const_iterator iter = hullTriangleArray.cbegin(); iter != hullTriangleArray.cend(); iter++ )
 	{
-		Vertex point = pointCloud.back();
-		pointCloud.pop_back();
-
-		newVertexArray->push_back( point );
-
-		int index = ( int )newVertexArray->size() - 1;
-
-		bool keepGoing = true;
-		while( keepGoing )
-		{
-			keepGoing = false;
-
-			for( IndexTriangleList::iterator iter = triangleList->begin(); iter != triangleList->end(); iter++ )
-			{
-				IndexTriangle& indexTriangle = *iter;
-
-				if( !indexTriangle.HasVertex( index ) )
-				{
-					Plane plane;
-					indexTriangle.GetPlane( plane, newVertexArray );
-
-					if( plane.GetSide( point.position ) == Plane::SIDE_FRONT )
-					{
-						AddOrRemoveTriangle( IndexTriangle( index, indexTriangle.vertex[0], indexTriangle.vertex[1] ) );
-						AddOrRemoveTriangle( IndexTriangle( index, indexTriangle.vertex[1], indexTriangle.vertex[2] ) );
-						AddOrRemoveTriangle( IndexTriangle( index, indexTriangle.vertex[2], indexTriangle.vertex[0] ) );
-						AddOrRemoveTriangle( indexTriangle );
-
-						keepGoing = true;
-						break;
-					}
-				}
-			}
-		}
+		const IndexTriangle& indexTriangle = *iter;
+		triangleArray->push_back( IndexTriangle( newIndexArray[ indexTriangle.vertex[0] ], newIndexArray[ indexTriangle.vertex[1] ], newIndexArray[ indexTriangle.vertex[2] ] ) );
 	}
 
+	delete vertexArray;
 	vertexArray = newVertexArray;
 
+	InvalidatePositionIndex();
+
 	return true;
 }
 
 void TriangleMesh::AddOrRemoveTriangle( const IndexTriangle& givenIndexTriangle )
 {
-	for( IndexTriangleList::iterator iter = triangleList->begin(); iter != triangleList->end(); iter++ )
+	for( int i = 0; i < ( signed )triangleArray->size(); i++ )
 	{
-		IndexTriangle& indexTriangle = *iter;
+		const IndexTriangle& indexTriangle = ( *triangleArray )[i];
 		if( givenIndexTriangle.CoincidentWith( indexTriangle ) )
 		{
-			triangleList->erase( iter );
+			RemoveTriangle( i );
 			return;
 		}
 	}
 
-	triangleList->push_back( givenIndexTriangle );
+	triangleArray->push_back( givenIndexTriangle );
 }
 
 void TriangleMesh::CalculateCenter( Vector& center ) const
@@ -223,33 +186,109 @@ void TriangleMesh::CalculateCenter( Vector& center ) const
 	}
 }
 
-void TriangleMesh::CalculateNormals( void )
+void TriangleMesh::CalculateNormals( NormalWeighting normalWeighting /*= NORMAL_WEIGHTING_UNIFORM*/, ThreadPool* threadPool /*= nullptr*/ )
 {
-	for( int i = 0; i < ( int )vertexArray->size(); i++ )
-	{
-		Vertex* vertex = &( *vertexArray )[i];
-		vertex->normal.Set( 0.0, 0.0, 0.0 );
-	}
+	int triangleCount = ( int )triangleArray->size();
+	int vertexCount = ( int )vertexArray->size();
 
-	for( IndexTriangleList::iterator iter = triangleList->begin(); iter != triangleList->end(); iter++ )
+	// This finds the weighted normal a triangle contributes at each of its corners.  Degenerate
+	// triangles contribute nothing.  The cross product's length is twice the triangle's area.
+	auto calculateCornerNormals = [ & ]( const IndexTriangle& indexTriangle, Vector* cornerNormal )
 	{
-		IndexTriangle& indexTriangle = *iter;
+		Vector edge[3];
+		for( int i = 0; i < 3; i++ )
+			edge[i].Subtract( ( *vertexArray )[ indexTriangle.vertex[ ( i + 1 ) % 3 ] ].position, ( *vertexArray )[ indexTriangle.vertex[i] ].position );
 
-		Plane plane;
-		indexTriangle.GetPlane( plane, vertexArray );
+		Vector faceNormal;
+		faceNormal.Cross( edge[0], edge[1] );
+		if( normalWeighting != NORMAL_WEIGHTING_AREA && !faceNormal.Normalize() )
+			faceNormal.Set( 0.0, 0.0, 0.0 );
 
 		for( int i = 0; i < 3; i++ )
 		{
-			Vertex* vertex = &( *vertexArray )[ indexTriangle.vertex[i] ];
-			vertex->normal.Add( plane.normal );
+			cornerNormal[i] = faceNormal;
+
+			if( normalWeighting == NORMAL_WEIGHTING_ANGLE )
+			{
+				Vector unitEdgeA, unitEdgeB;
+				double angle = 0.0;
+				if( edge[i].GetNormalized( unitEdgeA ) && edge[ ( i + 2 ) % 3 ].GetNormalized( unitEdgeB ) )
+					angle = acos( MAX( -1.0, MIN( 1.0, -unitEdgeA.Dot( unitEdgeB ) ) ) );
+
+				cornerNormal[i].Scale( angle );
+			}
 		}
-	}
+	};
 
-	for( int i = 0; i < ( int )vertexArray->size(); i++ )
+	auto isValidTriangle = [ & ]( const IndexTriangle& indexTriangle )
 	{
-		Vertex* vertex = &( *vertexArray )[i];
-		vertex->normal.Normalize();
+		return ValidIndex( indexTriangle.vertex[0] ) && ValidIndex( indexTriangle.vertex[1] ) && ValidIndex( indexTriangle.vertex[2] );
+	};
+
+	if( !threadPool )
+	{
+		for( int i = 0; i < vertexCount; i++ )
+			( *vertexArray )[i].normal.Set( 0.0, 0.0, 0.0 );
+
+		for( int i = 0; i < triangleCount; i++ )
+		{
+			const IndexTriangle& indexTriangle = ( *triangleArray )[i];
+			if( !isValidTriangle( indexTriangle ) )
+				continue;
+
+			Vector cornerNormal[3];
+			calculateCornerNormals( indexTriangle, cornerNormal );
+
+			for( int j = 0; j < 3; j++ )
+				( *vertexArray )[ indexTriangle.vertex[j] ].normal.Add( cornerNormal[j] );
+		}
+
+		for( int i = 0; i < vertexCount; i++ )
+			( *vertexArray )[i].normal.Normalize();
+
+		return;
 	}
+
+	// Scattering into the vertices from many threads would have them racing one another, so instead
+	// we list the corners at each vertex, in triangle order, and have each vertex gather its own sum.
+	// This adds up the same terms in the same order as the serial scatter above.
+	std::vector< Vector > cornerNormalArray( 3 * triangleCount );
+	threadPool->ParallelFor( triangleCount, 4096, [ & ]( int begin, int end )
+	{
+		for( int i = begin; i < end; i++ )
+			if( isValidTriangle( ( *triangleArray )[i] ) )
+				calculateCornerNormals( ( *triangleArray )[i], &cornerNormalArray[ 3 * i ] );
+	} );
+
+	std::vector< int > vertexOffsetArray( vertexCount + 1, 0 );
+	for( int i = 0; i < triangleCount; i++ )
+		if( isValidTriangle( ( *triangleArray )[i] ) )
+			for( int j = 0; j < 3; j++ )
+				vertexOffsetArray[ ( *triangleArray )[i].vertex[j] + 1 ]++;
+
+	for( int i = 0; i < vertexCount; i++ )
+		vertexOffsetArray[ i + 1 ] += vertexOffsetArray[i];
+
+	std::vector< int > cornerArray( vertexOffsetArray[ vertexCount ] );
+	std::vector< int > cursorArray( vertexOffsetArray.begin(), vertexOffsetArray.end() - 1 );
+	for( int i = 0; i < triangleCount; i++ )
+		if( isValidTriangle( ( *triangleArray )[i] ) )
+			for( int j = 0; j < 3; j++ )
+				cornerArray[ cursorArray[ ( *triangleArray )[i].vertex[j] ]++ ] = 3 * i + j;
+
+	threadPool->ParallelFor( vertexCount, 4096, [ & ]( int begin, int end )
+	{
+		for( int i = begin; i < end; i++ )
+		{
+			Vector& normal = ( *vertexArray )[i].normal;
+			normal.Set( 0.0, 0.0, 0.0 );
+
+			for( int j = vertexOffsetArray[i]; j < vertexOffsetArray[ i + 1 ]; j++ )
+				normal.Add( cornerNormalArray[ cornerArray[j] ] );
+
+			normal.Normalize();
+		}
+	} );
 }
 
 void TriangleMesh::CalculateSphericalUVs( void )
@@ -273,14 +312,20 @@ void TriangleMesh::CalculateSphericalUVs( void )
 
 void TriangleMesh::SubdivideAllTriangles( double radius )
 {
-	IndexTriangleList::iterator iter = triangleList->begin();
-	while( iter != triangleList->end() )
+	// Every midpoint is looked up three times, so make sure those lookups are not linear.
+	bool temporaryPositionIndex = false;
+	if( !positionIndex )
 	{
-		IndexTriangleList::iterator nextIter = iter;
-		nextIter++;
+		EnablePositionIndex( 8.0 * EPSILON );
+		temporaryPositionIndex = true;
+	}
 
-		IndexTriangle indexTriangle = *iter;
-		triangleList->erase( iter );
+	IndexTriangleArray* subdividedTriangleArray = new IndexTriangleArray();
+	subdividedTriangleArray->reserve( 4 * triangleArray->size() );
+
+	for( IndexTriangleArray::const_iterator iter = triangleArray->cbegin(); iter != triangleArray->cend(); iter++ )
+	{
+		const IndexTriangle& indexTriangle = *iter;
 
 		Triangle triangle;
 		indexTriangle.GetTriangle( triangle, vertexArray );
@@ -297,17 +342,23 @@ void TriangleMesh::SubdivideAllTriangles( double radius )
 			index[i] = FindIndex( point[i], EPSILON, true );
 
 		for( int i = 0; i < 3; i++ )
-			triangleList->push_front( IndexTriangle( indexTriangle.vertex[i], index[i], index[ ( i + 2 ) % 3 ] ) );
-
-		triangleList->push_front( IndexTriangle( index[0], index[1], index[2] ) );
+			subdividedTriangleArray->push_back( IndexTriangle( indexTriangle.vertex[i], index[i], index[ ( i + 2 ) % 3 ] ) );
 
-		iter = nextIter;
+		subdividedTriangleArray->push_back( IndexTriangle( index[0], index[1], index[2] ) );
 	}
+
+	delete triangleArray;
+	triangleArray = subdividedTriangleArray;
+
+	if( temporaryPositionIndex )
+		DisablePositionIndex();
 }
 
 void TriangleMesh::Transform( const AffineTransform& affineTransform )
 {
 	affineTransform.Transform( *vertexArray );
+
+	InvalidatePositionIndex();
 }
 
 bool TriangleMesh::SetVertexPosition( int index, const Vector& position )
@@ -316,6 +367,7 @@ bool TriangleMesh::SetVertexPosition( int index, const Vector& position )
 		return false;
 
 	( *vertexArray )[ index ].position = position;
+	InvalidatePositionIndex();
 	return true;
 }
 
@@ -334,6 +386,7 @@ bool TriangleMesh::SetVertex( int index, const Vertex& vertex )
 		return false;
 
 	( *vertexArray )[ index ] = vertex;
+	InvalidatePositionIndex();
 	return true;
 }
 
@@ -362,13 +415,81 @@ bool TriangleMesh::ValidIndex( int index ) const
 	return true;
 }
 
+int TriangleMesh::GetTriangleCount( void ) const
+{
+	return ( int )triangleArray->size();
+}
+
+void TriangleMesh::AddTriangle( const IndexTriangle& indexTriangle )
+{
+	triangleArray->push_back( indexTriangle );
+}
+
+bool TriangleMesh::RemoveTriangle( int index )
+{
+	if( !ValidTriangleIndex( index ) )
+		return false;
+
+	int lastIndex = ( int )triangleArray->size() - 1;
+	if( index != lastIndex )
+		( *triangleArray )[ index ] = ( *triangleArray )[ lastIndex ];
+
+	triangleArray->pop_back();
+	return true;
+}
+
+bool TriangleMesh::SetTriangle( int index, const IndexTriangle& indexTriangle )
+{
+	if( !ValidTriangleIndex( index ) )
+		return false;
+
+	( *triangleArray )[ index ] = indexTriangle;
+	return true;
+}
+
+bool TriangleMesh::GetTriangle( int index, IndexTriangle& indexTriangle ) const
+{
+	if( !ValidTriangleIndex( index ) )
+		return false;
+
+	indexTriangle = ( *triangleArray )[ index ];
+	return true;
+}
+
+bool TriangleMesh::GetTriangle( int index, const IndexTriangle*& indexTriangle ) const
+{
+	if( !ValidTriangleIndex( index ) )
+		return false;
+
+	indexTriangle = &( *triangleArray )[ index ];
+	return true;
+}
+
+bool TriangleMesh::ValidTriangleIndex( int index ) const
+{
+	if( index < 0 || index >= ( signed )triangleArray->size() )
+		return false;
+	return true;
+}
+
 int TriangleMesh::FindIndex( const Vector& position, double eps /*= EPSILON*/, bool addIfNotFound /*= false*/ ) const
 {
-	for( int i = 0; i < ( signed )vertexArray->size(); i++ )
+	if( positionIndex )
+	{
+		SyncPositionIndex();
+
+		int index = positionIndex->FindIndex( position, eps );
+		if( index >= 0 )
+			return index;
+	}
+	else
 	{
-		const Vertex& vertex = ( *vertexArray )[i];
-		if( vertex.position.IsEqualTo( position, eps ) )
-			return i;
+		for( int i = 0; i < ( signed )vertexArray->size(); i++ )
+		{
+			const Vertex& vertex = ( *vertexArray )[i];
+			if( vertex.position.IsEqualTo( position, eps ) )
+				return i;
+		}
 	}
 
 	if( addIfNotFound )
@@ -376,12 +497,59 @@ int TriangleMesh::FindIndex( const Vector& position, double eps /*= EPSILON*/, b
 		Vertex vertex;
 		vertex.position = position;
 		vertexArray->push_back( vertex );
-		return ( int )vertexArray->size() - 1;
+
+		int index = ( int )vertexArray->size() - 1;
+
+		if( positionIndex )
+			positionIndex->Insert( position, index );
+
+		return index;
 	}
 
 	return -1;
 }
 
+void TriangleMesh::EnablePositionIndex( double cellSize /*= EPSILON*/ )
+{
+	if( !positionIndex )
+		positionIndex = new SpatialHash( cellSize );
+	else
+		positionIndex->SetCellSize( cellSize );
+
+	SyncPositionIndex();
+}
+
+void TriangleMesh::DisablePositionIndex( void )
+{
+	delete positionIndex;
+	positionIndex = nullptr;
+}
+
+void TriangleMesh::InvalidatePositionIndex( void )
+{
+	if( positionIndex )
+		positionIndex->Clear();
+}
+
+bool TriangleMesh::PositionIndexEnabled( void ) const
+{
+	return( positionIndex ? true : false );
+}
+
+// The index only ever grows with the vertex array, so catching up is just a matter of
+// inserting whatever vertices have been appended since we last looked.
+void TriangleMesh::SyncPositionIndex( void ) const
+{
+	if( positionIndex->GetEntryCount() > ( signed )vertexArray->size() )
+		positionIndex->Clear();
+
+	if( positionIndex->GetEntryCount() == 0 )
+		positionIndex->Reserve( ( int )vertexArray->size() );
+
+	for( int i = positionIndex->GetEntryCount(); i < ( signed )vertexArray->size(); i++ )
+		positionIndex->Insert( ( *vertexArray )[i].position, i );
+}
+
 /*static*/ void TriangleMesh::SetEdgePair( uint64_t& edgePair, int index0, int index1 )
 {
 	if( index0 <= index1 )
@@ -400,8 +568,8 @@ void TriangleMesh::GenerateEdgeSet( EdgeSet& edgeSet ) const
 {
 	edgeSet.clear();
 
-	IndexTriangleList::const_iterator iter = triangleList->cbegin();
-	while( iter != triangleList->cend() )
+	IndexTriangleArray::const_iterator iter = triangleArray->cbegin();
+	while( iter != triangleArray->cend() )
 	{
 		const IndexTriangle& indexTriangle = *iter;
 		
@@ -419,6 +587,35 @@ void TriangleMesh::GenerateEdgeSet( EdgeSet& edgeSet ) const
 	}
 }
 
+void TriangleMesh::GenerateEdgeArray( EdgeArray& edgeArray, ThreadPool* threadPool /*= nullptr*/ ) const
+{
+	int triangleCount = ( int )triangleArray->size();
+	edgeArray.resize( 3 * triangleCount );
+
+	auto gatherFunction = [ & ]( int begin, int end )
+	{
+		for( int i = begin; i < end; i++ )
+		{
+			const IndexTriangle& indexTriangle = ( *triangleArray )[i];
+			for( int j = 0; j < 3; j++ )
+				SetEdgePair( edgeArray[ 3 * i + j ], indexTriangle.vertex[j], indexTriangle.vertex[ ( j + 1 ) % 3 ] );
+		}
+	};
+
+	if( threadPool )
+		threadPool->ParallelFor( triangleCount, 4096, gatherFunction );
+	else
+		gatherFunction( 0, triangleCount );
+
+	RadixSortUnique( edgeArray, threadPool );
+}
+
+bool TriangleMesh::Simplify( int targetTriangleCount, double maxError /*= -1.0*/ )
+{
+	MeshSimplifier meshSimplifier;
+	return meshSimplifier.Simplify( *this, *this, targetTriangleCount, maxError );
+}
+
 void TriangleMesh::AddSymmetricVertices( const Vector& vector )
 {
 	for( int i = 0; i < 8; i++ )
@@ -441,189 +638,428 @@ void TriangleMesh::AddSymmetricVertices( const Vector& vector )
 	}
 }
 
-void TriangleMesh::Compress( void )
+// Here we map each vertex to the first vertex (possibly itself) found within the given
+// distance of it, where only vertices mapped to themselves are considered.  The returned
+// value is the number of vertices that map to themselves.  Bucketing the vertices in a
+// spatial hash makes this expected linear time in the number of vertices.
+int TriangleMesh::GenerateWeldMap( std::vector< int >& weldMap, double eps /*= EPSILON*/ ) const
 {
-	VertexArray* compressedVertexArray = new VertexArray();
+	weldMap.resize( vertexArray->size() );
+
+	// Cells somewhat larger than the weld distance mean that most queries only have to visit
+	// one or two cells rather than the eight a cell size of exactly the weld distance costs us.
+	SpatialHash spatialHash( 8.0 * eps );
+	spatialHash.Reserve( ( int )vertexArray->size() );
+
+	int weldedCount = 0;
 
 	for( int i = 0; i < ( signed )vertexArray->size(); i++ )
 	{
-		const Vertex& vertex = ( *vertexArray )[i];
+		const Vector& position = ( *vertexArray )[i].position;
 
-		int j;
-		for( j = 0; j < ( signed )compressedVertexArray->size(); j++ )
+		int j = spatialHash.FindIndex( position, eps );
+		if( j < 0 )
 		{
-			const Vertex& compressedVertex = ( *compressedVertexArray )[j];
-			if( compressedVertex.position.IsEqualTo( vertex.position ) )
-				break;
+			j = i;
+			spatialHash.Insert( position, i );
+			weldedCount++;
 		}
 
-		if( j < ( signed )compressedVertexArray->size() )
-			continue;
+		weldMap[i] = j;
+	}
+
+	return weldedCount;
+}
+
+void TriangleMesh::Compress( double eps /*= EPSILON*/ )
+{
+	std::vector< int > weldMap;
+	int weldedCount = GenerateWeldMap( weldMap, eps );
 
-		compressedVertexArray->push_back( vertex );
+	VertexArray* compressedVertexArray = new VertexArray();
+	compressedVertexArray->reserve( weldedCount );
+
+	std::vector< int > compressedIndexArray( vertexArray->size(), -1 );
 
-		for( IndexTriangleList::iterator iter = triangleList->begin(); iter != triangleList->end(); iter++ )
+	for( int i = 0; i < ( signed )vertexArray->size(); i++ )
+	{
+		if( weldMap[i] == i )
 		{
-			IndexTriangle& indexTriangle = *iter;
-			for( int j = 0; j < 3; j++ )
-				if( ( *vertexArray )[ indexTriangle.vertex[j] ].position.IsEqualTo( vertex.position ) )
-					indexTriangle.vertex[j] = compressedVertexArray->size() - 1;
+			compressedIndexArray[i] = ( int )compressedVertexArray->size();
+			compressedVertexArray->push_back( ( *vertexArray )[i] );
 		}
 	}
 
+	for( IndexTriangleArray::iterator iter = triangleArray->begin(); iter != triangleArray->end(); iter++ )
+	{
+		IndexTriangle& indexTriangle = *iter;
+		for( int j = 0; j < 3; j++ )
+			indexTriangle.vertex[j] = compressedIndexArray[ weldMap[ indexTriangle.vertex[j] ] ];
+	}
+
 	delete vertexArray;
 	vertexArray = compressedVertexArray;
+
+	InvalidatePositionIndex();
 }
 
-bool TriangleMesh::GeneratePolygonFaceList( PolygonList& polygonFaceList, double eps /*= EPSILON*/ ) const
+// This is Tom Forsyth's linear-speed vertex cache optimization.  We greedily emit whichever triangle
+// scores highest, where a triangle's score is the sum of its vertices' scores.  A vertex scores higher
+// the more recently it was used, so that we stay in the cache, and the fewer triangles it has left to
+// emit, so that we finish off vertices rather than leave stragglers we'll have to come back for.
+void TriangleMesh::OptimizeTriangleOrder( int cacheSize /*= 32*/ )
 {
-	// Our algorithm's correctness depends upon the mesh being fully compressed.
-	const_cast< TriangleMesh* >( this )->Compress();
+	int triangleCount = ( int )triangleArray->size();
+	int vertexCount = ( int )vertexArray->size();
+
+	if( triangleCount == 0 || cacheSize < 4 )
+		return;
+
+	for( int i = 0; i < triangleCount; i++ )
+		for( int j = 0; j < 3; j++ )
+			if( !ValidIndex( ( *triangleArray )[i].vertex[j] ) )
+				return;
+
+	// List the triangles using each vertex.  We shrink these lists as triangles are emitted.
+	std::vector< int > vertexOffsetArray( vertexCount + 1, 0 );
+	for( int i = 0; i < triangleCount; i++ )
+		for( int j = 0; j < 3; j++ )
+			vertexOffsetArray[ ( *triangleArray )[i].vertex[j] + 1 ]++;
+
+	for( int i = 0; i < vertexCount; i++ )
+		vertexOffsetArray[ i + 1 ] += vertexOffsetArray[i];
+
+	std::vector< int > remainingCountArray( vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+		remainingCountArray[i] = vertexOffsetArray[ i + 1 ] - vertexOffsetArray[i];
+
+	std::vector< int > vertexTriangleArray( 3 * triangleCount );
+	std::vector< int > cursorArray( vertexOffsetArray.begin(), vertexOffsetArray.end() - 1 );
+	for( int i = 0; i < triangleCount; i++ )
+		for( int j = 0; j < 3; j++ )
+			vertexTriangleArray[ cursorArray[ ( *triangleArray )[i].vertex[j] ]++ ] = i;
+
+	// The scores depend on small integers only, so we look them up rather than call pow() in the inner loop.
+	std::vector< double > cacheScoreArray( cacheSize );
+	for( int i = 0; i < cacheSize; i++ )
+	{
+		// The last triangle's vertices get a fixed score, so as not to favor any particular edge of it.
+		if( i < 3 )
+			cacheScoreArray[i] = 0.75;
+		else
+			cacheScoreArray[i] = pow( 1.0 - double( i - 3 ) / double( cacheSize - 3 ), 1.5 );
+	}
 
-	IndexTriangleList triangleQueue;
-	for( IndexTriangleList::const_iterator iter = triangleList->cbegin(); iter != triangleList->cend(); iter++ )
-		triangleQueue.push_back( *iter );
+	std::vector< double > valenceScoreArray( 32 );
+	for( int i = 1; i < ( signed )valenceScoreArray.size(); i++ )
+		valenceScoreArray[i] = 2.0 * pow( double( i ), -0.5 );
 
-	while( triangleQueue.size() > 0 )
+	auto calculateVertexScore = [ & ]( int cachePosition, int remainingCount ) -> double
 	{
-		IndexTriangleList::iterator iter = triangleQueue.begin();
-		IndexTriangle indexTriangle = *iter;
-		triangleQueue.erase( iter );
+		if( remainingCount == 0 )
+			return -1.0;
 
-		Plane plane;
-		if( !indexTriangle.GetPlane( plane, vertexArray ) )
-			return false;
+		double score = ( cachePosition >= 0 ) ? cacheScoreArray[ cachePosition ] : 0.0;
+
+		if( remainingCount < ( signed )valenceScoreArray.size() )
+			score += valenceScoreArray[ remainingCount ];
+		else
+			score += 2.0 * pow( double( remainingCount ), -0.5 );
+
+		return score;
+	};
+
+	std::vector< int > cachePositionArray( vertexCount, -1 );
+	std::vector< double > vertexScoreArray( vertexCount );
+	for( int i = 0; i < vertexCount; i++ )
+		vertexScoreArray[i] = calculateVertexScore( -1, remainingCountArray[i] );
+
+	std::vector< bool > emittedArray( triangleCount, false );
+	IndexTriangleArray* orderedTriangleArray = new IndexTriangleArray();
+	orderedTriangleArray->reserve( triangleCount );
 
-		IndexTriangleList coplanarList, breadthFirstSearchQueue;
-		breadthFirstSearchQueue.push_back( indexTriangle );
+	// The cache briefly holds up to three more than its size while we push a triangle's vertices into it.
+	std::vector< int > cacheArray, newCacheArray;
+	cacheArray.reserve( cacheSize + 3 );
+	newCacheArray.reserve( cacheSize + 3 );
 
-		while( breadthFirstSearchQueue.size() > 0 )
+	int bestTriangle = 0;
+	int scanCursor = 0;
+
+	while( true )
+	{
+		// If nothing in the cache led us to a triangle, start somewhere fresh.  Rather than search all
+		// triangles for the best one, which would make us quadratic, we take the next one not yet emitted.
+		if( bestTriangle < 0 )
 		{
-			iter = breadthFirstSearchQueue.begin();
-			IndexTriangle coplanarTriangle = *iter;
-			breadthFirstSearchQueue.erase( iter );
+			while( scanCursor < triangleCount && emittedArray[ scanCursor ] )
+				scanCursor++;
 
-			coplanarList.push_back( coplanarTriangle );
+			if( scanCursor == triangleCount )
+				break;
 
-			iter = triangleQueue.begin();
-			while( iter != triangleQueue.end() )
-			{
-				IndexTriangleList::iterator nextIter = iter;
-				nextIter++;
+			bestTriangle = scanCursor;
+		}
 
-				IndexTriangle adjacentTriangle = *iter;
-				if( adjacentTriangle.AdjacentTo( coplanarTriangle ) )
+		const IndexTriangle& indexTriangle = ( *triangleArray )[ bestTriangle ];
+		orderedTriangleArray->push_back( indexTriangle );
+		emittedArray[ bestTriangle ] = true;
+
+		newCacheArray.clear();
+		for( int i = 0; i < 3; i++ )
+		{
+			int vertex = indexTriangle.vertex[i];
+			newCacheArray.push_back( vertex );
+
+			int* triangle = &vertexTriangleArray[ vertexOffsetArray[ vertex ] ];
+			int& remainingCount = remainingCountArray[ vertex ];
+			for( int j = 0; j < remainingCount; j++ )
+			{
+				if( triangle[j] == bestTriangle )
 				{
-					Plane otherPlane;
-					if( !adjacentTriangle.GetPlane( otherPlane, vertexArray ) )
-						return false;
-
-					double dot = otherPlane.normal.Dot( plane.normal );
-					if( fabs( dot - 1.0 ) < eps )
-					{
-						triangleQueue.erase( iter );
-						breadthFirstSearchQueue.push_back( adjacentTriangle );
-					}
+					triangle[j] = triangle[ remainingCount - 1 ];
+					remainingCount--;
+					break;
 				}
+			}
+		}
+
+		for( int i = 0; i < ( signed )cacheArray.size(); i++ )
+		{
+			int vertex = cacheArray[i];
+			if( vertex != indexTriangle.vertex[0] && vertex != indexTriangle.vertex[1] && vertex != indexTriangle.vertex[2] )
+				newCacheArray.push_back( vertex );
+		}
+
+		cacheArray.swap( newCacheArray );
+
+		// Rescore everything that was or is in the cache, and the triangles around those vertices.
+		for( int i = 0; i < ( signed )cacheArray.size(); i++ )
+		{
+			int vertex = cacheArray[i];
+			cachePositionArray[ vertex ] = ( i < cacheSize ) ? i : -1;
+			vertexScoreArray[ vertex ] = calculateVertexScore( cachePositionArray[ vertex ], remainingCountArray[ vertex ] );
+		}
 
-				iter = nextIter;			
+		bestTriangle = -1;
+		double bestScore = -1.0;
+
+		for( int i = 0; i < ( signed )cacheArray.size(); i++ )
+		{
+			int vertex = cacheArray[i];
+			const int* triangle = &vertexTriangleArray[ vertexOffsetArray[ vertex ] ];
+			for( int j = 0; j < remainingCountArray[ vertex ]; j++ )
+			{
+				const IndexTriangle& cachedTriangle = ( *triangleArray )[ triangle[j] ];
+				double score = vertexScoreArray[ cachedTriangle.vertex[0] ] + vertexScoreArray[ cachedTriangle.vertex[1] ] + vertexScoreArray[ cachedTriangle.vertex[2] ];
+
+				if( score > bestScore )
+				{
+					bestScore = score;
+					bestTriangle = triangle[j];
+				}
 			}
 		}
 
-		iter = coplanarList.begin();
-		indexTriangle = *iter;
-		coplanarList.erase( iter );
+		if( ( signed )cacheArray.size() > cacheSize )
+			cacheArray.resize( cacheSize );
+	}
 
-		std::vector< int > loopArray;
+	delete triangleArray;
+	triangleArray = orderedTriangleArray;
+}
+
+void TriangleMesh::OptimizeVertexOrder( void )
+{
+	std::vector< int > indexMap( vertexArray->size(), -1 );
+
+	VertexArray* orderedVertexArray = new VertexArray();
+	orderedVertexArray->reserve( vertexArray->size() );
+
+	for( IndexTriangleArray::iterator iter = triangleArray->begin(); iter != triangleArray->end(); iter++ )
+	{
+		IndexTriangle& indexTriangle = *iter;
 		for( int i = 0; i < 3; i++ )
-			loopArray.push_back( indexTriangle.vertex[i] );
+		{
+			if( !ValidIndex( indexTriangle.vertex[i] ) )
+				continue;
+
+			int& index = indexMap[ indexTriangle.vertex[i] ];
+			if( index < 0 )
+			{
+				index = ( int )orderedVertexArray->size();
+				orderedVertexArray->push_back( ( *vertexArray )[ indexTriangle.vertex[i] ] );
+			}
+
+			indexTriangle.vertex[i] = index;
+		}
+	}
+
+	// Vertices no triangle uses keep their relative order at the end.
+	for( int i = 0; i < ( signed )vertexArray->size(); i++ )
+		if( indexMap[i] < 0 )
+			orderedVertexArray->push_back( ( *vertexArray )[i] );
+
+	delete vertexArray;
+	vertexArray = orderedVertexArray;
+
+	InvalidatePositionIndex();
+}
+
+// This simulates a FIFO cache of the given size and returns the number of cache misses per triangle.
+// A value of 0.5 is about the best possible on large, regular meshes; 3.0 is the worst.
+double TriangleMesh::CalculateAverageCacheMissRatio( int cacheSize /*= 32*/ ) const
+{
+	if( triangleArray->size() == 0 || cacheSize < 1 )
+		return 0.0;
+
+	std::vector< int > cacheTimeArray( vertexArray->size(), -cacheSize );
+	int time = 0, missCount = 0;
 
-		while( coplanarList.size() > 0 )
+	for( IndexTriangleArray::const_iterator iter = triangleArray->cbegin(); iter != triangleArray->cend(); iter++ )
+	{
+		const IndexTriangle& indexTriangle = *iter;
+		for( int i = 0; i < 3; i++ )
 		{
-			unsigned int listSize = coplanarList.size();
+			if( !ValidIndex( indexTriangle.vertex[i] ) )
+				continue;
 
-			for( iter = coplanarList.begin(); iter != coplanarList.end(); iter++ )
+			int& cacheTime = cacheTimeArray[ indexTriangle.vertex[i] ];
+			if( time - cacheTime >= cacheSize )
 			{
-				indexTriangle = *iter;
+				cacheTime = time++;
+				missCount++;
+			}
+		}
+	}
 
-				struct EdgeShare
-				{
-					int i, j;
-					int s, t;
-				};
+	return double( missCount ) / double( triangleArray->size() );
+}
 
-				std::list< EdgeShare > edgeShareList;
-				int vertexShareCount = 0;
+bool TriangleMesh::GeneratePolygonFaceList( PolygonList& polygonFaceList, double eps /*= EPSILON*/ ) const
+{
+	for( IndexTriangleArray::const_iterator iter = triangleArray->cbegin(); iter != triangleArray->cend(); iter++ )
+		for( int i = 0; i < 3; i++ )
+			if( !ValidIndex( iter->vertex[i] ) )
+				return false;
 
-				int i, j, s, t;
+	// Our algorithm's correctness depends upon the mesh being fully compressed, so
+	// we work with a welded copy of the triangles rather than modifying the mesh.
+	std::vector< int > weldMap;
+	GenerateWeldMap( weldMap );
 
-				for( i = 0; i < ( signed )loopArray.size(); i++ )
-				{
-					j = ( i + 1 ) % loopArray.size();
-					
-					for( s = 0; s < 3; s++ )
-					{
-						t = ( s + 1 ) % 3;
-
-						if( loopArray[i] == indexTriangle.vertex[t] &&
-							loopArray[j] == indexTriangle.vertex[s] )
-						{
-							EdgeShare edgeShare;
-							edgeShare.i = i;
-							edgeShare.j = j;
-							edgeShare.s = s;
-							edgeShare.t = t;
-							edgeShareList.push_back( edgeShare );
-						}
-
-						if( loopArray[i] == indexTriangle.vertex[s] )
-							vertexShareCount++;
-					}
-				}
+	IndexTriangleArray weldedTriangleArray;
+	weldedTriangleArray.reserve( triangleArray->size() );
+	for( IndexTriangleArray::const_iterator iter = triangleArray->cbegin(); iter != triangleArray->cend(); iter++ )
+	{
+		IndexTriangle indexTriangle = *iter;
+		for( int i = 0; i < 3; i++ )
+			indexTriangle.vertex[i] = weldMap[ indexTriangle.vertex[i] ];
+		weldedTriangleArray.push_back( indexTriangle );
+	}
 
-				if( edgeShareList.size() == 1 && vertexShareCount < 3 )
-				{
-					EdgeShare edgeShare = edgeShareList.front();
-					std::vector< int >::iterator loopIter( loopArray.begin() + edgeShare.j );
-					loopArray.insert( loopIter, indexTriangle.vertex[ ( edgeShare.s + 2 ) % 3 ] );
-					coplanarList.erase( iter );
-					break;
-				}
-				else if( edgeShareList.size() == 2 )
+	MeshAdjacency meshAdjacency;
+	if( !meshAdjacency.Generate( weldedTriangleArray, ( int )vertexArray->size() ) )
+		return false;
+
+	std::vector< int > faceArray( weldedTriangleArray.size(), -1 );
+	std::vector< int > nextBoundaryHalfEdgeArray( vertexArray->size(), -1 );
+	int faceCount = 0;
+
+	for( int i = 0; i < ( signed )weldedTriangleArray.size(); i++ )
+	{
+		if( faceArray[i] >= 0 )
+			continue;
+
+		Plane plane;
+		if( !weldedTriangleArray[i].GetPlane( plane, vertexArray ) )
+			return false;
+
+		// Flood out across edges to all coplanar triangles connected to this one.
+		int face = faceCount++;
+		faceArray[i] = face;
+
+		std::vector< int > coplanarArray;
+		coplanarArray.push_back( i );
+
+		for( int j = 0; j < ( signed )coplanarArray.size(); j++ )
+		{
+			for( int k = 0; k < 3; k++ )
+			{
+				int adjacentTriangle = meshAdjacency.GetAdjacentTriangle( coplanarArray[j], k );
+				if( adjacentTriangle < 0 || faceArray[ adjacentTriangle ] >= 0 )
+					continue;
+
+				Plane otherPlane;
+				if( !weldedTriangleArray[ adjacentTriangle ].GetPlane( otherPlane, vertexArray ) )
+					return false;
+
+				double dot = otherPlane.normal.Dot( plane.normal );
+				if( fabs( dot - 1.0 ) < eps )
 				{
-					EdgeShare edgeShareA = edgeShareList.front();
-					EdgeShare edgeShareB = edgeShareList.back();
-					if( edgeShareA.j == edgeShareB.i )
-					{
-						std::vector< int >::iterator loopIter( loopArray.begin() + edgeShareA.j );
-						loopArray.erase( loopIter );
-						coplanarList.erase( iter );
-						break;
-					}
-					else if( edgeShareB.j == edgeShareA.i )
-					{
-						std::vector< int >::iterator loopIter( loopArray.begin() + edgeShareB.j );
-						loopArray.erase( loopIter );
-						coplanarList.erase( iter );
-						break;
-					}
+					faceArray[ adjacentTriangle ] = face;
+					coplanarArray.push_back( adjacentTriangle );
 				}
+			}
+		}
 
-				iter++;
+		// The polygon's loop is made of those edges not shared with another triangle of the same face.
+		std::vector< int > boundaryArray;
+		for( int j = 0; j < ( signed )coplanarArray.size(); j++ )
+		{
+			for( int k = 0; k < 3; k++ )
+			{
+				int adjacentTriangle = meshAdjacency.GetAdjacentTriangle( coplanarArray[j], k );
+				if( adjacentTriangle < 0 || faceArray[ adjacentTriangle ] != face )
+					boundaryArray.push_back( 3 * coplanarArray[j] + k );
 			}
+		}
 
-			if( listSize == coplanarList.size() )
-				return false;
+		// If more than one boundary edge leaves a vertex, the loop pinches there, and we can't
+		// say how to go around it.  If they don't all chain into one loop, the face has a hole.
+		// We can represent neither.
+		bool simpleLoop = true;
+		for( int j = 0; j < ( signed )boundaryArray.size(); j++ )
+		{
+			int originVertex = meshAdjacency.GetOriginVertex( boundaryArray[j] );
+			if( nextBoundaryHalfEdgeArray[ originVertex ] >= 0 )
+				simpleLoop = false;
+			nextBoundaryHalfEdgeArray[ originVertex ] = boundaryArray[j];
 		}
 
+		// A face with no boundary at all closes on itself, which no polygon can represent either.
+		if( boundaryArray.size() == 0 )
+			simpleLoop = false;
+
+		std::vector< int > loopArray;
+		if( simpleLoop )
+		{
+			int halfEdge = boundaryArray[0];
+			do
+			{
+				loopArray.push_back( meshAdjacency.GetOriginVertex( halfEdge ) );
+				halfEdge = nextBoundaryHalfEdgeArray[ meshAdjacency.GetTerminalVertex( halfEdge ) ];
+			}
+			while( halfEdge >= 0 && halfEdge != boundaryArray[0] && loopArray.size() <= boundaryArray.size() );
+
+			if( halfEdge != boundaryArray[0] || loopArray.size() != boundaryArray.size() )
+				simpleLoop = false;
+		}
+
+		for( int j = 0; j < ( signed )boundaryArray.size(); j++ )
+			nextBoundaryHalfEdgeArray[ meshAdjacency.GetOriginVertex( boundaryArray[j] ) ] = -1;
+
+		if( !simpleLoop )
+			return false;
+
 		Polygon* polygon = new Polygon();
 		polygonFaceList.push_back( polygon );
 
-		for( int i = 0; i < ( signed )loopArray.size(); i++ )
-			polygon->vertexArray->push_back( ( *vertexArray )[ loopArray[i] ].position );
+		for( int j = 0; j < ( signed )loopArray.size(); j++ )
+			polygon->vertexArray->push_back( ( *vertexArray )[ loopArray[j] ].position );
 	}
 
 	return true;
 }
 
-// TriangleMesh.cpp
\ No newline at end of file
+// TriangleMesh.cpp
@@ -17,6 +17,10 @@ namespace _3DMath
 	class AffineTransform;
 	class AxisAlignedBox;
 	class Vertex;
+	class SpatialHash;
+	class ThreadPool;
+
+	typedef std::list< TriangleMesh* > TriangleMeshList;
 }
 
 class _3DMATH_API _3DMath::TriangleMesh
@@ -30,27 +34,64 @@ public:
 	void Clone( const TriangleMesh& triangleMesh );
 	bool FindConvexHull( void );
 	void AddOrRemoveTriangle( const IndexTriangle& givenIndexTriangle );
-	void CalculateNormals( void );
+	enum NormalWeighting
+	{
+		NORMAL_WEIGHTING_UNIFORM,
+		NORMAL_WEIGHTING_AREA,
+		NORMAL_WEIGHTING_ANGLE,
+	};
+
+	// Each vertex normal is the normalized, weighted sum of the normals of the triangles sharing
+	// that vertex.  Sums are always taken in triangle order, so the results are the same no matter
+	// how many threads, if any, are used.
+	void CalculateNormals( NormalWeighting normalWeighting = NORMAL_WEIGHTING_UNIFORM, ThreadPool* threadPool = nullptr );
 	void CalculateSphericalUVs( void );
 	void SubdivideAllTriangles( double radius );	// TODO: A better version of this could smooth any ridged mesh.  This one only knows convex meshes at origin.
 	void Transform( const AffineTransform& affineTransform );
 	bool GenerateBoundingBox( AxisAlignedBox& boundingBox ) const;
+
+	// This hashes the vertex positions and the triangles, which is all that a tree built from the mesh depends on,
+	// so that something saved along with the hash can later be checked against the mesh it was made from.
+	uint64_t CalculateContentHash( void ) const;
 	void GenerateTriangleList( TriangleList& triangleList, bool skipDegenerates = true ) const;
 	//void GenerateStringMesh( const std::string& string, double fontSize, void* font );
-	void Compress( void );
+	void Compress( double eps = EPSILON );
+	bool Simplify( int targetTriangleCount, double maxError = -1.0 );		// See MeshSimplifier.
+
+	// These reorder the triangles so that consecutive triangles share vertices as much as possible,
+	// which is what a GPU's post-transform vertex cache wants, and then reorder the vertices by first
+	// use, so that reads of the vertex array walk forward through memory.  The mesh is unchanged but
+	// for the order of its elements, so any indices held onto from before are no longer good.
+	void OptimizeTriangleOrder( int cacheSize = 32 );
+	void OptimizeVertexOrder( void );
+	double CalculateAverageCacheMissRatio( int cacheSize = 32 ) const;
+	int GenerateWeldMap( std::vector< int >& weldMap, double eps = EPSILON ) const;
 	//void GenerateFromSurface( const Surface* surface, const AxisAlignedBox& boundingBox );	// TODO: Use a gift-wrapping-type algorithm?  Utilize tangent spaces.
 	void AddSymmetricVertices( const Vector& vector );
 	bool GeneratePolygonFaceList( PolygonList& polygonFaceList, double eps = EPSILON ) const;
 
 	typedef std::set< uint64_t > EdgeSet;
+	typedef std::vector< uint64_t > EdgeArray;
 
 	static void SetEdgePair( uint64_t& edgePair, int index0, int index1 );
 	static void GetEdgePair( uint64_t edgePair, int& index0, int& index1 );
 
 	void GenerateEdgeSet( EdgeSet& edgeSet ) const;
 
+	// This produces the same edges, in the same order, as the edge set, but in a flat array.
+	// It is much faster, and much lighter on memory, for large meshes.
+	void GenerateEdgeArray( EdgeArray& edgeArray, ThreadPool* threadPool = nullptr ) const;
+
 	int FindIndex( const Vector& position, double eps = EPSILON, bool addIfNotFound = false ) const;
 
+	// With a position index enabled, FindIndex is expected constant time rather than linear.
+	// The index picks up vertices appended to the vertex array on its own, but if you move
+	// or remove vertices by accessing the vertex array directly, you must invalidate it.
+	void EnablePositionIndex( double cellSize = EPSILON );
+	void DisablePositionIndex( void );
+	void InvalidatePositionIndex( void );
+	bool PositionIndexEnabled( void ) const;
+
 	void CalculateCenter( Vector& center ) const;
 
 	bool SetVertexPosition( int index, const Vector& position );
@@ -62,10 +103,25 @@ public:
 
 	bool ValidIndex( int index ) const;
 
+	int GetTriangleCount( void ) const;
+	void AddTriangle( const IndexTriangle& indexTriangle );
+	bool RemoveTriangle( int index );		// This is O(1), but does not preserve triangle order.
+	bool SetTriangle( int index, const IndexTriangle& indexTriangle );
+	bool GetTriangle( int index, IndexTriangle& indexTriangle ) const;
+	bool GetTriangle( int index, const IndexTriangle*& indexTriangle ) const;
+
+	bool ValidTriangleIndex( int index ) const;
+
 	// TODO: May want to write a tri-stripper one day.
 
 	std::vector< Vertex >* vertexArray;
-	IndexTriangleList* triangleList;
+	IndexTriangleArray* triangleArray;
+
+private:
+
+	void SyncPositionIndex( void ) const;
+
+	SpatialHash* positionIndex;
 };
 
 // TriangleMesh.h